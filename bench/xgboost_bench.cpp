@@ -0,0 +1,287 @@
+/*!
+ * \file xgboost_bench.cpp
+ * \brief benchmark of data loading, training and prediction, built and run by make bench
+ *
+ *  Usage: xgboost_bench [name=value]...
+ *     data         libsvm text data, synthetic data is generated when not given
+ *     num_row      number of rows of synthetic data, default 100000
+ *     num_feature  number of features of synthetic data, default 1000
+ *     density      fraction of nonzero features in a row of synthetic data, default 0.05
+ *     seed         random seed of synthetic data, default 0
+ *     num_round    number of boosting rounds of each booster, default 10
+ *     booster      tree, linear or all, default all
+ *     compress     1 to train on compressed matrix, see xgboost_data_compressed.h, default 0
+ *     binary_level zlib level of the compressed binary buffer benchmark, 0 to skip it, default 1
+ *     tmp          prefix of temporal files, default xgboost_bench.tmp
+ *     out          result file, default stdout
+ *  other parameters are passed to the model, e.g. bst:tree_method=hist bst:max_depth=8
+ *
+ *  Results are tab separated lines of benchmark name, round, seconds, items and items per second,
+ *  round is -1 for benchmarks that are not done per round, lines start with # are comments.
+ */
+#define _CRT_SECURE_NO_WARNINGS
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <vector>
+#include "../booster/xgboost_gbmbase.h"
+#include "../regression/xgboost_regdata.h"
+#include "../utils/xgboost_utils.h"
+#include "../utils/xgboost_random.h"
+#include "../utils/xgboost_timer.h"
+
+namespace xgboost{
+    namespace bench{
+        /*! \brief parameters of the benchmark */
+        struct BenchParam{
+            /*! \brief path of text data, empty means synthetic data */
+            std::string data;
+            /*! \brief shape of synthetic data */
+            size_t num_row;
+            unsigned num_feature;
+            float density;
+            unsigned seed;
+            /*! \brief number of boosting rounds */
+            int num_round;
+            /*! \brief boosters to run */
+            std::string booster;
+            /*! \brief whether to train on compressed matrix */
+            int compress;
+            /*! \brief zlib level of compressed binary buffer */
+            int binary_level;
+            /*! \brief prefix of temporal files */
+            std::string tmp;
+            /*! \brief result file, empty means stdout */
+            std::string out;
+            /*! \brief parameters passed to the model */
+            std::vector< std::pair<std::string,std::string> > model_cfg;
+            BenchParam( void ){
+                num_row = 100000; num_feature = 1000; density = 0.05f; seed = 0;
+                num_round = 10; booster = "all"; compress = 0; binary_level = 1; tmp = "xgboost_bench.tmp";
+            }
+            /*!
+             * \brief set parameters from outside
+             * \param name name of the parameter
+             * \param val  value of the parameter
+             */
+            inline void SetParam( const char *name, const char *val ){
+                if( !strcmp( "data", name ) )        { data = val; return; }
+                if( !strcmp( "num_row", name ) )     { num_row = static_cast<size_t>( atof( val ) ); return; }
+                if( !strcmp( "num_feature", name ) ) { num_feature = static_cast<unsigned>( atoi( val ) ); return; }
+                if( !strcmp( "density", name ) )     { density = static_cast<float>( atof( val ) ); return; }
+                if( !strcmp( "seed", name ) )        { seed = static_cast<unsigned>( atoi( val ) ); return; }
+                if( !strcmp( "num_round", name ) )   { num_round = atoi( val ); return; }
+                if( !strcmp( "booster", name ) )     { booster = val; return; }
+                if( !strcmp( "compress", name ) )    { compress = atoi( val ); return; }
+                if( !strcmp( "binary_level", name ) ){ binary_level = atoi( val ); return; }
+                if( !strcmp( "tmp", name ) )         { tmp = val; return; }
+                if( !strcmp( "out", name ) )         { out = val; return; }
+                model_cfg.push_back( std::make_pair( std::string( name ), std::string( val ) ) );
+            }
+        };
+        /*! \brief writer of results */
+        class BenchReporter{
+        public:
+            BenchReporter( FILE *fo ):fo( fo ){
+                fprintf( fo, "# benchmark\tround\tseconds\titems\titems_per_sec\n" );
+            }
+            /*!
+             * \brief report result of a benchmark
+             * \param name name of the benchmark
+             * \param round boosting round, -1 if not done per round
+             * \param sec seconds used
+             * \param items number of items processed, e.g. rows or entries
+             */
+            inline void Report( const std::string &name, int round, double sec, size_t items ){
+                fprintf( fo, "%s\t%d\t%.6f\t%lu\t%.1f\n", name.c_str(), round, sec, (unsigned long)items,
+                         sec > 0.0 ? items / sec : 0.0 );
+                fflush( fo );
+            }
+            /*! \brief stream of results, used to write comments */
+            inline FILE *Stream( void ){
+                return fo;
+            }
+        private:
+            FILE *fo;
+        };
+        /*! \brief size of a file in bytes */
+        inline size_t FileSize( const char *fname ){
+            FILE *fi = utils::FopenCheck( fname, "rb" );
+            fseek( fi, 0, SEEK_END );
+            const size_t size = static_cast<size_t>( ftell( fi ) );
+            fclose( fi );
+            return size;
+        }
+        /*!
+         * \brief write synthetic data in libsvm format, a quarter of the features are binary, the others uniform in [0,1),
+         *        label is a linear function of every tenth feature plus gaussian noise
+         * \param param shape of the data
+         * \param fname name of the output file
+         * \return number of nonzero entries written
+         */
+        inline size_t GenSynthetic( const BenchParam &param, const char *fname ){
+            random::Seed( param.seed );
+            std::vector<float> weight( param.num_feature, 0.0f );
+            for( unsigned j = 0; j < param.num_feature; j += 10 ){
+                weight[ j ] = static_cast<float>( random::SampleNormal() );
+            }
+            FILE *fo = utils::FopenCheck( fname, "w" );
+            const double logq = param.density < 1.0f ? log( 1.0 - param.density ) : 0.0;
+            std::vector<unsigned> findex; std::vector<float> fvalue;
+            size_t nentry = 0;
+            for( size_t i = 0; i < param.num_row; i ++ ){
+                findex.resize( 0 ); fvalue.resize( 0 );
+                double label = random::SampleNormal() * 0.1;
+                // gaps between nonzero features are geometric, so the cost is linear in number of nonzeros
+                for( double j = -1.0; ; ){
+                    j += param.density < 1.0f ? 1.0 + floor( log( random::NextDouble2() ) / logq ) : 1.0;
+                    if( j >= param.num_feature ) break;
+                    const unsigned fid = static_cast<unsigned>( j );
+                    const float fv = fid % 4 == 0 ? 1.0f : floor( random::NextDouble() * 10000.0f ) / 10000.0f;
+                    findex.push_back( fid ); fvalue.push_back( fv );
+                    label += weight[ fid ] * fv;
+                }
+                fprintf( fo, "%g", label );
+                for( size_t k = 0; k < findex.size(); k ++ ){
+                    fprintf( fo, " %u:%g", findex[k], fvalue[k] );
+                }
+                fprintf( fo, "\n" );
+                nentry += findex.size();
+            }
+            fclose( fo );
+            return nentry;
+        }
+        /*!
+         * \brief train a model with square loss and time the rounds and the prediction
+         * \param name prefix of benchmark names
+         * \param booster_type type of booster
+         * \param param benchmark parameters
+         * \param dmat training data
+         * \param rep reporter of results
+         */
+        inline void RunBooster( const std::string &name, int booster_type, const BenchParam &param,
+                                const regression::DMatrix &dmat, BenchReporter &rep ){
+            const size_t nrow = dmat.labels.size();
+            char buf[ 32 ];
+            booster::GBMBaseModel model;
+            sprintf( buf, "%d", booster_type ); model.SetParam( "booster_type", buf );
+            sprintf( buf, "%u", dmat.num_feature ); model.SetParam( "bst:num_feature", buf );
+            sprintf( buf, "%lu", (unsigned long)nrow ); model.SetParam( "num_pbuffer", buf );
+            model.SetParam( "silent", "1" ); model.SetParam( "bst:silent", "1" );
+            for( size_t i = 0; i < param.model_cfg.size(); i ++ ){
+                model.SetParam( param.model_cfg[i].first.c_str(), param.model_cfg[i].second.c_str() );
+            }
+            model.InitModel(); model.InitTrainer();
+            booster::FMatrixS::Image img( dmat.data, dmat.PagedRows() );
+            std::vector<float> pred( nrow ), grad( nrow ), hess( nrow );
+            std::vector<unsigned> root_index;
+            for( int r = 0; r < param.num_round; r ++ ){
+                double tstart = utils::GetTime();
+                model.PredictBatch( img, nrow, &pred[0], 0 );
+                rep.Report( name + ".predict_buffer", r, utils::GetTime() - tstart, nrow );
+                for( size_t i = 0; i < nrow; i ++ ){
+                    grad[ i ] = pred[ i ] - dmat.labels[ i ]; hess[ i ] = 1.0f;
+                }
+                tstart = utils::GetTime();
+                model.DoBoost( grad, hess, img, root_index, 0 );
+                rep.Report( name + ".boost", r, utils::GetTime() - tstart, nrow );
+            }
+            double tstart = utils::GetTime();
+            double sum_sqr = 0.0;
+            for( size_t i = 0; i < nrow; i ++ ){
+                const float p = model.Predict( img[ i ] );
+                sum_sqr += ( p - dmat.labels[ i ] ) * ( p - dmat.labels[ i ] );
+            }
+            rep.Report( name + ".predict_single", -1, utils::GetTime() - tstart, nrow );
+            tstart = utils::GetTime();
+            model.PredictBatch( img, nrow, &pred[0] );
+            rep.Report( name + ".predict_batch", -1, utils::GetTime() - tstart, nrow );
+            // decision against threshold 0 with early exit, ntree counts the boosters evaluated
+            size_t nabove = 0, ntree = 0;
+            tstart = utils::GetTime();
+            for( size_t i = 0; i < nrow; i ++ ){
+                unsigned n;
+                if( model.PredictAbove( img[ i ], 0.0f, 1.0f, 0, 0, &n ) ) nabove += 1;
+                ntree += n;
+            }
+            rep.Report( name + ".predict_above", -1, utils::GetTime() - tstart, nrow );
+            fprintf( rep.Stream(), "# %s predict_above %lu rows above, %.2f boosters per row\n", name.c_str(),
+                     (unsigned long)nabove, nrow != 0 ? (double)ntree / nrow : 0.0 );
+            fprintf( rep.Stream(), "# %s train-rmse %f\n", name.c_str(), nrow != 0 ? sqrt( sum_sqr / nrow ) : 0.0 );
+        }
+    };
+};
+
+using namespace xgboost;
+
+int main( int argc, char *argv[] ){
+    bench::BenchParam param;
+    for( int i = 1; i < argc; i ++ ){
+        char name[ 256 ], val[ 256 ];
+        if( sscanf( argv[i], "%255[^=]=%255s", name, val ) == 2 ) param.SetParam( name, val );
+    }
+    FILE *fo = param.out.length() != 0 ? utils::FopenCheck( param.out.c_str(), "w" ) : stdout;
+    bench::BenchReporter rep( fo );
+    const std::string ftext = param.data.length() != 0 ? param.data : param.tmp + ".txt";
+    const std::string fbinary = param.tmp + ".buffer";
+    double tstart;
+    if( param.data.length() == 0 ){
+        tstart = utils::GetTime();
+        const size_t nentry = bench::GenSynthetic( param, ftext.c_str() );
+        rep.Report( "gen_text", -1, utils::GetTime() - tstart, nentry );
+    }
+    regression::DMatrix dmat;
+    tstart = utils::GetTime();
+    dmat.LoadText( ftext.c_str(), true );
+    rep.Report( "load_text", -1, utils::GetTime() - tstart, dmat.data.NumEntry() );
+    tstart = utils::GetTime();
+    dmat.SaveBinary( fbinary.c_str(), true );
+    rep.Report( "save_binary", -1, utils::GetTime() - tstart, dmat.data.NumEntry() );
+    {
+        regression::DMatrix dbinary;
+        tstart = utils::GetTime();
+        utils::Assert( dbinary.LoadBinary( fbinary.c_str(), true ), "fail to load binary buffer" );
+        rep.Report( "load_binary", -1, utils::GetTime() - tstart, dbinary.data.NumEntry() );
+    }
+    if( param.binary_level != 0 ){
+        const size_t plain = bench::FileSize( fbinary.c_str() );
+        tstart = utils::GetTime();
+        dmat.SaveBinary( fbinary.c_str(), true, param.binary_level );
+        rep.Report( "save_binary_z", -1, utils::GetTime() - tstart, dmat.data.NumEntry() );
+        fprintf( fo, "# binary buffer of %lu bytes is compressed into %lu bytes\n",
+                 (unsigned long)plain, (unsigned long)bench::FileSize( fbinary.c_str() ) );
+        regression::DMatrix dbinary;
+        tstart = utils::GetTime();
+        utils::Assert( dbinary.LoadBinary( fbinary.c_str(), true ), "fail to load compressed binary buffer" );
+        rep.Report( "load_binary_z", -1, utils::GetTime() - tstart, dbinary.data.NumEntry() );
+    }
+    remove( fbinary.c_str() );
+    if( param.data.length() == 0 ) remove( ftext.c_str() );
+    const size_t nentry = dmat.data.NumEntry();
+    if( param.compress != 0 ){
+        tstart = utils::GetTime();
+        dmat.Compress( true );
+        rep.Report( "compress", -1, utils::GetTime() - tstart, nentry );
+        fprintf( fo, "# compressed %lu entries into %lu bytes\n", (unsigned long)nentry, (unsigned long)dmat.compressed.Bytes() );
+    }else{
+        tstart = utils::GetTime();
+        dmat.data.InitColAccess();
+        rep.Report( "init_col_access", -1, utils::GetTime() - tstart, nentry );
+        if( param.booster == "all" || param.booster == "linear" ){
+            tstart = utils::GetTime();
+            dmat.data.InitRowOrderCol();
+            rep.Report( "init_row_order_col", -1, utils::GetTime() - tstart, nentry );
+        }
+    }
+    fprintf( fo, "# %lu rows, %u features, %lu entries\n", (unsigned long)dmat.labels.size(), dmat.num_feature, (unsigned long)nentry );
+    if( param.booster == "all" || param.booster == "tree" ){
+        bench::RunBooster( "tree", 0, param, dmat, rep );
+    }
+    if( param.booster == "all" || param.booster == "linear" ){
+        bench::RunBooster( "linear", 1, param, dmat, rep );
+    }
+    if( fo != stdout ) fclose( fo );
+    return 0;
+}
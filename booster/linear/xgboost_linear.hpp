@@ -3,7 +3,8 @@
 /*!
  * \file xgboost_linear.h
  * \brief Implementation of Linear booster, with L1/L2 regularization: Elastic Net
- *        the update rule is coordinate descent
+ *        the update rule is coordinate descent, features can be updated in parallel blocks, shotgun style,
+ *        the sorted column index of training data is used as column major data when it is available
  * \author Tianqi Chen: tianqi.tchen@gmail.com
  */
 #include <vector>
@@ -12,13 +13,14 @@
 #include "../xgboost.h"
 #include "../../utils/xgboost_utils.h"
 #include "../../utils/xgboost_matrix_csr.h"
+#include "../../utils/xgboost_omp.h"
 
 namespace xgboost{
     namespace booster{
         /*! \brief linear model, with L1/L2 regularization */
         class LinearBooster : public IBooster{
         public:
-            LinearBooster( void ){ silent = 0;}
+            LinearBooster( void ){ silent = 0; stats = NULL; }
             virtual ~LinearBooster( void ){}
         public:
             virtual void SetParam( const char *name, const char *val ){
@@ -41,7 +43,11 @@ namespace xgboost{
                                   const FMatrixS::Image &smat,
                                   const std::vector<unsigned> &root_index ){
                 utils::Assert( grad.size() < UINT_MAX, "number of instance exceed what we can handle" );
+                ScopedTimer timer( stats, BoostStats::kLinearUpdate );
                 this->Update( smat, grad, hess );
+            }
+            virtual void SetStats( BoostStats *stats ){
+                this->stats = stats;
             }            
             virtual float Predict( const FMatrixS::Line &sp, unsigned rid = 0 ){
                 float sum = model.bias();
@@ -60,6 +66,14 @@ namespace xgboost{
                 }
                 return sum;
             }
+            virtual void PredictBatch( const FMatrixS::Image &feats, size_t nrow,
+                                       const std::vector<unsigned> &root_index, float *out ){
+                const long ndata = static_cast<long>( nrow );
+                #pragma omp parallel for schedule( static, 256 ) num_threads( param.nthread > 0 ? param.nthread : omp_get_max_threads() )
+                for( long i = 0; i < ndata; i ++ ){
+                    out[ i ] += this->Predict( feats[ i ] );
+                }
+            }
         protected:
             // training parameter
             struct ParamTrain{
@@ -71,10 +85,22 @@ namespace xgboost{
                 float reg_alpha;
                  /*! \brief regularization weight for L2 norm  in bias */               
                 float reg_lambda_bias;
+                /*! \brief number of threads, 0 means the OpenMP default */
+                int nthread;
+                /*! 
+                 * \brief number of features updated together in parallel, default 1 means sequential coordinate descent,
+                 *        features in a block see gradient before the block, large block may need smaller learning_rate
+                 */
+                int feature_block;
+                /*! \brief whether gradient updates of a block are applied in feature order, so result is independent of nthread */
+                int deterministic;
                 
                 ParamTrain( void ){
                     reg_alpha = 0.0f; reg_lambda = 0.0f; reg_lambda_bias = 0.0f;
                     learning_rate = 1.0f;
+                    nthread = 0;
+                    feature_block = 1;
+                    deterministic = 1;
                 }            
                 inline void SetParam( const char *name, const char *val ){
                     // sync-names
@@ -87,6 +113,9 @@ namespace xgboost{
                     if( !strcmp( "reg_lambda", name ) )    reg_lambda = (float)atof( val );
                     if( !strcmp( "reg_alpha", name ) )     reg_alpha = (float)atof( val );
                     if( !strcmp( "reg_lambda_bias", name ) )    reg_lambda_bias = (float)atof( val );
+                    if( !strcmp( "nthread", name ) )       nthread = atoi( val );
+                    if( !strcmp( "feature_block", name ) ) feature_block = atoi( val );
+                    if( !strcmp( "deterministic", name ) ) deterministic = atoi( val );
                 }
                 // given original weight calculate delta 
                 inline double CalcDelta( double sum_grad, double sum_hess, double w ){
@@ -140,9 +169,9 @@ namespace xgboost{
                 }
                 // load model from file
                 inline void LoadModel( utils::IStream &fi ){
-                    utils::Assert( fi.Read( &param, sizeof(Param) ) != 0, "Load LinearBooster" );
+                    utils::Assert( fi.Read( &param, sizeof(Param) ) == sizeof(Param), "Load LinearBooster" );
                     weight.resize( param.num_feature + 1 );
-                    utils::Assert( fi.Read( &weight[0], sizeof(float) * weight.size() ) != 0, "Load LinearBooster" );
+                    utils::Assert( fi.Read( &weight[0], sizeof(float) * weight.size() ) == sizeof(float) * weight.size(), "Load LinearBooster" );
                 }
                 // model bias
                 inline float &bias( void ){
@@ -162,70 +191,154 @@ namespace xgboost{
                     this->fvalue = fvalue; this->rindex = rindex;
                 }
             };
+            /*! \brief columns of column major data built by MakeCmajor, column i is feature fstart + i */
+            struct CmajorCols{
+                typedef SCEntry Entry;
+                const std::vector<size_t> &rptr;
+                const std::vector<SCEntry> &entry;
+                int fstart;
+                CmajorCols( const std::vector<size_t> &rptr, const std::vector<SCEntry> &entry, int fstart )
+                    :rptr( rptr ), entry( entry ), fstart( fstart ){}
+                /*! \brief get column of feature fid, return length of the column */
+                inline size_t Get( int fid, const Entry *&col ) const{
+                    const size_t start = rptr[ fid - fstart ], len = rptr[ fid - fstart + 1 ] - start;
+                    if( len != 0 ) col = &entry[ start ];
+                    return len;
+                }
+            };
+            /*! \brief columns of row ordered column copy of the data, built once and shared by all the rounds */
+            struct IndexCols{
+                typedef FMatrixS::REntry Entry;
+                const FMatrixS::Image &smat;
+                IndexCols( const FMatrixS::Image &smat ):smat( smat ){}
+                inline size_t Get( int fid, const Entry *&col ) const{
+                    if( (size_t)fid >= smat.NumRowOrderCol() ) return 0;
+                    FMatrixS::Col c = smat.GetRowOrderCol( fid );
+                    col = c.data;
+                    return c.len;
+                }
+            };
         private:
             int silent;
+            /*! \brief statistics to add profile to, NULL if not profiling */
+            BoostStats *stats;
         protected:
             Model model;
             ParamTrain param;
         protected:
+            // optimize bias
+            inline void UpdateBias( std::vector<float> &grad,                       
+                                    const std::vector<float> &hess ){
+                double sum_grad = 0.0, sum_hess = 0.0;
+                for( size_t i = 0; i < grad.size(); i ++ ){
+                    sum_grad += grad[ i ]; sum_hess += hess[ i ];
+                }
+                // remove bias effect
+                double dw = param.learning_rate * param.CalcDeltaBias( sum_grad, sum_hess, model.bias() );
+                model.bias() += dw;
+                // update grad value 
+                for( size_t i = 0; i < grad.size(); i ++ ){
+                    grad[ i ] += dw * hess[ i ];
+                }
+            }
+            // optimal change of weight of feature fid, given its column
+            template<typename Entry>
+            inline double CalcFeatureDelta( const std::vector<float> &grad,                       
+                                            const std::vector<float> &hess,
+                                            const Entry *col, size_t len, int fid ){
+                double sum_grad = 0.0, sum_hess = 0.0;
+                for( size_t j = 0; j < len; j ++ ){
+                    const float v = col[j].fvalue; 
+                    sum_grad += grad[ col[j].rindex ] * v;
+                    sum_hess += hess[ col[j].rindex ] * v * v;
+                }
+                return param.learning_rate * param.CalcDelta( sum_grad, sum_hess, model.weight[ fid ] );
+            }
+            // update grad value after weight of a feature changes by dw
+            template<typename Entry>
+            inline static void AddFeatureDelta( std::vector<float> &grad,                       
+                                                const std::vector<float> &hess,
+                                                const Entry *col, size_t len, double dw ){
+                for( size_t j = 0; j < len; j ++ ){
+                    grad[ col[j].rindex ] += hess[ col[j].rindex ] * col[j].fvalue * dw;
+                }
+            }
+            // optimize weight of features in [fstart,fend), columns are given by cols
+            template<typename ColSource>
             inline void UpdateWeights( std::vector<float> &grad,                       
                                        const std::vector<float> &hess,
-                                       const std::vector<size_t> &rptr,
-                                       const std::vector<SCEntry> &entry ){
-                {// optimize bias
-                    double sum_grad = 0.0, sum_hess = 0.0;
-                    for( size_t i = 0; i < grad.size(); i ++ ){
-                        sum_grad += grad[ i ]; sum_hess += hess[ i ];
-                    }
-                    // remove bias effect
-                    double dw = param.learning_rate * param.CalcDeltaBias( sum_grad, sum_hess, model.bias() );
-                    model.bias() += dw;
-                    // update grad value 
-                    for( size_t i = 0; i < grad.size(); i ++ ){
-                        grad[ i ] += dw * hess[ i ];
+                                       const ColSource &cols,
+                                       int fstart, int fend ){
+                typedef typename ColSource::Entry Entry;
+                if( param.feature_block <= 1 ){
+                    for( int i = fstart; i < fend; i ++ ){
+                        const Entry *col;
+                        const size_t len = cols.Get( i, col );
+                        if( len == 0 ) continue;
+                        double dw = this->CalcFeatureDelta( grad, hess, col, len, i );
+                        model.weight[ i ] += dw;
+                        this->AddFeatureDelta( grad, hess, col, len, dw );
                     }
+                    return;
                 }
-
-                // optimize weight
-                const int nfeat = model.param.num_feature;                               
-                for( int i = 0; i < nfeat; i ++ ){
-                    size_t start = rptr[i];
-                    size_t end   = rptr[i+1];
-                    if( start >= end ) continue;
-                    double sum_grad = 0.0, sum_hess = 0.0;
-                    for( size_t j = start; j < end; j ++ ){
-                        const float v = entry[j].fvalue; 
-                        sum_grad += grad[ entry[j].rindex ] * v;
-                        sum_hess += hess[ entry[j].rindex ] * v * v;
+                // shotgun: deltas of a block are computed in parallel from the same gradient, then applied
+                const int bsize = param.feature_block;
+                const int nthread = param.nthread > 0 ? param.nthread : omp_get_max_threads();
+                std::vector<double> delta( bsize );
+                for( int bstart = fstart; bstart < fend; bstart += bsize ){
+                    const int bend = std::min( bstart + bsize, fend );
+                    #pragma omp parallel for schedule( dynamic, 64 ) num_threads( nthread )
+                    for( int i = bstart; i < bend; i ++ ){
+                        const Entry *col;
+                        const size_t len = cols.Get( i, col );
+                        delta[ i - bstart ] = len == 0 ? 0.0 : this->CalcFeatureDelta( grad, hess, col, len, i );
                     }
-                    float w = model.weight[ i ];
-                    double dw = param.learning_rate * param.CalcDelta( sum_grad, sum_hess, w );
-                    model.weight[ i ] += dw;
-                    // update grad value 
-                    for( size_t j = start; j < end; j ++ ){
-                        const float v = entry[j].fvalue; 
-                        grad[ entry[j].rindex ] += hess[ entry[j].rindex ] * v * dw;
+                    for( int i = bstart; i < bend; i ++ ){
+                        model.weight[ i ] += delta[ i - bstart ];
+                    }
+                    if( param.deterministic != 0 ){
+                        for( int i = bstart; i < bend; i ++ ){
+                            if( delta[ i - bstart ] == 0.0 ) continue;
+                            const Entry *col;
+                            const size_t len = cols.Get( i, col );
+                            this->AddFeatureDelta( grad, hess, col, len, delta[ i - bstart ] );
+                        }
+                    }else{
+                        // features of a block share rows, so updates to grad are atomic
+                        #pragma omp parallel for schedule( dynamic, 64 ) num_threads( nthread )
+                        for( int i = bstart; i < bend; i ++ ){
+                            const double dw = delta[ i - bstart ];
+                            if( dw == 0.0 ) continue;
+                            const Entry *col;
+                            const size_t len = cols.Get( i, col );
+                            for( size_t j = 0; j < len; j ++ ){
+                                const float g = static_cast<float>( hess[ col[j].rindex ] * col[j].fvalue * dw );
+                                #pragma omp atomic
+                                grad[ col[j].rindex ] += g;
+                            }
+                        }
                     }
                 }
             }
             
+            // build column major format of features in [fstart,fend), the rows are visited in order
             inline void MakeCmajor( std::vector<size_t> &rptr,
                                     std::vector<SCEntry> &entry,
                                     const std::vector<float> &hess,                                 
-                                    const FMatrixS::Image &smat ){
-                // transform to column order first
-                const int nfeat = model.param.num_feature;            
+                                    const FMatrixS::Image &smat,
+                                    int fstart, int fend ){
                 // build CSR column major format data
                 utils::SparseCSRMBuilder<SCEntry> builder( rptr, entry );
-                builder.InitBudget( nfeat );
+                builder.InitBudget( fend - fstart );
                 for( unsigned i = 0; i < (unsigned)hess.size(); i ++ ){
                 // skip deleted entries
                     if( hess[i] < 0.0f ) continue;
                     // add sparse part budget
                     FMatrixS::Line sp = smat[ i ];
                     for( unsigned j = 0; j < sp.len; j ++ ){
+                        if( sp.findex[j] < (unsigned)fstart || sp.findex[j] >= (unsigned)fend ) continue;
                         if( j == 0 || sp.findex[j-1] != sp.findex[j] ){
-                            builder.AddBudget( sp.findex[j] );
+                            builder.AddBudget( sp.findex[j] - fstart );
                         }
                     }
                 }
@@ -236,9 +349,10 @@ namespace xgboost{
                     // add sparse part budget
                     FMatrixS::Line sp = smat[ i ];
                     for( unsigned j = 0; j < sp.len; j ++ ){
+                        if( sp.findex[j] < (unsigned)fstart || sp.findex[j] >= (unsigned)fend ) continue;
                         // skip duplicated terms
                         if( j == 0 || sp.findex[j-1] != sp.findex[j] ){
-                            builder.PushElem( sp.findex[j], SCEntry( sp.fvalue[j], i ) );
+                            builder.PushElem( sp.findex[j] - fstart, SCEntry( sp.fvalue[j], i ) );
                         }
                     }
                 }
@@ -247,10 +361,50 @@ namespace xgboost{
             virtual void Update( const FMatrixS::Image &smat,
                                  std::vector<float> &grad,
                                  const std::vector<float> &hess ){
+                const int nfeat = model.param.num_feature;
                 std::vector<size_t> rptr;
                 std::vector<SCEntry> entry;
-                this->MakeCmajor( rptr, entry, hess, smat );
-                this->UpdateWeights( grad, hess, rptr, entry );
+                this->UpdateBias( grad, hess );
+                // row ordered column copy of training data is built once and shared by all the rounds,
+                // it contains all rows, so a filtered copy is still made when some rows are deleted
+                if( smat.HaveRowOrderCol() ){
+                    bool has_deleted = false;
+                    for( size_t i = 0; i < hess.size(); i ++ ){
+                        if( hess[i] < 0.0f ){
+                            has_deleted = true; break;
+                        }
+                    }
+                    if( !has_deleted ){
+                        this->UpdateWeights( grad, hess, IndexCols( smat ), 0, nfeat );
+                        return;
+                    }
+                }
+                if( !smat.IsPaged() ){
+                    this->MakeCmajor( rptr, entry, hess, smat, 0, nfeat );
+                    this->UpdateWeights( grad, hess, CmajorCols( rptr, entry, 0 ), 0, nfeat );
+                    return;
+                }
+                // paged rows: features are processed in blocks, so that the column copy of each block 
+                // is bounded by the page cache, the rows are streamed once per block
+                std::vector<size_t> fcount( nfeat, 0 );
+                for( unsigned i = 0; i < (unsigned)hess.size(); i ++ ){
+                    if( hess[i] < 0.0f ) continue;
+                    FMatrixS::Line sp = smat[ i ];
+                    for( unsigned j = 0; j < sp.len; j ++ ){
+                        if( sp.findex[j] < (unsigned)nfeat ) fcount[ sp.findex[j] ] ++;
+                    }
+                }
+                const size_t budget = std::max( smat.Paged()->BudgetEntry(), (size_t)1 );
+                for( int fstart = 0; fstart < nfeat; ){
+                    int fend = fstart + 1;
+                    size_t cnt = fcount[ fstart ];
+                    while( fend < nfeat && cnt + fcount[ fend ] <= budget ){
+                        cnt += fcount[ fend ]; fend ++;
+                    }
+                    this->MakeCmajor( rptr, entry, hess, smat, fstart, fend );
+                    this->UpdateWeights( grad, hess, CmajorCols( rptr, entry, fstart ), fstart, fend );
+                    fstart = fend;
+                }
             }
         };
     };
@@ -6,10 +6,15 @@
  *        this file is adapted from GBRT implementation in SVDFeature project
  * \author Tianqi Chen: tqchen@apex.sjtu.edu.cn, tianqi.tchen@gmail.com 
  */
+#include <cstring>
 #include <algorithm>
+#include <limits>
+#include <pthread.h>
 #include "xgboost_tree_model.h"
 #include "../../utils/xgboost_random.h"
 #include "../../utils/xgboost_matrix_csr.h"
+#include "../../utils/xgboost_omp.h"
+#include "../../utils/xgboost_quantile.h"
 
 namespace xgboost{
     namespace booster{
@@ -71,6 +76,14 @@ namespace xgboost{
                 inline bool default_left( void ) const{
                     return (sindex >> 31) != 0;
                 }
+                /*! 
+                 * \brief whether e should replace current entry, ties are broken by smaller feature index, 
+                 *        so the selection does not depend on the order entries are pushed from different threads
+                 */
+                inline bool need_replace( const Entry &e ) const{
+                    if( e.loss_chg == loss_chg ) return e.split_index() < this->split_index();
+                    return e.loss_chg > loss_chg;
+                }
             };
         private:
             Entry best_entry;
@@ -81,7 +94,7 @@ namespace xgboost{
                 best_entry.loss_chg = 0.0f;
             }
             inline void push_back( const Entry &e ){
-                if( e.loss_chg > best_entry.loss_chg ) best_entry = e;
+                if( best_entry.need_replace( e ) ) best_entry = e;
             }
             inline const Entry & select( void ){            
                 return best_entry;                
@@ -101,12 +114,50 @@ namespace xgboost{
                 unsigned len;            
                 // base_weight of parent
                 float parent_base_weight;
+                // index of gradient histogram in hist_pool, used in histogram mode, -1 means not built
+                int hist;
                 Task(){}
                 Task( int nid, unsigned *idset, unsigned len, float pweight = 0.0f ){
                     this->nid = nid;
                     this->idset = idset;
                     this->len = len;
                     this->parent_base_weight = pweight;
+                    this->hist = -1;
+                }
+            };
+            
+            // one bin of gradient histogram
+            struct HistEntry{
+                double sum_grad;
+                double sum_hess;
+                inline void clear( void ){
+                    sum_grad = sum_hess = 0.0;
+                }
+                inline void add( double grad, double hess ){
+                    sum_grad += grad; sum_hess += hess;
+                }
+                inline void add( const HistEntry &e ){
+                    sum_grad += e.sum_grad; sum_hess += e.sum_hess;
+                }
+                inline void sub( const HistEntry &e ){
+                    sum_grad -= e.sum_grad; sum_hess -= e.sum_hess;
+                }
+            };
+            
+            // quantized bins of features, used in histogram mode
+            struct HistCut{
+                // bins of feature fid are [ cut_ptr[fid], cut_ptr[fid+1] )
+                std::vector<unsigned> cut_ptr;
+                // cut_value[b]: feature values smaller than cut_value[b] fall into bins no larger than b
+                std::vector<float> cut_value;
+                // minimum value of each feature
+                std::vector<float> min_value;
+                // get the global bin index of a feature value
+                inline unsigned get_bin( unsigned fid, float fvalue ) const{
+                    const float *begin = &cut_value[ cut_ptr[ fid ] ];
+                    // the last cut is above all values
+                    const float *end = begin + ( cut_ptr[ fid + 1 ] - cut_ptr[ fid ] - 1 );
+                    return cut_ptr[ fid ] + static_cast<unsigned>( std::upper_bound( begin, end, fvalue ) - begin );
                 }
             };
             
@@ -124,6 +175,37 @@ namespace xgboost{
                     return fvalue < p.fvalue;
                 }
             };
+
+            // level-wise mode: node of the level to be expanded, with statistics of its rows
+            struct LevelNode{
+                Task tsk;
+                int depth;
+                double sum_grad, sum_hess;
+                // cost of the node as root, and weight of the node if it is leaf
+                double root_cost, base_weight;
+            };
+            // level-wise mode: statistics and node slot of a row, packed so that a column entry touches one place
+            struct LevelRow{
+                float grad, hess;
+                // slot of the node of the row in current level, -1 if the row is not in it
+                int slot;
+            };
+            // level-wise mode: state of the scan of a column for one node of the level
+            struct ScanState{
+                // statistics of entries scanned so far
+                double csum_grad, csum_hess;
+                // feature value of first and last entry scanned
+                float first_fvalue, last_fvalue;
+                // scan that the state belongs to, the state is reset when a new scan touches it
+                int stamp;
+            };
+            // level-wise mode: boundary between two distinct values of a node met by a column scan,
+            // with the statistics of the entries before it
+            struct ScanBound{
+                int k;
+                float split_value;
+                double csum_grad, csum_hess;
+            };
         private:
             // training parameter
             const TreeParamTrain &param;
@@ -133,15 +215,166 @@ namespace xgboost{
             std::vector<float> &hess;
             const FMatrixS::Image &smat;
             const std::vector<unsigned> &group_id;
+        public:
+            /*! 
+             * \brief temporal space of the updater, the buffers keep their capacity, 
+             *        so they are reused across nodes and trees without new allocation,
+             *        each thread that trains trees has its own workspace, see GetWorkspace,
+             *        it is freed when the thread exits, or by FreeWorkspace when training ends
+             */
+            struct Workspace{
+                // stack to store current task
+                std::vector<Task> task_stack;
+                // temporal space for index set
+                std::vector<unsigned> idset;
+                // node id of each row, only maintained when pre-sorted column access is used, -1 means not in tree
+                std::vector<int> position;
+                // temporal space for entries of a pre-sorted column that belong to current node, one for each thread
+                std::vector< std::vector<SCEntry> > col_entry;
+                // histogram mode: quantized bins of features
+                HistCut hcut;
+                // histogram mode: row pointer of bin codes, indexed by row index
+                std::vector<size_t> bin_ptr;
+                // histogram mode: global bin index of each entry in the rows
+                std::vector<unsigned> bin_code;
+                // histogram mode: histograms of pending nodes, and the free slots in the pool
+                std::vector< std::vector<HistEntry> > hist_pool;
+                std::vector<int> hist_free;
+                // histogram mode: temporal histogram of each thread
+                std::vector< std::vector<HistEntry> > thread_hist;
+                // task of each split node, used to re-assign rows of a node that is pruned back to leaf
+                std::vector<Task> split_task;
+                // distributed column mode: rank of the worker owning the feature of each split node
+                std::vector<int> split_owner;
+                // distributed column mode: bitmap of rows of a node that go to the non-default child
+                std::vector<unsigned char> split_bits;
+                // features sampled for the tree, and whether each feature is in the tree
+                std::vector<unsigned> tree_feat;
+                std::vector<char> tree_fmask;
+                // features sampled for current node, sorted, and whether each feature is in the node
+                std::vector<unsigned> node_feat;
+                std::vector<char> node_fmask;
+                // row pointer of column major matrix of a node, kept zero between nodes
+                std::vector<size_t> tmp_rptr;
+                // entries and active features of column major matrix of a node
+                std::vector<SCEntry> node_entry;
+                std::vector<size_t> node_aclist;
+                // statistics of each column of a node, kept zero between nodes, and whether the column is materialized
+                std::vector<HistEntry> col_stat;
+                std::vector<char> col_keep;
+                // rows that go to the non-default child in a split
+                std::vector<unsigned> qset;
+                // mark of rows that go to the non-default child, indexed by row index, kept zero between splits
+                std::vector<char> row_mark;
+                // level-wise mode: tasks of current and next level, and slot of each node in current level, -1 if not in it
+                std::vector<Task> level, next_level;
+                std::vector<int> level_slot;
+                // level-wise mode: nodes of the level to be expanded, and the batch of them being expanded
+                std::vector<LevelNode> level_pending, level_node;
+                // level-wise mode: statistics and slot of each row, for the column scans of exact method
+                std::vector<LevelRow> level_row;
+                // level-wise mode: scan state of each node of the level, one array for each thread
+                std::vector< std::vector<ScanState> > scan_state;
+                // level-wise mode: nodes touched by current scan, one list for each thread
+                std::vector< std::vector<int> > scan_touch;
+                // level-wise mode: boundaries met by current scan, one list for each thread
+                std::vector< std::vector<ScanBound> > scan_bound;
+                // level-wise mode: features sampled for each node of the level, num_feature marks per node
+                std::vector<char> level_fmask;
+                // level-wise mode: rows of each split node that go to the non-default child
+                std::vector< std::vector<SCEntry> > level_rows;
+                // level-wise mode: statistics of the nodes of a level, and histograms of a level packed for allreduce
+                std::vector<double> level_sum, level_hist;
+                /*! \brief bytes of memory held by the workspace */
+                inline size_t Bytes( void ) const{
+                    size_t n = task_stack.capacity() * sizeof(Task) + idset.capacity() * sizeof(unsigned)
+                        + position.capacity() * sizeof(int) + bin_ptr.capacity() * sizeof(size_t)
+                        + bin_code.capacity() * sizeof(unsigned) + hist_free.capacity() * sizeof(int)
+                        + split_task.capacity() * sizeof(Task) + ( tree_feat.capacity() + node_feat.capacity() ) * sizeof(unsigned)
+                        + tree_fmask.capacity() + node_fmask.capacity() + tmp_rptr.capacity() * sizeof(size_t)
+                        + node_entry.capacity() * sizeof(SCEntry) + node_aclist.capacity() * sizeof(size_t)
+                        + col_stat.capacity() * sizeof(HistEntry) + col_keep.capacity()
+                        + qset.capacity() * sizeof(unsigned) + row_mark.capacity()
+                        + split_owner.capacity() * sizeof(int) + split_bits.capacity()
+                        + ( level.capacity() + next_level.capacity() ) * sizeof(Task) + level_slot.capacity() * sizeof(int)
+                        + ( level_pending.capacity() + level_node.capacity() ) * sizeof(LevelNode) + level_row.capacity() * sizeof(LevelRow)
+                        + level_fmask.capacity() + ( level_sum.capacity() + level_hist.capacity() ) * sizeof(double)
+                        + ( hcut.cut_ptr.capacity() + hcut.cut_value.capacity() + hcut.min_value.capacity() ) * 4;
+                    for( size_t i = 0; i < col_entry.size(); i ++ ) n += col_entry[i].capacity() * sizeof(SCEntry);
+                    for( size_t i = 0; i < hist_pool.size(); i ++ ) n += hist_pool[i].capacity() * sizeof(HistEntry);
+                    for( size_t i = 0; i < thread_hist.size(); i ++ ) n += thread_hist[i].capacity() * sizeof(HistEntry);
+                    for( size_t i = 0; i < scan_state.size(); i ++ ) n += scan_state[i].capacity() * sizeof(ScanState);
+                    for( size_t i = 0; i < scan_touch.size(); i ++ ) n += scan_touch[i].capacity() * sizeof(int);
+                    for( size_t i = 0; i < scan_bound.size(); i ++ ) n += scan_bound[i].capacity() * sizeof(ScanBound);
+                    for( size_t i = 0; i < level_rows.size(); i ++ ) n += level_rows[i].capacity() * sizeof(SCEntry);
+                    return n;
+                }
+            };
+            /*! \brief workspace of calling thread, created in first use */
+            inline static Workspace &GetWorkspace( void ){
+                Workspace *&ws = WorkspacePtr();
+                if( ws == NULL ){
+                    ws = new Workspace();
+                    pthread_setspecific( WorkspaceKey::Get(), ws );
+                }
+                return *ws;
+            }
+            /*! \brief release workspace of calling thread, no updater of the thread can be running */
+            inline static void FreeWorkspace( void ){
+                Workspace *&ws = WorkspacePtr();
+                if( ws == NULL ) return;
+                pthread_setspecific( WorkspaceKey::Get(), NULL );
+                delete ws; ws = NULL;
+            }
+        private:
+            inline static Workspace *&WorkspacePtr( void ){
+                static __thread Workspace *ws = NULL;
+                return ws;
+            }
+            // key of the workspace of each thread, its destructor frees the workspace when the thread exits
+            struct WorkspaceKey{
+                pthread_key_t key;
+                WorkspaceKey( void ){
+                    utils::Assert( pthread_key_create( &key, Delete ) == 0, "RTreeUpdater: fail to create workspace key" );
+                }
+                inline static void Delete( void *ws ){
+                    delete static_cast<Workspace*>( ws );
+                }
+                inline static pthread_key_t Get( void ){
+                    static WorkspaceKey k;
+                    return k.key;
+                }
+            };
         private:
             // maximum depth up to now
             int max_depth;
             // number of nodes being pruned
             int num_pruned;
-            // stack to store current task
-            std::vector<Task> task_stack;
-            // temporal space for index set
-            std::vector<unsigned> idset;
+            // leaf node id of each row in the final tree, -1 means not in tree, NULL means not recorded
+            std::vector<int> *leaf_index;
+            // statistics to add profile to, NULL if not profiling
+            BoostStats *stats;
+            // synchronization engine of distributed training, NULL if not distributed
+            sync::ISync *sync;
+            // temporal space, references to the buffers of workspace of current thread
+            Workspace &ws;
+            std::vector<Task> &task_stack;
+            std::vector<unsigned> &idset;
+            std::vector<int> &position;
+            std::vector< std::vector<SCEntry> > &col_entry;
+            HistCut &hcut;
+            std::vector<size_t> &bin_ptr;
+            std::vector<unsigned> &bin_code;
+            std::vector< std::vector<HistEntry> > &hist_pool;
+            std::vector<int> &hist_free;
+            std::vector< std::vector<HistEntry> > &thread_hist;
+            std::vector<Task> &split_task;
+            std::vector<int> &split_owner;
+            std::vector<unsigned> &tree_feat;
+            std::vector<char> &tree_fmask;
+            std::vector<unsigned> &node_feat;
+            std::vector<char> &node_fmask;
+            std::vector<size_t> &tmp_rptr;
         private:
             // task management: NOTE DFS here
             inline void add_task( Task tsk ){
@@ -164,6 +397,9 @@ namespace xgboost{
                 if( s.leaf_child_cnt >= 2 && param.need_prune( s.loss_chg, depth - 1 ) ){
                     // need to be pruned
                     tree.ChangeToLeaf( pid, param.learning_rate * s.base_weight );
+                    if( leaf_index != NULL ) this->set_leaf_index( split_task[ pid ], pid );
+                    // ids of the pruned childs can be reused by later nodes, rows must not keep them as position
+                    if( position.size() != 0 ) this->set_position( split_task[ pid ] );
                     // add statistics to number of nodes pruned
                     num_pruned += 2;
                     // tail recursion
@@ -172,6 +408,7 @@ namespace xgboost{
             }        
             // make leaf for current node :)
             inline void make_leaf( Task tsk, double sum_grad, double sum_hess, bool compute ){
+                ScopedTimer timer( stats, BoostStats::kMakeLeaf );
                 for( unsigned i = 0; i < tsk.len; i ++ ){
                     const unsigned ridx = tsk.idset[i];
                     if( compute ){
@@ -180,77 +417,111 @@ namespace xgboost{
                 }
                 }
                 tree[ tsk.nid ].set_leaf( param.learning_rate * param.CalcWeight( sum_grad, sum_hess, tsk.parent_base_weight ) );
+                if( leaf_index != NULL ) this->set_leaf_index( tsk, tsk.nid );
                 this->try_prune_leaf( tsk.nid, tree.GetDepth( tsk.nid ) );
             }
+            // record that rows in task end in leaf nid
+            inline void set_leaf_index( const Task &tsk, int nid ){
+                for( unsigned i = 0; i < tsk.len; i ++ ){
+                    (*leaf_index)[ tsk.idset[i] ] = nid;
+                }
+            }
         private:
             // make split for current task, re-arrange positions in idset
             inline void make_split( Task tsk, const SCEntry *entry, int num, float loss_chg, double base_weight ){
+                ScopedTimer timer( stats, BoostStats::kPartition );
+                // add childs to current node, this must be done first, since AddChilds can reallocate the stats
+                tree.AddChilds( tsk.nid );
+                // rows of the node are kept in place by the split, remember them in case the node is pruned
+                if( split_task.size() <= (size_t)tsk.nid ) split_task.resize( tsk.nid + 1 );
+                split_task[ tsk.nid ] = tsk;
                 // before split, first prepare statistics
                 RTree::NodeStat &s = tree.stat( tsk.nid );
                 s.loss_chg = loss_chg; 
                 s.leaf_child_cnt = 0;
                 s.base_weight = static_cast<float>( base_weight );
                 
-                // add childs to current node
-                tree.AddChilds( tsk.nid );
                 // assert that idset is sorted
                 assert_sorted( tsk.idset, tsk.len );
-                // use merge sort style to get the solution
-                std::vector<unsigned> qset;
+                // mark rows that go to the split part, then do stable partition of idset in one pass,
+                // the split part is buffered in qset, so both parts keep the order of idset
+                std::vector<char> &row_mark = ws.row_mark;
+                std::vector<unsigned> &qset = ws.qset;
                 for( int i = 0; i < num; i ++ ){
-                    qset.push_back( entry[i].rindex );
-                }
-                std::sort( qset.begin(), qset.end() );
-                // do merge sort style, make the other set, remove elements in qset
-                for( unsigned i = 0, top = 0; i < tsk.len; i ++ ){
-                    if( top < qset.size() ){
-                        if( tsk.idset[ i ] != qset[ top ] ){
-                            tsk.idset[ i - top ] = tsk.idset[ i ];
-                        }else{
-                            top ++;
-                        }
+                    row_mark[ entry[i].rindex ] = 1;
+                }
+                qset.resize( 0 );
+                unsigned top = 0;
+                for( unsigned i = 0; i < tsk.len; i ++ ){
+                    const unsigned ridx = tsk.idset[ i ];
+                    if( row_mark[ ridx ] != 0 ){
+                        qset.push_back( ridx ); row_mark[ ridx ] = 0;
                     }else{
-                        tsk.idset[ i - qset.size() ] = tsk.idset[ i ];
+                        tsk.idset[ top ++ ] = ridx;
                     }
                 }
                 // get two parts 
                 RTree::Node &n = tree[ tsk.nid ];
-                Task def_part( n.default_left() ? n.cleft() : n.cright(), tsk.idset, tsk.len - qset.size(), s.base_weight );
-                Task spl_part( n.default_left() ? n.cright(): n.cleft() , tsk.idset + def_part.len, qset.size(), s.base_weight );  
+                Task def_part( n.default_left() ? n.cleft() : n.cright(), tsk.idset, top, s.base_weight );
+                Task spl_part( n.default_left() ? n.cright(): n.cleft() , tsk.idset + top, qset.size(), s.base_weight );  
                 // fill back split part
-                for( unsigned i = 0; i < spl_part.len; i ++ ){
-                    spl_part.idset[ i ] = qset[ i ];
+                if( spl_part.len != 0 ){
+                    memcpy( spl_part.idset, &qset[0], sizeof(unsigned) * spl_part.len );
+                }
+                assert_sorted( def_part.idset, def_part.len );
+                assert_sorted( spl_part.idset, spl_part.len );
+                // update position of rows
+                if( position.size() != 0 ){
+                    this->set_position( def_part );
+                    this->set_position( spl_part );
                 }
                 // add tasks to the queue
                 this->add_task( def_part ); 
                 this->add_task( spl_part );
             }
             
-            // enumerate split point of the tree
+            // enumerate split point of the tree, cstat is the sum of statistics of entry[start,end),
+            // both directions are done in one forward pass, the part going right in backward process is cstat minus prefix
             inline void enumerate_split( RTSelecter &sglobal, int tlen,
                                          double rsum_grad, double rsum_hess, double root_cost,
-                                         const SCEntry *entry, size_t start, size_t end, 
+                                         const SCEntry *entry, size_t start, size_t end, const HistEntry &cstat,
                                          int findex, float parent_base_weight ){
-                // local selecter
+                // rows without the feature always take the default direction, no split can have enough weight on both sides
+                if( cstat.sum_hess < param.min_child_weight ) return;
+                // local selecter of forward process
                 RTSelecter slocal( param );
-                
-                if( param.default_direction != 1 ){
-                    // forward process, default right
-                    double csum_grad = 0.0, csum_hess = 0.0;
-                    for( size_t j = start; j < end; j ++ ){
-                        const unsigned ridx = entry[ j ].rindex;
-                        csum_grad += grad[ ridx ];
-                        csum_hess += hess[ ridx ];
-                        // check for split
-                        if( j == end - 1 || entry[j].fvalue + rt_2eps < entry[ j + 1 ].fvalue ){
-                            if( csum_hess < param.min_child_weight ) continue;
-                            const double dsum_hess = rsum_hess - csum_hess;
-                            if( dsum_hess < param.min_child_weight ) break;                        
+                bool fwd = param.default_direction != 1;
+                bool bwd = param.default_direction != 2;
+                // best of backward process, candidates come in reverse order of the old backward scan,
+                // so a tie replaces the best to keep the same choice
+                RTSelecter::Entry bbest( 0.0f, 0, 0, 0, 0.0f, false );
+                bool has_bbest = false;
+                if( bwd && rsum_hess - cstat.sum_hess >= param.min_child_weight ){
+                    // all the entries go right, default left
+                    const double loss_chg = param.CalcCost( cstat.sum_grad, cstat.sum_hess, parent_base_weight ) + 
+                        param.CalcCost( rsum_grad - cstat.sum_grad, rsum_hess - cstat.sum_hess, parent_base_weight ) - root_cost;
+                    if( static_cast<float>( loss_chg ) > 0.0f ){
+                        bbest = RTSelecter::Entry( loss_chg, start, static_cast<int>( end - start ), findex, entry[start].fvalue - rt_eps, true );
+                        has_bbest = true;
+                    }
+                }
+                double csum_grad = 0.0, csum_hess = 0.0;
+                for( size_t j = start; j < end && ( fwd || bwd ); j ++ ){
+                    const unsigned ridx = entry[ j ].rindex;
+                    csum_grad += grad[ ridx ];
+                    csum_hess += hess[ ridx ];
+                    // check for split
+                    if( j != end - 1 && entry[j].fvalue + rt_2eps >= entry[ j + 1 ].fvalue ) continue;
+                    // forward process, entry[start,j] go left, default right
+                    if( fwd && csum_hess >= param.min_child_weight ){
+                        const double dsum_hess = rsum_hess - csum_hess;
+                        if( dsum_hess < param.min_child_weight ){
+                            fwd = false;
+                        }else{
                             // change of loss 
-                            double loss_chg = 
-                            param.CalcCost( csum_grad, csum_hess, parent_base_weight ) + 
+                            const double loss_chg = 
+                                param.CalcCost( csum_grad, csum_hess, parent_base_weight ) + 
                                 param.CalcCost( rsum_grad - csum_grad, dsum_hess, parent_base_weight ) - root_cost;
-                            
                             const int clen = static_cast<int>( j + 1 - start );
                             // add candidate to selecter
                             slocal.push_back( RTSelecter::Entry( loss_chg, start, clen, findex, 
@@ -258,36 +529,1144 @@ namespace xgboost{
                                                                  false ) );
                         }
                     }
+                    // backward process, entry(j,end) go right, default left
+                    if( bwd && j != end - 1 ){
+                        const double bsum_grad = cstat.sum_grad - csum_grad;
+                        const double bsum_hess = cstat.sum_hess - csum_hess;
+                        if( bsum_hess < param.min_child_weight ){
+                            bwd = false;
+                        }else if( rsum_hess - bsum_hess >= param.min_child_weight ){
+                            const double loss_chg = param.CalcCost( bsum_grad, bsum_hess, parent_base_weight ) + 
+                                param.CalcCost( rsum_grad - bsum_grad, rsum_hess - bsum_hess, parent_base_weight ) - root_cost;
+                            if( static_cast<float>( loss_chg ) > 0.0f && static_cast<float>( loss_chg ) >= bbest.loss_chg ){
+                                bbest = RTSelecter::Entry( loss_chg, j + 1, static_cast<int>( end - j - 1 ), findex,
+                                                           0.5 * (entry[j].fvalue + entry[j+1].fvalue), true );
+                                has_bbest = true;
+                            }
+                        }
+                    }
+                }
+                if( has_bbest ) slocal.push_back( bbest );
+                sglobal.push_back( slocal.select() );
+            }
+            
+        private:
+            // whether training is distributed over several workers
+            inline bool is_dist( void ) const{
+                return sync != NULL && sync->GetWorldSize() > 1;
+            }
+            // whether features are sharded over workers, otherwise rows are sharded and statistics of nodes are summed over workers
+            inline bool is_dist_col( void ) const{
+                return this->is_dist() && param.dsplit == 1;
+            }
+            // distributed mode: sum buf over all workers, does nothing in a single process
+            inline void allreduce( double *buf, size_t n ){
+                if( !this->is_dist() ) return;
+                ScopedTimer timer( stats, BoostStats::kSync );
+                sync->AllreduceSum( buf, n );
+            }
+            // distributed mode: take the features sampled by worker 0, so that all workers scan the same features
+            inline void sync_feat( std::vector<unsigned> &feat ){
+                if( !this->is_dist() || feat.size() == 0 ) return;
+                ScopedTimer timer( stats, BoostStats::kSync );
+                sync->Broadcast( &feat[0], feat.size() * sizeof(unsigned), 0 );
+            }
+            // sum of gradient statistics of rows in task, over all workers in distributed mode
+            inline void get_node_sum( const Task &tsk, double &sum_grad, double &sum_hess ){
+                double sum[2] = { 0.0, 0.0 };
+                for( unsigned i = 0; i < tsk.len; i ++ ){
+                    const unsigned ridx = tsk.idset[i];
+                    sum[0] += grad[ ridx ];
+                    sum[1] += hess[ ridx ];
+                }
+                // each worker holds all rows when features are sharded
+                if( !this->is_dist_col() ) this->allreduce( sum, 2 );
+                sum_grad = sum[0]; sum_hess = sum[1];
+            }
+            // distributed column mode: take the rows sampled by worker 0
+            inline void sync_rows( std::vector<unsigned> &rows ){
+                if( !this->is_dist_col() ) return;
+                ScopedTimer timer( stats, BoostStats::kSync );
+                size_t n = rows.size();
+                sync->Broadcast( &n, sizeof(n), 0 );
+                rows.resize( n );
+                if( n != 0 ) sync->Broadcast( &rows[0], n * sizeof(unsigned), 0 );
+            }
+            // distributed column mode: replace e by the best split over all workers, return the rank of worker owning it,
+            // return -1 if features are not sharded
+            inline int sync_best_split( const Task &tsk, RTSelecter::Entry &e ){
+                if( !this->is_dist_col() ) return -1;
+                std::vector<RTSelecter::Entry> best( sync->GetWorldSize() );
+                {
+                    ScopedTimer timer( stats, BoostStats::kSync );
+                    sync->Allgather( &e, sizeof(e), &best[0] );
+                }
+                // same rule as RTSelecter, so every worker picks the same one
+                int owner = 0;
+                for( int w = 1; w < (int)best.size(); w ++ ){
+                    if( best[ owner ].need_replace( best[ w ] ) ) owner = w;
+                }
+                e = best[ owner ];
+                if( split_owner.size() <= (size_t)tsk.nid ) split_owner.resize( tsk.nid + 1, -1 );
+                split_owner[ tsk.nid ] = owner;
+                return owner;
+            }
+            // distributed column mode: the owner of the split broadcasts the rows of task that go to the non-default child,
+            // as a bitmap over tsk.idset, entry[0,num) are the rows in the owner, replaced by the rows received
+            inline void sync_split_rows( const Task &tsk, int owner, const SCEntry *&entry, int &num ){
+                std::vector<unsigned char> &bits = ws.split_bits;
+                bits.resize( 0 ); bits.resize( ( tsk.len + 7 ) / 8, 0 );
+                if( sync->GetRank() == owner ){
+                    std::vector<char> &row_mark = ws.row_mark;
+                    for( int i = 0; i < num; i ++ ){
+                        row_mark[ entry[i].rindex ] = 1;
+                    }
+                    for( unsigned i = 0; i < tsk.len; i ++ ){
+                        if( row_mark[ tsk.idset[i] ] == 0 ) continue;
+                        bits[ i >> 3 ] |= static_cast<unsigned char>( 1 << ( i & 7 ) );
+                        row_mark[ tsk.idset[i] ] = 0;
+                    }
+                }
+                if( bits.size() != 0 ){
+                    ScopedTimer timer( stats, BoostStats::kSync );
+                    sync->Broadcast( &bits[0], bits.size(), owner );
+                }
+                // entry can point into col_entry[0], it is consumed before the buffer is refilled
+                if( col_entry.size() == 0 ) col_entry.resize( 1 );
+                std::vector<SCEntry> &buf = col_entry[0];
+                buf.resize( 0 );
+                for( unsigned i = 0; i < tsk.len; i ++ ){
+                    if( ( bits[ i >> 3 ] >> ( i & 7 ) ) & 1 ) buf.push_back( SCEntry( 0.0f, tsk.idset[i] ) );
+                }
+                entry = buf.size() == 0 ? NULL : &buf[0];
+                num = static_cast<int>( buf.size() );
+            }
+            // distributed column mode: find leaves of rows left out of the tree, e.g. by sampling,
+            // the rows go down one level at a time, each step is decided by the owner of the split and summed over workers
+            inline void sync_rest_leaf( void ){
+                std::vector<int> &lindex = *leaf_index;
+                std::vector<unsigned> rest;
+                std::vector<int> nid;
+                for( size_t i = 0; i < lindex.size(); i ++ ){
+                    if( lindex[i] >= 0 ) continue;
+                    rest.push_back( (unsigned)i );
+                    nid.push_back( group_id.size() == 0 ? 0 : (int)group_id[i] );
+                }
+                const int rank = sync->GetRank();
+                std::vector<double> next( rest.size() );
+                while( true ){
+                    bool active = false;
+                    for( size_t k = 0; k < rest.size(); k ++ ){
+                        next[k] = 0.0;
+                        const RTree::Node &n = tree[ nid[k] ];
+                        if( n.is_leaf() ) continue;
+                        active = true;
+                        if( split_owner[ nid[k] ] != rank ) continue;
+                        // the row is scanned for the feature, missing value takes the default direction
+                        FMatrixS::Line sp = smat[ rest[k] ];
+                        int cnid = n.default_left() ? n.cleft() : n.cright();
+                        for( unsigned j = 0; j < sp.len; j ++ ){
+                            if( sp.findex[j] != n.split_index() ) continue;
+                            cnid = sp.fvalue[j] < n.split_cond() ? n.cleft() : n.cright();
+                            break;
+                        }
+                        next[k] = cnid;
+                    }
+                    // all workers see the same positions, so they leave the loop together
+                    if( !active ) break;
+                    this->allreduce( &next[0], next.size() );
+                    for( size_t k = 0; k < rest.size(); k ++ ){
+                        if( !tree[ nid[k] ].is_leaf() ) nid[k] = static_cast<int>( next[k] );
+                    }
+                }
+                for( size_t k = 0; k < rest.size(); k ++ ){
+                    lindex[ rest[k] ] = nid[k];
+                }
+            }
+        private:
+            // move a random subset of n features to the front of feat, return the size of subset
+            inline static size_t sample_feat( std::vector<unsigned> &feat, float ratio ){
+                const size_t n = feat.size();
+                if( ratio > 1.0f - 1e-6f ) return n;
+                size_t k = static_cast<size_t>( ratio * n + 0.5f );
+                if( k == 0 ) k = 1;
+                if( k > n ) k = n;
+                // partial shuffle, only the first k positions are drawn
+                for( size_t i = 0; i < k; i ++ ){
+                    std::swap( feat[ i ], feat[ i + random::NextUInt32( (uint32_t)( n - i ) ) ] );
+                }
+                return k;
+            }
+            // sample the features of the tree, done once per tree before any data is scanned
+            inline void init_feat( void ){
+                const unsigned nfeat = static_cast<unsigned>( tree.param.num_feature );
+                tree_feat.resize( nfeat );
+                for( unsigned i = 0; i < nfeat; i ++ ) tree_feat[i] = i;
+                tree_feat.resize( sample_feat( tree_feat, param.colsample_bytree ) );
+                if( param.colsample_bytree < 1.0f - 1e-6f ) this->sync_feat( tree_feat );
+                std::sort( tree_feat.begin(), tree_feat.end() );
+                tree_fmask.resize( 0 ); tree_fmask.resize( nfeat, 0 );
+                for( size_t i = 0; i < tree_feat.size(); i ++ ) tree_fmask[ tree_feat[i] ] = 1;
+                node_feat = tree_feat; node_fmask = tree_fmask;
+            }
+            // sample the features of current node from features of the tree, called before the node scans the data
+            inline void sample_node_feat( void ){
+                if( param.colsample_bynode > 1.0f - 1e-6f ) return;
+                for( size_t i = 0; i < node_feat.size(); i ++ ) node_fmask[ node_feat[i] ] = 0;
+                // tree_feat is kept as a permutation of the features of the tree
+                const size_t k = sample_feat( tree_feat, param.colsample_bynode );
+                node_feat.assign( tree_feat.begin(), tree_feat.begin() + k );
+                this->sync_feat( node_feat );
+                std::sort( node_feat.begin(), node_feat.end() );
+                for( size_t i = 0; i < node_feat.size(); i ++ ) node_fmask[ node_feat[i] ] = 1;
+            }
+            // set position of rows in task to be task's node id
+            inline void set_position( const Task &tsk ){
+                for( unsigned i = 0; i < tsk.len; i ++ ){
+                    position[ tsk.idset[i] ] = tsk.nid;
+                }
+            }
+            // whether feature fid can be used by the tree
+            inline bool in_tree( unsigned fid ) const{
+                return fid < tree_fmask.size() && tree_fmask[ fid ] != 0;
+            }
+            // whether to use pre-sorted column scan instead of building and sorting columns for the node
+            inline bool use_presort( const Task &tsk ) const{
+                return smat.HaveColAccess() && tsk.len >= param.presort_ratio * idset.size();
+            }
+            // number of threads used in split finding
+            inline int get_nthread( void ) const{
+                return param.nthread > 0 ? param.nthread : omp_get_max_threads();
+            }
+            // collect entries of pre-sorted column fid that belong to node nid into buf, entries remain sorted,
+            // cstat is set to the sum of statistics of the entries
+            inline size_t get_node_col( int nid, unsigned fid, std::vector<SCEntry> &buf, HistEntry &cstat ) const{
+                buf.resize( 0 ); cstat.clear();
+                FMatrixS::Col col = smat.GetSortedCol( fid );
+                for( bst_uint j = 0; j < col.len; j ++ ){
+                    const unsigned ridx = col.data[j].rindex;
+                    if( position[ ridx ] == nid ){
+                        buf.push_back( SCEntry( col.data[j].fvalue, ridx ) );
+                        cstat.add( grad[ ridx ], hess[ ridx ] );
+                    }
+                }
+                return buf.size();
+            }
+            // find split for current task using pre-sorted columns, no per node sorting is needed
+            inline void expand_presort( Task tsk, int depth ){
+                // statistics of root
+                double rsum_grad = 0.0, rsum_hess = 0.0;
+                for( unsigned i = 0; i < tsk.len; i ++ ){
+                    const unsigned ridx = tsk.idset[i];
+                    rsum_grad  += grad[ ridx ];
+                    rsum_hess  += hess[ ridx ];
+                }
+                // if minimum split weight is not meet
+                if( param.cannot_split( rsum_hess, depth )  ){
+                    this->make_leaf( tsk, rsum_grad, rsum_hess, false ); return; 
+                }
+                // global selecter
+                RTSelecter sglobal( param );
+                // cost root 
+                const double root_cost = param.CalcRootCost( rsum_grad, rsum_hess );
+                // KEY: layerwise, weight of current node if it is leaf
+                const double base_weight = param.CalcWeight( rsum_grad, rsum_hess, tsk.parent_base_weight );
+                const unsigned ncol = static_cast<unsigned>( std::min( smat.NumCol(), (size_t)tree.param.num_feature ) );
+                const int nthread = this->get_nthread();
+                // per thread selecter, merged after enumeration
+                std::vector<RTSelecter> stemp( nthread, RTSelecter( param ) );
+                col_entry.resize( nthread );
+                this->sample_node_feat();
+                const unsigned nsample = static_cast<unsigned>( node_feat.size() );
+                if( stats != NULL ) stats->AddFeat( depth, nsample );
+                ScopedTimer tenum( stats, BoostStats::kEnumSplit );
+                #pragma omp parallel for schedule( dynamic, 1 ) num_threads( nthread )
+                for( unsigned i = 0; i < nsample; i ++ ){
+                    const unsigned fid = node_feat[ i ];
+                    if( fid >= ncol ) continue;
+                    const int tid = omp_get_thread_num();
+                    std::vector<SCEntry> &buf = col_entry[ tid ];
+                    HistEntry cstat;
+                    const size_t len = this->get_node_col( tsk.nid, fid, buf, cstat );
+                    if( len == 0 ) continue;
+                    this->enumerate_split( stemp[ tid ], tsk.len,
+                                           rsum_grad, rsum_hess, root_cost,
+                                           &buf[0], 0, len, cstat, fid, base_weight );
+                }
+                tenum.Stop();
+                for( int i = 0; i < nthread; i ++ ){
+                    sglobal.push_back( stemp[ i ].select() );
+                }
+                // get the best solution
+                RTSelecter::Entry e = sglobal.select();
+                const int owner = this->sync_best_split( tsk, e );
+                // allowed to split
+                if( e.loss_chg > rt_eps ){
+                    // add splits
+                    tree[ tsk.nid ].set_split( e.split_index(), e.split_value, e.default_left() );
+                    const SCEntry *entry = NULL;
+                    int num = 0;
+                    if( owner < 0 || owner == sync->GetRank() ){
+                        // collect the column again, the order is the same as in enumeration
+                        ScopedTimer timer( stats, BoostStats::kPartition );
+                        HistEntry cstat;
+                        this->get_node_col( tsk.nid, e.split_index(), col_entry[0], cstat );
+                        entry = &col_entry[0][ e.start ]; num = e.len;
+                    }
+                    if( owner >= 0 ) this->sync_split_rows( tsk, owner, entry, num );
+                    // re-arrange idset, push tasks
+                    this->make_split( tsk, entry, num, e.loss_chg, base_weight ); 
+                }else{
+                    // make leaf if we didn't meet requirement
+                    this->make_leaf( tsk, rsum_grad, rsum_hess, false );
+                }
+            }
+        private:
+            // level-wise mode: whether the tree is grown level by level, the exact method needs pre-sorted columns for it,
+            // the tree is grown depth-first otherwise
+            inline bool use_levelwise( void ) const{
+                if( param.grow_policy != 1 ) return false;
+                return param.tree_method == 1 || smat.HaveColAccess();
+            }
+            // level-wise mode: add a split candidate of node k to sel, same rule as enumerate_split
+            inline void push_level_split( const LevelNode &node, const ScanState &s, unsigned fid, float split_value,
+                                          bool default_left, RTSelecter &sel ) const{
+                if( s.csum_hess < param.min_child_weight ) return;
+                const double dsum_hess = node.sum_hess - s.csum_hess;
+                if( dsum_hess < param.min_child_weight ) return;
+                double loss_chg = param.CalcCost( s.csum_grad, s.csum_hess, node.base_weight ) + 
+                    param.CalcCost( node.sum_grad - s.csum_grad, dsum_hess, node.base_weight ) - node.root_cost;
+                sel.push_back( RTSelecter::Entry( loss_chg, 0, 0, fid, split_value, default_left ) );
+            }
+            // level-wise mode: scan pre-sorted column fid once, the statistics of all nodes of the level are accumulated together,
+            // candidates of node k go to sel[k]; for each node, the candidates are the ones enumerate_split finds over the entries
+            // of the node: the forward process is done in the scan, the backward process replays the boundaries met by the scan
+            // in reverse, the part going right is the column total of the node minus the statistics before the boundary
+            inline void scan_level_col( unsigned fid, int stamp, std::vector<ScanState> &state, std::vector<int> &touch,
+                                        std::vector<ScanBound> &bound, RTSelecter *sel ) const{
+                const std::vector<LevelNode> &nodes = ws.level_node;
+                const size_t nfeat = tree_fmask.size();
+                const bool sampled = ws.level_fmask.size() != 0;
+                const bool fwd = param.default_direction != 1;
+                const bool bwd = param.default_direction != 2;
+                FMatrixS::Col col = smat.GetSortedCol( fid );
+                touch.resize( 0 ); bound.resize( 0 );
+                const LevelRow *row = &ws.level_row[0];
+                for( bst_uint i = 0; i < col.len; i ++ ){
+                    const FMatrixS::REntry &c = col.data[ i ];
+                    const LevelRow &r = row[ c.rindex ];
+                    const int k = r.slot;
+                    if( k < 0 ) continue;
+                    if( sampled && ws.level_fmask[ k * nfeat + fid ] == 0 ) continue;
+                    ScanState &st = state[ k ];
+                    if( st.stamp != stamp ){
+                        st.stamp = stamp; st.csum_grad = st.csum_hess = 0.0;
+                        st.first_fvalue = c.fvalue;
+                        touch.push_back( k );
+                    }else if( st.last_fvalue + rt_2eps < c.fvalue ){
+                        // a boundary between two distinct values of the node
+                        const float split_value = 0.5 * ( st.last_fvalue + c.fvalue );
+                        if( fwd ) this->push_level_split( nodes[k], st, fid, split_value, false, sel[k] );
+                        if( bwd ){
+                            ScanBound e;
+                            e.k = k; e.split_value = split_value;
+                            e.csum_grad = st.csum_grad; e.csum_hess = st.csum_hess;
+                            bound.push_back( e );
+                        }
+                    }
+                    st.csum_grad += r.grad;
+                    st.csum_hess += r.hess;
+                    st.last_fvalue = c.fvalue;
+                }
+                // forward process: split after the last entry of each node
+                if( fwd ){
+                    for( size_t j = 0; j < touch.size(); j ++ ){
+                        const int k = touch[ j ];
+                        this->push_level_split( nodes[k], state[k], fid, state[k].last_fvalue + rt_eps, false, sel[k] );
+                    }
+                }
+                if( !bwd ) return;
+                // backward process: the boundaries from the largest value down, then all the entries of the node go right
+                for( size_t j = bound.size(); j != 0; j -- ){
+                    const ScanBound &e = bound[ j - 1 ];
+                    ScanState bs = state[ e.k ];
+                    bs.csum_grad -= e.csum_grad; bs.csum_hess -= e.csum_hess;
+                    this->push_level_split( nodes[e.k], bs, fid, e.split_value, true, sel[e.k] );
+                }
+                for( size_t j = 0; j < touch.size(); j ++ ){
+                    const int k = touch[ j ];
+                    this->push_level_split( nodes[k], state[k], fid, state[k].first_fvalue - rt_eps, true, sel[k] );
+                }
+            }
+            // level-wise mode: statistics of the tasks of a level, summed over workers in one allreduce for the level,
+            // tasks that can not be split become leaves, the others are put into ws.level_pending
+            inline void init_level( std::vector<Task> &level ){
+                std::vector<double> &sum = ws.level_sum;
+                sum.resize( level.size() * 2 );
+                for( size_t i = 0; i < level.size(); i ++ ){
+                    const Task &tsk = level[ i ];
+                    sum[ i * 2 ] = sum[ i * 2 + 1 ] = 0.0;
+                    for( unsigned j = 0; j < tsk.len; j ++ ){
+                        const unsigned ridx = tsk.idset[j];
+                        sum[ i * 2 ] += grad[ ridx ];
+                        sum[ i * 2 + 1 ] += hess[ ridx ];
+                    }
+                }
+                // each worker holds all rows when features are sharded
+                if( sum.size() != 0 && !this->is_dist_col() ) this->allreduce( &sum[0], sum.size() );
+                std::vector<LevelNode> &nodes = ws.level_pending;
+                nodes.resize( 0 );
+                for( size_t i = 0; i < level.size(); i ++ ){
+                    Task &tsk = level[ i ];
+                    const int depth = tree.GetDepth( tsk.nid );
+                    if( depth > max_depth ) max_depth = depth;
+                    if( stats != NULL ) stats->AddNode( depth, tsk.len );
+                    LevelNode node;
+                    node.depth = depth;
+                    node.sum_grad = sum[ i * 2 ]; node.sum_hess = sum[ i * 2 + 1 ];
+                    if( depth >= param.max_depth || param.cannot_split( node.sum_hess, depth ) ){
+                        this->release_hist( tsk );
+                        this->make_leaf( tsk, node.sum_grad, node.sum_hess, false ); continue;
+                    }
+                    node.tsk = tsk;
+                    node.root_cost = param.CalcRootCost( node.sum_grad, node.sum_hess );
+                    node.base_weight = param.CalcWeight( node.sum_grad, node.sum_hess, tsk.parent_base_weight );
+                    nodes.push_back( node );
+                }
+            }
+            // level-wise mode: sample features of each node of the level, in order of the nodes
+            inline void sample_level_feat( void ){
+                const std::vector<LevelNode> &nodes = ws.level_node;
+                const size_t nfeat = tree_fmask.size();
+                ws.level_fmask.resize( 0 );
+                if( param.colsample_bynode < 1.0f - 1e-6f ){
+                    ws.level_fmask.resize( nodes.size() * nfeat );
+                    for( size_t k = 0; k < nodes.size(); k ++ ){
+                        this->sample_node_feat();
+                        if( stats != NULL ) stats->AddFeat( nodes[k].depth, node_feat.size() );
+                        std::copy( node_fmask.begin(), node_fmask.end(), ws.level_fmask.begin() + k * nfeat );
+                    }
+                }else if( stats != NULL ){
+                    for( size_t k = 0; k < nodes.size(); k ++ ) stats->AddFeat( nodes[k].depth, tree_feat.size() );
+                }
+            }
+            // level-wise mode, exact method: enumerate splits of all nodes of the level, each pre-sorted column is scanned
+            // once for both directions, candidates of node k found by thread t go to stemp[ t * nnode + k ]
+            inline void enum_level_exact( std::vector<RTSelecter> &stemp, int nthread ){
+                const int nnode = static_cast<int>( ws.level_node.size() );
+                {// rows of the level, built once and read by every column scan
+                    std::vector<LevelRow> &row = ws.level_row;
+                    row.resize( position.size() );
+                    for( size_t i = 0; i < row.size(); i ++ ){
+                        row[i].grad = grad[i]; row[i].hess = hess[i];
+                        row[i].slot = position[i] < 0 ? -1 : ws.level_slot[ position[i] ];
+                    }
+                }
+                if( ws.scan_state.size() < (size_t)nthread ) ws.scan_state.resize( nthread );
+                if( ws.scan_touch.size() < (size_t)nthread ) ws.scan_touch.resize( nthread );
+                if( ws.scan_bound.size() < (size_t)nthread ) ws.scan_bound.resize( nthread );
+                for( int t = 0; t < nthread; t ++ ){
+                    ws.scan_state[t].resize( nnode );
+                    for( int k = 0; k < nnode; k ++ ) ws.scan_state[t][k].stamp = -1;
+                }
+                const unsigned ncol = static_cast<unsigned>( std::min( smat.NumCol(), tree_fmask.size() ) );
+                const unsigned nsample = static_cast<unsigned>( tree_feat.size() );
+                #pragma omp parallel for schedule( dynamic, 1 ) num_threads( nthread )
+                for( unsigned i = 0; i < nsample; i ++ ){
+                    const unsigned fid = tree_feat[ i ];
+                    if( fid >= ncol ) continue;
+                    const int tid = omp_get_thread_num();
+                    RTSelecter *sel = &stemp[ tid * nnode ];
+                    this->scan_level_col( fid, (int)i, ws.scan_state[ tid ], ws.scan_touch[ tid ], ws.scan_bound[ tid ], sel );
+                }
+            }
+            // level-wise mode, histogram method: enumerate splits of all nodes of the level over their histograms,
+            // pairs of node and feature are spread over threads, so small nodes of deep levels still use all threads
+            inline void enum_level_hist( std::vector<RTSelecter> &stemp, int nthread ){
+                const std::vector<LevelNode> &nodes = ws.level_node;
+                const unsigned nnode = static_cast<unsigned>( nodes.size() );
+                const size_t nfeat = tree_fmask.size();
+                const bool sampled = ws.level_fmask.size() != 0;
+                const unsigned nsample = static_cast<unsigned>( tree_feat.size() );
+                const unsigned npair = nnode * nsample;
+                #pragma omp parallel for schedule( dynamic, 64 ) num_threads( nthread )
+                for( unsigned p = 0; p < npair; p ++ ){
+                    const unsigned k = p / nsample, fid = tree_feat[ p % nsample ];
+                    if( sampled && ws.level_fmask[ k * nfeat + fid ] == 0 ) continue;
+                    const LevelNode &node = nodes[ k ];
+                    this->enumerate_hist_split( stemp[ omp_get_thread_num() * nnode + k ],
+                                                node.sum_grad, node.sum_hess, node.root_cost,
+                                                &hist_pool[ node.tsk.hist ][0], fid, node.base_weight );
+                }
+            }
+            // level-wise mode, exact method: collect rows that go to the non-default child of each split node,
+            // in one pass over each split feature
+            inline void collect_level_exact( const std::vector<RTSelecter::Entry> &best, const std::vector<int> &owner, int nthread ){
+                std::vector< std::vector<SCEntry> > &rows = ws.level_rows;
+                std::vector<unsigned> split_feat;
+                for( size_t k = 0; k < best.size(); k ++ ){
+                    if( best[k].loss_chg <= rt_eps ) continue;
+                    if( owner[k] >= 0 && owner[k] != sync->GetRank() ) continue;
+                    split_feat.push_back( best[k].split_index() );
+                }
+                std::sort( split_feat.begin(), split_feat.end() );
+                split_feat.resize( std::unique( split_feat.begin(), split_feat.end() ) - split_feat.begin() );
+                const unsigned nsplit = static_cast<unsigned>( split_feat.size() );
+                // a node has only one split feature, so rows of a node are written by one thread
+                #pragma omp parallel for schedule( dynamic, 1 ) num_threads( nthread )
+                for( unsigned i = 0; i < nsplit; i ++ ){
+                    const unsigned fid = split_feat[ i ];
+                    FMatrixS::Col col = smat.GetSortedCol( fid );
+                    for( bst_uint j = 0; j < col.len; j ++ ){
+                        const int k = ws.level_row[ col.data[j].rindex ].slot;
+                        if( k < 0 || best[k].loss_chg <= rt_eps || best[k].split_index() != fid ) continue;
+                        if( owner[k] >= 0 && owner[k] != sync->GetRank() ) continue;
+                        const bool go_left = col.data[j].fvalue < best[k].split_value;
+                        if( go_left != best[k].default_left() ) rows[k].push_back( SCEntry( 0.0f, col.data[j].rindex ) );
+                    }
+                }
+            }
+            // level-wise mode, histogram method: collect rows that go to the non-default child of each split node,
+            // from the bin codes of the rows of each node, or in one pass over the pages for paged rows
+            inline void collect_level_hist( const std::vector<RTSelecter::Entry> &best, int nthread ){
+                const std::vector<LevelNode> &nodes = ws.level_node;
+                std::vector< std::vector<SCEntry> > &rows = ws.level_rows;
+                if( smat.IsPaged() ){
+                    const FMatrixS::IPagedRows &paged = *smat.Paged();
+                    for( size_t pid = 0; pid < paged.NumPage(); pid ++ ){
+                        size_t begin, end;
+                        const FMatrixS &page = paged.GetPage( pid, begin, end );
+                        for( size_t ridx = begin; ridx < end && ridx < position.size(); ridx ++ ){
+                            if( position[ ridx ] < 0 ) continue;
+                            const int k = ws.level_slot[ position[ ridx ] ];
+                            if( k < 0 || best[k].loss_chg <= rt_eps ) continue;
+                            const RTSelecter::Entry &e = best[k];
+                            FMatrixS::Line sp = page[ ridx - begin ];
+                            for( unsigned j = 0; j < sp.len; j ++ ){
+                                if( sp.findex[j] != e.split_index() ) continue;
+                                const unsigned b = hcut.get_bin( e.split_index(), sp.fvalue[j] );
+                                if( e.default_left() ? b >= e.start : b <= e.start ){
+                                    rows[k].push_back( SCEntry( 0.0f, (unsigned)ridx ) );
+                                }
+                                break;
+                            }
+                        }
+                    }
+                    return;
+                }
+                const int nnode = static_cast<int>( nodes.size() );
+                #pragma omp parallel for schedule( dynamic, 1 ) num_threads( nthread )
+                for( int k = 0; k < nnode; k ++ ){
+                    const RTSelecter::Entry &e = best[k];
+                    if( e.loss_chg <= rt_eps ) continue;
+                    const Task &tsk = nodes[k].tsk;
+                    const unsigned fid = e.split_index();
+                    const unsigned bstart = hcut.cut_ptr[ fid ], bend = hcut.cut_ptr[ fid + 1 ];
+                    for( unsigned i = 0; i < tsk.len; i ++ ){
+                        const unsigned ridx = tsk.idset[i];
+                        for( size_t j = bin_ptr[ ridx ]; j < bin_ptr[ ridx + 1 ]; j ++ ){
+                            const unsigned b = bin_code[j];
+                            if( b < bstart || b >= bend ) continue;
+                            if( e.default_left() ? b >= e.start : b <= e.start ){
+                                rows[k].push_back( SCEntry( 0.0f, ridx ) );
+                            }
+                            break;
+                        }
+                    }
+                }
+            }
+            // level-wise mode, histogram method: number of histograms that can be held within the memory budget
+            inline size_t max_level_hist( void ) const{
+                const size_t nbyte = hcut.cut_value.size() * sizeof(HistEntry);
+                if( nbyte == 0 ) return std::numeric_limits<size_t>::max();
+                return std::max( (size_t)2, ( (size_t)std::max( param.level_hist_mb, 0 ) << 20 ) / nbyte );
+            }
+            // level-wise mode: end of the batch of pending nodes of the level starting at kb, all nodes are in one batch
+            // for exact method, for histogram method the histograms built for the batch must fit in the memory budget
+            inline size_t next_level_batch( size_t kb ) const{
+                const std::vector<LevelNode> &pending = ws.level_pending;
+                if( param.tree_method != 1 ) return pending.size();
+                size_t held = hist_pool.size() - hist_free.size();
+                const size_t nmax = this->max_level_hist();
+                size_t ke = kb;
+                for( ; ke < pending.size(); ke ++ ){
+                    if( pending[ ke ].tsk.hist >= 0 ) continue;
+                    if( ke != kb && held >= nmax ) break;
+                    held ++;
+                }
+                return ke;
+            }
+            // level-wise mode, histogram method: give histograms to the children of the splits of the level,
+            // child[2*i] and child[2*i+1] are the children of a split whose histogram is parent[i];
+            // only the smaller child is built from data, the larger one takes the histogram of parent minus the smaller one,
+            // when the memory budget is used up, the parent histogram is freed and both children build theirs at next level
+            inline void make_level_child_hist( std::vector<Task> &next, std::vector<int> &child, std::vector<int> &parent ){
+                {// the decision only depends on the tree, so it is the same on every worker
+                    size_t held = hist_pool.size() - hist_free.size();
+                    const size_t nmax = this->max_level_hist();
+                    size_t top = 0;
+                    for( size_t i = 0; i < parent.size(); i ++ ){
+                        if( held < nmax ){
+                            held ++;
+                            parent[ top ] = parent[i];
+                            child[ top * 2 ] = child[ i * 2 ]; child[ top * 2 + 1 ] = child[ i * 2 + 1 ];
+                            top ++;
+                        }else{
+                            hist_free.push_back( parent[i] ); held --;
+                        }
+                    }
+                    parent.resize( top ); child.resize( top * 2 );
+                }
+                const size_t npair = parent.size();
+                if( npair == 0 ) return;
+                // the smaller child is decided by rows of all workers, so every worker builds the same one
+                std::vector<double> &clen = ws.level_sum;
+                clen.resize( npair * 2 );
+                for( size_t i = 0; i < npair * 2; i ++ ) clen[i] = next[ child[i] ].len;
+                this->allreduce( &clen[0], clen.size() );
+                std::vector<Task*> small( npair ), large( npair );
+                for( size_t i = 0; i < npair; i ++ ){
+                    const bool first = clen[ i * 2 ] < clen[ i * 2 + 1 ];
+                    small[i] = &next[ child[ i * 2 + ( first ? 0 : 1 ) ] ];
+                    large[i] = &next[ child[ i * 2 + ( first ? 1 : 0 ) ] ];
+                }
+                ScopedTimer timer( stats, BoostStats::kHistBuild );
+                this->build_level_hist( small );
+                for( size_t i = 0; i < npair; i ++ ){
+                    large[i]->hist = parent[i];
+                    std::vector<HistEntry> &lhist = hist_pool[ parent[i] ];
+                    const std::vector<HistEntry> &shist = hist_pool[ small[i]->hist ];
+                    for( size_t b = 0; b < lhist.size(); b ++ ){
+                        lhist[b].sub( shist[b] );
+                    }
+                }
+            }
+            // level-wise mode: expand all tasks of a level, in batches of nodes for histogram method with many nodes,
+            // tasks of the next level are put into ws.next_level
+            inline void expand_level( std::vector<Task> &level ){
+                ws.next_level.resize( 0 );
+                this->init_level( level );
+                const std::vector<LevelNode> &pending = ws.level_pending;
+                for( size_t kb = 0, ke; kb < pending.size(); kb = ke ){
+                    ke = this->next_level_batch( kb );
+                    ws.level_node.assign( pending.begin() + kb, pending.begin() + ke );
+                    this->expand_level_batch();
+                }
+            }
+            // level-wise mode: expand the nodes in ws.level_node together
+            inline void expand_level_batch( void ){
+                std::vector<LevelNode> &nodes = ws.level_node;
+                const bool hist_method = param.tree_method == 1;
+                const int nnode = static_cast<int>( nodes.size() );
+                if( hist_method ){
+                    // only the roots have no histogram, the nodes below get theirs when their parent is split
+                    std::vector<Task*> build;
+                    for( int k = 0; k < nnode; k ++ ){
+                        if( nodes[k].tsk.hist < 0 ) build.push_back( &nodes[k].tsk );
+                    }
+                    ScopedTimer timer( stats, BoostStats::kHistBuild );
+                    this->build_level_hist( build );
+                }
+                // paged histogram build uses the slots for its own tasks, so the slots of the level are set after it
+                if( ws.level_slot.size() < (size_t)tree.param.num_nodes ) ws.level_slot.resize( tree.param.num_nodes, -1 );
+                for( int k = 0; k < nnode; k ++ ) ws.level_slot[ nodes[k].tsk.nid ] = k;
+                this->sample_level_feat();
+                const int nthread = this->get_nthread();
+                // per thread and node selecter, merged after enumeration
+                std::vector<RTSelecter> stemp( nthread * nnode, RTSelecter( param ) );
+                ScopedTimer tenum( stats, BoostStats::kEnumSplit );
+                if( hist_method ){
+                    this->enum_level_hist( stemp, nthread );
+                }else{
+                    this->enum_level_exact( stemp, nthread );
+                }
+                tenum.Stop();
+                // best split of each node
+                std::vector<RTSelecter::Entry> best( nnode );
+                std::vector<int> owner( nnode );
+                for( int k = 0; k < nnode; k ++ ){
+                    RTSelecter sglobal( param );
+                    for( int t = 0; t < nthread; t ++ ){
+                        sglobal.push_back( stemp[ t * nnode + k ].select() );
+                    }
+                    best[ k ] = sglobal.select();
+                    owner[ k ] = this->sync_best_split( nodes[k].tsk, best[ k ] );
+                    if( best[ k ].loss_chg > rt_eps ){
+                        tree[ nodes[k].tsk.nid ].set_split( best[k].split_index(), best[k].split_value, best[k].default_left() );
+                    }
+                }
+                // collect rows that go to the non-default child of each split
+                ScopedTimer tpart( stats, BoostStats::kPartition );
+                std::vector< std::vector<SCEntry> > &rows = ws.level_rows;
+                if( rows.size() < (size_t)nnode ) rows.resize( nnode );
+                for( int k = 0; k < nnode; k ++ ) rows[ k ].resize( 0 );
+                if( hist_method ){
+                    this->collect_level_hist( best, nthread );
+                }else{
+                    this->collect_level_exact( best, owner, nthread );
+                }
+                tpart.Stop();
+                for( int k = 0; k < nnode; k ++ ) ws.level_slot[ nodes[k].tsk.nid ] = -1;
+                // histogram method: children whose histograms are made, and the histograms of their parents
+                std::vector<int> hist_child, hist_parent;
+                for( int k = 0; k < nnode; k ++ ){
+                    Task &tsk = nodes[k].tsk;
+                    if( best[k].loss_chg <= rt_eps ){
+                        this->release_hist( tsk );
+                        this->make_leaf( tsk, nodes[k].sum_grad, nodes[k].sum_hess, false ); continue;
+                    }
+                    const SCEntry *entry = rows[k].size() == 0 ? NULL : &rows[k][0];
+                    int num = static_cast<int>( rows[k].size() );
+                    if( owner[k] >= 0 ) this->sync_split_rows( tsk, owner[k], entry, num );
+                    this->make_split( tsk, entry, num, best[k].loss_chg, nodes[k].base_weight );
+                    // make_split pushes the two children to the task stack
+                    ws.next_level.push_back( task_stack[ task_stack.size() - 2 ] );
+                    ws.next_level.push_back( task_stack[ task_stack.size() - 1 ] );
+                    task_stack.resize( task_stack.size() - 2 );
+                    if( tsk.hist < 0 ) continue;
+                    // children at maximum depth become leaves without histograms
+                    if( nodes[k].depth + 1 >= param.max_depth ){
+                        this->release_hist( tsk ); continue;
+                    }
+                    hist_child.push_back( (int)ws.next_level.size() - 2 );
+                    hist_child.push_back( (int)ws.next_level.size() - 1 );
+                    hist_parent.push_back( tsk.hist );
+                }
+                this->make_level_child_hist( ws.next_level, hist_child, hist_parent );
+            }
+        private:
+            // histogram mode: build quantized bins and bin codes of rows in idset, this is done once per tree
+            inline void init_hist( size_t ngrads ){
+                const unsigned nfeat = static_cast<unsigned>( tree.param.num_feature );
+                // weighted quantile sketch of each feature, weighted by hessian
+                std::vector<utils::WQuantileSketch> sketch( nfeat );
+                for( unsigned i = 0; i < nfeat; i ++ ){
+                    sketch[i].Init( param.max_bin * 8 );
+                }
+                if( smat.HaveColAccess() ){
+                    const unsigned ncol = static_cast<unsigned>( std::min( smat.NumCol(), (size_t)nfeat ) );
+                    const unsigned nsample = static_cast<unsigned>( tree_feat.size() );
+                    #pragma omp parallel for schedule( dynamic, 1 ) num_threads( this->get_nthread() )
+                    for( unsigned i = 0; i < nsample; i ++ ){
+                        const unsigned fid = tree_feat[ i ];
+                        if( fid >= ncol ) continue;
+                        FMatrixS::Col col = smat.GetSortedCol( fid );
+                        for( bst_uint j = 0; j < col.len; j ++ ){
+                            const unsigned ridx = col.data[j].rindex;
+                            if( position[ ridx ] >= 0 ) sketch[ fid ].Push( col.data[j].fvalue, hess[ ridx ] );
+                        }
+                    }
+                }else if( smat.IsPaged() ){
+                    // one pass over the pages, rows in the tree are marked in position
+                    const FMatrixS::IPagedRows &paged = *smat.Paged();
+                    for( size_t pid = 0; pid < paged.NumPage(); pid ++ ){
+                        size_t begin, end;
+                        const FMatrixS &page = paged.GetPage( pid, begin, end );
+                        for( size_t ridx = begin; ridx < end && ridx < ngrads; ridx ++ ){
+                            if( position[ ridx ] < 0 ) continue;
+                            FMatrixS::Line sp = page[ ridx - begin ];
+                            for( unsigned j = 0; j < sp.len; j ++ ){
+                                if( this->in_tree( sp.findex[j] ) ) sketch[ sp.findex[j] ].Push( sp.fvalue[j], hess[ ridx ] );
+                            }
+                        }
+                    }
+                }else{
+                    for( size_t i = 0; i < idset.size(); i ++ ){
+                        const unsigned ridx = idset[i];
+                        FMatrixS::Line sp = smat[ ridx ];
+                        for( unsigned j = 0; j < sp.len; j ++ ){
+                            if( this->in_tree( sp.findex[j] ) ) sketch[ sp.findex[j] ].Push( sp.fvalue[j], hess[ ridx ] );
+                        }
+                    }
+                }
+                // make the cuts, the last cut of each feature is above all its values
+                hcut.cut_ptr.resize( nfeat + 1 ); hcut.cut_ptr[0] = 0;
+                hcut.cut_value.resize( 0 ); hcut.min_value.resize( nfeat );
+                utils::WQSummary summary;
+                std::vector<utils::WQSummary> merged;
+                if( this->is_dist() ) this->merge_summary( sketch, merged );
+                for( unsigned fid = 0; fid < nfeat; fid ++ ){
+                    if( this->is_dist() ){
+                        summary.data.swap( merged[ fid ].data );
+                    }else{
+                        sketch[ fid ].GetSummary( summary, param.max_bin );
+                    }
+                    if( summary.data.size() != 0 ){
+                        hcut.min_value[ fid ] = summary.data[0].value;
+                        for( size_t k = 1; k < summary.data.size(); k ++ ){
+                            hcut.cut_value.push_back( summary.data[k].value );
+                        }
+                        hcut.cut_value.push_back( summary.data.back().value + rt_eps );
+                    }
+                    hcut.cut_ptr[ fid + 1 ] = static_cast<unsigned>( hcut.cut_value.size() );
+                }
+                // histograms kept from previous trees are all free
+                hist_free.resize( 0 );
+                for( size_t i = hist_pool.size(); i != 0; i -- ) hist_free.push_back( (int)( i - 1 ) );
+                // paged rows do not keep bin codes in memory, bins are computed when streaming the pages
+                bin_ptr.resize( 0 ); bin_code.resize( 0 );
+                if( smat.IsPaged() ) return;
+                // get bin code of each row
+                bin_ptr.resize( ngrads + 1, 0 );
+                for( size_t i = 0; i < idset.size(); i ++ ){
+                    FMatrixS::Line sp = smat[ idset[i] ];
+                    size_t cnt = 0;
+                    for( unsigned j = 0; j < sp.len; j ++ ){
+                        if( this->in_tree( sp.findex[j] ) ) cnt ++;
+                    }
+                    bin_ptr[ idset[i] + 1 ] = cnt;
+                }
+                for( size_t i = 1; i < bin_ptr.size(); i ++ ){
+                    bin_ptr[ i ] += bin_ptr[ i - 1 ];
+                }
+                bin_code.resize( bin_ptr.back() );
+                const unsigned nrows = static_cast<unsigned>( idset.size() );
+                #pragma omp parallel for schedule( static ) num_threads( this->get_nthread() )
+                for( unsigned i = 0; i < nrows; i ++ ){
+                    const unsigned ridx = idset[i];
+                    FMatrixS::Line sp = smat[ ridx ];
+                    size_t top = bin_ptr[ ridx ];
+                    for( unsigned j = 0; j < sp.len; j ++ ){
+                        if( this->in_tree( sp.findex[j] ) ) bin_code[ top ++ ] = hcut.get_bin( sp.findex[j], sp.fvalue[j] );
+                    }
+                }
+            }
+            // distributed mode: merge the local sketches of features in the tree over all workers,
+            // the summaries are combined in order of rank, so every worker gets the same cuts
+            inline void merge_summary( std::vector<utils::WQuantileSketch> &sketch, std::vector<utils::WQSummary> &out ){
+                typedef utils::WQSummary::Entry SEntry;
+                out.resize( 0 ); out.resize( sketch.size() );
+                // local summaries are finer than the bins, so little precision is lost when the merged one is pruned
+                const size_t nlocal = static_cast<size_t>( param.max_bin ) * 2;
+                const size_t nworker = static_cast<size_t>( sync->GetWorldSize() );
+                // features are exchanged in batches, so the gathered summaries take bounded memory
+                const size_t nbatch = std::max( (size_t)1, ( (size_t)64 << 20 ) / ( nlocal * sizeof(SEntry) * nworker ) );
+                std::vector<unsigned> size, wsize;
+                std::vector<SEntry> data, wdata;
+                utils::WQSummary s, sum, tmp;
+                for( size_t begin = 0; begin < tree_feat.size(); begin += nbatch ){
+                    const size_t n = std::min( nbatch, tree_feat.size() - begin );
+                    size.resize( n ); data.resize( n * nlocal );
+                    for( size_t i = 0; i < n; i ++ ){
+                        sketch[ tree_feat[ begin + i ] ].GetSummary( s, nlocal );
+                        size[i] = static_cast<unsigned>( s.data.size() );
+                        std::copy( s.data.begin(), s.data.end(), data.begin() + i * nlocal );
+                    }
+                    wsize.resize( n * nworker ); wdata.resize( n * nlocal * nworker );
+                    {
+                        ScopedTimer timer( stats, BoostStats::kSync );
+                        sync->Allgather( &size[0], n * sizeof(unsigned), &wsize[0] );
+                        sync->Allgather( &data[0], n * nlocal * sizeof(SEntry), &wdata[0] );
+                    }
+                    for( size_t i = 0; i < n; i ++ ){
+                        sum.data.resize( 0 );
+                        for( size_t w = 0; w < nworker; w ++ ){
+                            const size_t start = ( w * n + i ) * nlocal;
+                            s.data.assign( wdata.begin() + start, wdata.begin() + start + wsize[ w * n + i ] );
+                            tmp.SetCombine( sum, s );
+                            sum.data.swap( tmp.data );
+                        }
+                        out[ tree_feat[ begin + i ] ].SetPrune( sum, param.max_bin );
+                    }
+                }
+            }
+            // paged mode: get the page of row tsk.idset[i], rows tsk.idset[i,iend) are in the page, first row of page is begin
+            inline const FMatrixS &get_page_seg( const Task &tsk, unsigned i, unsigned &iend, size_t &begin ) const{
+                const FMatrixS::IPagedRows &paged = *smat.Paged();
+                size_t end;
+                const FMatrixS &page = paged.GetPage( paged.PageOfRow( tsk.idset[i] ), begin, end );
+                iend = static_cast<unsigned>( std::lower_bound( tsk.idset + i, tsk.idset + tsk.len, (unsigned)end ) - tsk.idset );
+                return page;
+            }
+            // histogram mode, paged rows: accumulate the histogram while streaming pages, rows in idset are sorted
+            inline void build_hist_paged( const Task &tsk ){
+                std::vector<HistEntry> &hist = hist_pool[ tsk.hist ];
+                for( size_t b = 0; b < hist.size(); b ++ ) hist[b].clear();
+                for( unsigned i = 0, iend; i < tsk.len; i = iend ){
+                    size_t begin;
+                    const FMatrixS &page = this->get_page_seg( tsk, i, iend, begin );
+                    for( unsigned k = i; k < iend; k ++ ){
+                        const unsigned ridx = tsk.idset[k];
+                        FMatrixS::Line sp = page[ ridx - begin ];
+                        for( unsigned j = 0; j < sp.len; j ++ ){
+                            if( this->in_tree( sp.findex[j] ) ) hist[ hcut.get_bin( sp.findex[j], sp.fvalue[j] ) ].add( grad[ ridx ], hess[ ridx ] );
+                        }
+                    }
+                }
+            }
+            // histogram mode: allocate a histogram from pool
+            inline int alloc_hist( void ){
+                if( hist_free.size() != 0 ){
+                    int hid = hist_free.back(); hist_free.pop_back();
+                    hist_pool[ hid ].resize( hcut.cut_value.size() );
+                    return hid;
+                }
+                hist_pool.push_back( std::vector<HistEntry>( hcut.cut_value.size() ) );
+                return static_cast<int>( hist_pool.size() - 1 );
+            }
+            // histogram mode: return the histogram of task back to pool
+            inline void release_hist( Task &tsk ){
+                if( tsk.hist < 0 ) return;
+                hist_free.push_back( tsk.hist ); tsk.hist = -1;
+            }
+            // histogram mode: build the histogram of task, summed over all workers in distributed mode
+            inline void build_hist( const Task &tsk ){
+                this->build_local_hist( tsk );
+                std::vector<HistEntry> &hist = hist_pool[ tsk.hist ];
+                if( hist.size() != 0 ){
+                    this->allreduce( &hist[0].sum_grad, hist.size() * 2 );
+                }
+            }
+            // histogram mode: accumulate gradient statistics of local rows in task into its histogram,
+            // serial is set when the caller builds several histograms in parallel
+            inline void build_local_hist( const Task &tsk, bool serial = false ){
+                if( smat.IsPaged() ){
+                    this->build_hist_paged( tsk ); return;
+                }
+                std::vector<HistEntry> &hist = hist_pool[ tsk.hist ];
+                const unsigned nbin = static_cast<unsigned>( hist.size() );
+                // small nodes are not worth the reduction across threads
+                const int nthread = serial ? 1 : std::max( 1, std::min( this->get_nthread(), (int)( tsk.len / 1024 ) ) );
+                if( nthread == 1 ){
+                    for( unsigned b = 0; b < nbin; b ++ ) hist[b].clear();
+                    for( unsigned i = 0; i < tsk.len; i ++ ){
+                        const unsigned ridx = tsk.idset[i];
+                        for( size_t j = bin_ptr[ ridx ]; j < bin_ptr[ ridx + 1 ]; j ++ ){
+                            hist[ bin_code[j] ].add( grad[ ridx ], hess[ ridx ] );
+                        }
+                    }
+                    return;
+                }
+                if( thread_hist.size() < (size_t)nthread ) thread_hist.resize( nthread );
+                // OpenMP can give fewer threads than asked, only the histograms of the threads in the team are reduced
+                int nteam = nthread;
+                #pragma omp parallel num_threads( nthread )
+                {
+                    #pragma omp single
+                    nteam = omp_get_num_threads();
+                    std::vector<HistEntry> &thist = thread_hist[ omp_get_thread_num() ];
+                    thist.resize( nbin );
+                    for( unsigned b = 0; b < nbin; b ++ ) thist[b].clear();
+                    #pragma omp for schedule( static )
+                    for( unsigned i = 0; i < tsk.len; i ++ ){
+                        const unsigned ridx = tsk.idset[i];
+                        for( size_t j = bin_ptr[ ridx ]; j < bin_ptr[ ridx + 1 ]; j ++ ){
+                            thist[ bin_code[j] ].add( grad[ ridx ], hess[ ridx ] );
+                        }
+                    }
+                    // reduce in fixed thread order, so the result is deterministic
+                    #pragma omp for schedule( static )
+                    for( unsigned b = 0; b < nbin; b ++ ){
+                        hist[b].clear();
+                        for( int t = 0; t < nteam; t ++ ) hist[b].add( thread_hist[t][b] );
+                    }
+                }
+            }
+            // level-wise mode, histogram method: build the histograms of tasks together, summed over workers in one allreduce,
+            // paged rows are streamed once for all tasks, otherwise the tasks are spread over threads when there are enough of them
+            inline void build_level_hist( const std::vector<Task*> &tasks ){
+                const unsigned n = static_cast<unsigned>( tasks.size() );
+                if( n == 0 ) return;
+                // all histograms are allocated first, allocation can move histograms in the pool
+                for( unsigned i = 0; i < n; i ++ ) tasks[i]->hist = this->alloc_hist();
+                const int nthread = this->get_nthread();
+                if( smat.IsPaged() ){
+                    this->build_level_hist_paged( tasks );
+                }else if( n >= (unsigned)nthread ){
+                    #pragma omp parallel for schedule( dynamic, 1 ) num_threads( nthread )
+                    for( unsigned i = 0; i < n; i ++ ){
+                        this->build_local_hist( *tasks[i], true );
+                    }
+                }else{
+                    for( unsigned i = 0; i < n; i ++ ) this->build_local_hist( *tasks[i] );
+                }
+                if( !this->is_dist() ) return;
+                const size_t nbin = hcut.cut_value.size();
+                if( nbin == 0 ) return;
+                std::vector<double> &buf = ws.level_hist;
+                buf.resize( n * nbin * 2 );
+                for( unsigned i = 0; i < n; i ++ ){
+                    const double *h = &hist_pool[ tasks[i]->hist ][0].sum_grad;
+                    std::copy( h, h + nbin * 2, buf.begin() + i * nbin * 2 );
+                }
+                this->allreduce( &buf[0], buf.size() );
+                for( unsigned i = 0; i < n; i ++ ){
+                    double *h = &hist_pool[ tasks[i]->hist ][0].sum_grad;
+                    std::copy( buf.begin() + i * nbin * 2, buf.begin() + ( i + 1 ) * nbin * 2, h );
+                }
+            }
+            // level-wise mode, paged rows: accumulate the histograms of tasks in one pass over the pages,
+            // the task of a row is found from its position
+            inline void build_level_hist_paged( const std::vector<Task*> &tasks ){
+                std::vector<int> &slot = ws.level_slot;
+                if( slot.size() < (size_t)tree.param.num_nodes ) slot.resize( tree.param.num_nodes, -1 );
+                for( size_t i = 0; i < tasks.size(); i ++ ){
+                    std::vector<HistEntry> &hist = hist_pool[ tasks[i]->hist ];
+                    for( size_t b = 0; b < hist.size(); b ++ ) hist[b].clear();
+                    slot[ tasks[i]->nid ] = static_cast<int>( i );
+                }
+                const FMatrixS::IPagedRows &paged = *smat.Paged();
+                for( size_t pid = 0; pid < paged.NumPage(); pid ++ ){
+                    size_t begin, end;
+                    const FMatrixS &page = paged.GetPage( pid, begin, end );
+                    for( size_t ridx = begin; ridx < end && ridx < position.size(); ridx ++ ){
+                        if( position[ ridx ] < 0 || slot[ position[ ridx ] ] < 0 ) continue;
+                        std::vector<HistEntry> &hist = hist_pool[ tasks[ slot[ position[ ridx ] ] ]->hist ];
+                        FMatrixS::Line sp = page[ ridx - begin ];
+                        for( unsigned j = 0; j < sp.len; j ++ ){
+                            if( this->in_tree( sp.findex[j] ) ) hist[ hcut.get_bin( sp.findex[j], sp.fvalue[j] ) ].add( grad[ ridx ], hess[ ridx ] );
+                        }
+                    }
+                }
+                for( size_t i = 0; i < tasks.size(); i ++ ) slot[ tasks[i]->nid ] = -1;
+            }
+            // histogram mode: enumerate split points of feature fid over bins of histogram
+            inline void enumerate_hist_split( RTSelecter &sglobal, 
+                                              double rsum_grad, double rsum_hess, double root_cost,
+                                              const HistEntry *hist, unsigned fid, float parent_base_weight ) const{
+                const unsigned bstart = hcut.cut_ptr[ fid ], bend = hcut.cut_ptr[ fid + 1 ];
+                if( bstart == bend ) return;
+                // local selecter
+                RTSelecter slocal( param );
+                if( param.default_direction != 1 ){
+                    // forward process, default right
+                    double csum_grad = 0.0, csum_hess = 0.0;
+                    for( unsigned b = bstart; b < bend; b ++ ){
+                        csum_grad += hist[b].sum_grad;
+                        csum_hess += hist[b].sum_hess;
+                        if( csum_hess < param.min_child_weight ) continue;
+                        const double dsum_hess = rsum_hess - csum_hess;
+                        if( dsum_hess < param.min_child_weight ) break;
+                        double loss_chg = param.CalcCost( csum_grad, csum_hess, parent_base_weight ) + 
+                            param.CalcCost( rsum_grad - csum_grad, dsum_hess, parent_base_weight ) - root_cost;
+                        // bins in [bstart,b] goes left
+                        slocal.push_back( RTSelecter::Entry( loss_chg, b, 0, fid, hcut.cut_value[b], false ) );
+                    }
                 }
-                
                 if( param.default_direction != 2 ){
                     // backward process, default left
                     double csum_grad = 0.0, csum_hess = 0.0;
-                    for( size_t j = end; j > start; j -- ){
-                        const unsigned ridx = entry[ j - 1 ].rindex;
-                        csum_grad += grad[ ridx ];
-                        csum_hess += hess[ ridx ];
-                        // check for split
-                        if( j == start + 1 || entry[ j - 2 ].fvalue + rt_2eps < entry[ j - 1 ].fvalue ){
-                            if( csum_hess < param.min_child_weight ) continue;
-                            const double dsum_hess = rsum_hess - csum_hess;
-                            if( dsum_hess < param.min_child_weight ) break;
-                            double loss_chg = param.CalcCost( csum_grad, csum_hess, parent_base_weight ) + 
-                                param.CalcCost( rsum_grad - csum_grad, dsum_hess, parent_base_weight ) - root_cost;
-                            const int clen = static_cast<int>( end - j + 1 );
-                            // add candidate to selecter
-                            slocal.push_back( RTSelecter::Entry( loss_chg, j - 1, clen, findex,
-                                                                 j == start + 1 ? entry[j-1].fvalue - rt_eps : 0.5 * (entry[j-2].fvalue + entry[j-1].fvalue), 
-                                                                 true ) );
-                        }
+                    for( unsigned b = bend; b > bstart; b -- ){
+                        csum_grad += hist[b-1].sum_grad;
+                        csum_hess += hist[b-1].sum_hess;
+                        if( csum_hess < param.min_child_weight ) continue;
+                        const double dsum_hess = rsum_hess - csum_hess;
+                        if( dsum_hess < param.min_child_weight ) break;
+                        double loss_chg = param.CalcCost( csum_grad, csum_hess, parent_base_weight ) + 
+                            param.CalcCost( rsum_grad - csum_grad, dsum_hess, parent_base_weight ) - root_cost;
+                        // bins in [b-1,bend) goes right
+                        slocal.push_back( RTSelecter::Entry( loss_chg, b - 1, 0, fid,
+                                                             b - 1 == bstart ? hcut.min_value[ fid ] - rt_eps : hcut.cut_value[ b - 2 ],
+                                                             true ) );
                     }
                 }
                 sglobal.push_back( slocal.select() );
             }
-            
+            // histogram mode: find split for current task over histograms
+            inline void expand_hist( Task tsk, int depth ){
+                // statistics of root
+                double rsum_grad, rsum_hess;
+                this->get_node_sum( tsk, rsum_grad, rsum_hess );
+                // if minimum split weight is not meet
+                if( param.cannot_split( rsum_hess, depth )  ){
+                    this->release_hist( tsk );
+                    this->make_leaf( tsk, rsum_grad, rsum_hess, false ); return; 
+                }
+                if( tsk.hist < 0 ){
+                    ScopedTimer timer( stats, BoostStats::kHistBuild );
+                    tsk.hist = this->alloc_hist();
+                    this->build_hist( tsk );
+                }
+                // global selecter
+                RTSelecter sglobal( param );
+                // cost root 
+                const double root_cost = param.CalcRootCost( rsum_grad, rsum_hess );
+                // KEY: layerwise, weight of current node if it is leaf
+                const double base_weight = param.CalcWeight( rsum_grad, rsum_hess, tsk.parent_base_weight );
+                const int nthread = this->get_nthread();
+                const HistEntry *hist = &hist_pool[ tsk.hist ][0];
+                // per thread selecter, merged after enumeration
+                std::vector<RTSelecter> stemp( nthread, RTSelecter( param ) );
+                this->sample_node_feat();
+                const unsigned nsample = static_cast<unsigned>( node_feat.size() );
+                if( stats != NULL ) stats->AddFeat( depth, nsample );
+                ScopedTimer tenum( stats, BoostStats::kEnumSplit );
+                #pragma omp parallel for schedule( dynamic, 64 ) num_threads( nthread )
+                for( unsigned i = 0; i < nsample; i ++ ){
+                    this->enumerate_hist_split( stemp[ omp_get_thread_num() ], 
+                                                rsum_grad, rsum_hess, root_cost, hist, node_feat[ i ], base_weight );
+                }
+                tenum.Stop();
+                for( int i = 0; i < nthread; i ++ ){
+                    sglobal.push_back( stemp[ i ].select() );
+                }
+                // get the best solution
+                const RTSelecter::Entry &e = sglobal.select();
+                if( e.loss_chg <= rt_eps ){
+                    this->release_hist( tsk );
+                    this->make_leaf( tsk, rsum_grad, rsum_hess, false ); return;
+                }
+                tree[ tsk.nid ].set_split( e.split_index(), e.split_value, e.default_left() );
+                // collect rows that goes to the non-default direction
+                const unsigned fid = e.split_index();
+                const unsigned bstart = hcut.cut_ptr[ fid ], bend = hcut.cut_ptr[ fid + 1 ];
+                if( col_entry.size() == 0 ) col_entry.resize( 1 );
+                std::vector<SCEntry> &buf = col_entry[0];
+                buf.resize( 0 );
+                ScopedTimer tcollect( stats, BoostStats::kPartition );
+                if( smat.IsPaged() ){
+                    for( unsigned i = 0, iend; i < tsk.len; i = iend ){
+                        size_t begin;
+                        const FMatrixS &page = this->get_page_seg( tsk, i, iend, begin );
+                        for( unsigned k = i; k < iend; k ++ ){
+                            FMatrixS::Line sp = page[ tsk.idset[k] - begin ];
+                            for( unsigned j = 0; j < sp.len; j ++ ){
+                                if( sp.findex[j] != fid ) continue;
+                                const unsigned b = hcut.get_bin( fid, sp.fvalue[j] );
+                                if( e.default_left() ? b >= e.start : b <= e.start ){
+                                    buf.push_back( SCEntry( 0.0f, tsk.idset[k] ) );
+                                }
+                                break;
+                            }
+                        }
+                    }
+                }else{
+                    for( unsigned i = 0; i < tsk.len; i ++ ){
+                        const unsigned ridx = tsk.idset[i];
+                        for( size_t j = bin_ptr[ ridx ]; j < bin_ptr[ ridx + 1 ]; j ++ ){
+                            const unsigned b = bin_code[j];
+                            if( b < bstart || b >= bend ) continue;
+                            if( e.default_left() ? b >= e.start : b <= e.start ){
+                                buf.push_back( SCEntry( 0.0f, ridx ) );
+                            }
+                            break;
+                        }
+                    }
+                }
+                tcollect.Stop();
+                this->make_split( tsk, buf.size() == 0 ? NULL : &buf[0], static_cast<int>( buf.size() ), e.loss_chg, base_weight ); 
+                // histogram of the children, only the smaller child is built from data, the larger one is got by subtraction
+                Task &def_part = task_stack[ task_stack.size() - 2 ];
+                Task &spl_part = task_stack[ task_stack.size() - 1 ];
+                if( depth + 1 >= param.max_depth ){
+                    this->release_hist( tsk ); return;
+                }
+                // the smaller child is decided by rows of all workers, so every worker builds the same one
+                double clen[2] = { (double)def_part.len, (double)spl_part.len };
+                this->allreduce( clen, 2 );
+                Task &small = clen[0] < clen[1] ? def_part : spl_part;
+                Task &large = clen[0] < clen[1] ? spl_part : def_part;
+                ScopedTimer timer( stats, BoostStats::kHistBuild );
+                small.hist = this->alloc_hist();
+                this->build_hist( small );
+                large.hist = tsk.hist;
+                std::vector<HistEntry> &lhist = hist_pool[ large.hist ];
+                const std::vector<HistEntry> &shist = hist_pool[ small.hist ];
+                for( size_t b = 0; b < lhist.size(); b ++ ){
+                    lhist[b].sub( shist[b] );
+                }
+            }
         private:
-            // temporal storage for expand column major
-            std::vector<size_t>  tmp_rptr;        
             // find split for current task, another implementation of expand in column major manner
             // should be more memory frugal, avoid global sorting across feature       
             inline void expand( Task tsk ){
@@ -296,23 +1675,45 @@ namespace xgboost{
                 int depth = tree.GetDepth( tsk.nid );
                 // update statistiss
                 if( depth > max_depth ) max_depth = depth; 
+                if( stats != NULL ) stats->AddNode( depth, tsk.len );
                 // if bigger than max depth
                 if( depth >= param.max_depth ){
-                    this->make_leaf( tsk, 0.0, 0.0, true ); return;
+                    this->release_hist( tsk );
+                    double sum_grad, sum_hess;
+                    this->get_node_sum( tsk, sum_grad, sum_hess );
+                    this->make_leaf( tsk, sum_grad, sum_hess, false ); return;
+                }
+                // histogram based approximate split finding
+                if( param.tree_method == 1 ){
+                    this->expand_hist( tsk, depth ); return;
+                }
+                // large nodes scan the pre-sorted columns when available
+                if( this->use_presort( tsk ) ){
+                    this->expand_presort( tsk, depth ); return;
                 }
                 // convert to column major CSR format
                 const int nrows = tree.param.num_feature;
-                if( tmp_rptr.size() == 0 ){
-                    // initialize tmp storage in first usage
+                if( tmp_rptr.size() != (size_t)nrows + 1 ){
+                    // initialize tmp storage in first usage, the builder cleans it up after each use
                     tmp_rptr.resize( nrows + 1 ); 
                     std::fill( tmp_rptr.begin(), tmp_rptr.end(), 0 );
                 }
                 // records the columns
-                std::vector<SCEntry> entry;
+                std::vector<SCEntry> &entry = ws.node_entry;
                 // records the active features
-                std::vector<size_t>  aclist;
+                std::vector<size_t>  &aclist = ws.node_aclist;
+                ScopedTimer tbuild( stats, BoostStats::kColBuild );
                 utils::SparseCSRMBuilder<SCEntry,true> builder( tmp_rptr, entry, aclist );
                 builder.InitBudget( nrows );
+                // only the features sampled for the node are put into columns
+                this->sample_node_feat();
+                // statistics of each column, kept zero between nodes, and whether each column is kept
+                std::vector<HistEntry> &col_stat = ws.col_stat;
+                std::vector<char> &col_keep = ws.col_keep;
+                if( col_stat.size() != (size_t)nrows ){
+                    col_stat.resize( nrows ); col_keep.resize( nrows, 0 );
+                    for( int i = 0; i < nrows; i ++ ) col_stat[i].clear();
+                }
                 // statistics of root
                 double rsum_grad = 0.0, rsum_hess = 0.0;            
                 for( unsigned i = 0; i < tsk.len; i ++ ){
@@ -322,23 +1723,38 @@ namespace xgboost{
                     
                     FMatrixS::Line sp = smat[ ridx ];
                     for( unsigned j = 0; j < sp.len; j ++ ){
-                        builder.AddBudget( sp.findex[j] );
+                        if( node_fmask[ sp.findex[j] ] ){
+                            builder.AddBudget( sp.findex[j] );
+                            col_stat[ sp.findex[j] ].add( grad[ ridx ], hess[ ridx ] );
+                        }
                     }
                 }
                 
                 // if minimum split weight is not meet
                 if( param.cannot_split( rsum_hess, depth )  ){
+                    tbuild.Stop();
+                    for( size_t i = 0; i < aclist.size(); i ++ ) col_stat[ aclist[i] ].clear();
                     this->make_leaf( tsk, rsum_grad, rsum_hess, false ); builder.Cleanup(); return; 
                 }
+                // columns whose present rows are too light for a child can not give a split, they are never materialized
+                for( size_t i = 0; i < aclist.size(); i ++ ){
+                    const size_t fid = aclist[i];
+                    col_keep[ fid ] = col_stat[ fid ].sum_hess >= param.min_child_weight ? 1 : 0;
+                    if( col_keep[ fid ] == 0 ) col_stat[ fid ].clear();
+                }
+                builder.DropRows( col_keep );
                 
                 builder.InitStorage();
                 for( unsigned i = 0; i < tsk.len; i ++ ){
                     const unsigned ridx = tsk.idset[i];
                     FMatrixS::Line sp = smat[ ridx ];
                     for( unsigned j = 0; j < sp.len; j ++ ){
-                        builder.PushElem( sp.findex[j], SCEntry( sp.fvalue[j], ridx ) );
-                }                
+                        if( node_fmask[ sp.findex[j] ] && col_keep[ sp.findex[j] ] ){
+                            builder.PushElem( sp.findex[j], SCEntry( sp.fvalue[j], ridx ) );
+                        }
+                    }
                 }
+                tbuild.Stop();
                 // --- end of building column major matrix ---
                 // after this point, tmp_rptr and entry is ready to use
                 
@@ -348,37 +1764,78 @@ namespace xgboost{
                 const double root_cost = param.CalcRootCost( rsum_grad, rsum_hess );
                 // KEY: layerwise, weight of current node if it is leaf
                 const double base_weight = param.CalcWeight( rsum_grad, rsum_hess, tsk.parent_base_weight );
-                // enumerate feature index
-                for( size_t i = 0; i < aclist.size(); i ++ ){
+                const int nthread = this->get_nthread();
+                // per thread selecter, merged after enumeration
+                std::vector<RTSelecter> stemp( nthread, RTSelecter( param ) );
+                const unsigned nacl = static_cast<unsigned>( aclist.size() );
+                if( stats != NULL ) stats->AddFeat( depth, nacl );
+                // when profiling, columns are sorted in a pass of their own, so sorting and enumeration are timed apart
+                const bool sort_apart = stats != NULL;
+                if( sort_apart ){
+                    ScopedTimer timer( stats, BoostStats::kSort );
+                    #pragma omp parallel for schedule( dynamic, 1 ) num_threads( nthread )
+                    for( unsigned i = 0; i < nacl; i ++ ){
+                        std::sort( entry.begin() + tmp_rptr[ aclist[i] ], entry.begin() + tmp_rptr[ aclist[i] + 1 ] );
+                    }
+                }
+                ScopedTimer tenum( stats, BoostStats::kEnumSplit );
+                // enumerate feature index, each feature sorts its own segment of entry
+                #pragma omp parallel for schedule( dynamic, 1 ) num_threads( nthread )
+                for( unsigned i = 0; i < nacl; i ++ ){
                     int findex = static_cast<int>( aclist[i] );                
                     size_t start = tmp_rptr[ findex ];
                     size_t end   = tmp_rptr[ findex + 1 ];
                     utils::Assert( start < end, "bug" );
                     // local sort can be faster when the features are sparse
-                    std::sort( entry.begin() + start, entry.begin() + end );
+                    if( !sort_apart ) std::sort( entry.begin() + start, entry.begin() + end );
                     // local selecter
-                    this->enumerate_split( sglobal, tsk.len,
+                    this->enumerate_split( stemp[ omp_get_thread_num() ], tsk.len,
                                            rsum_grad, rsum_hess, root_cost,
-                                           &entry[0], start, end, findex, base_weight );
+                                           &entry[0], start, end, col_stat[ findex ], findex, base_weight );
+                }
+                tenum.Stop();
+                for( int i = 0; i < nthread; i ++ ){
+                    sglobal.push_back( stemp[ i ].select() );
+                }
+                // Cleanup tmp_rptr and column statistics for next use
+                for( unsigned i = 0; i < nacl; i ++ ){
+                    col_stat[ aclist[i] ].clear(); col_keep[ aclist[i] ] = 0;
                 }
-                // Cleanup tmp_rptr for next use
                 builder.Cleanup();
                 // get the best solution
-                const RTSelecter::Entry &e = sglobal.select();
+                RTSelecter::Entry e = sglobal.select();
+                const int owner = this->sync_best_split( tsk, e );
                 // allowed to split
                 if( e.loss_chg > rt_eps ){
                     // add splits
                     tree[ tsk.nid ].set_split( e.split_index(), e.split_value, e.default_left() );
+                    const SCEntry *sentry = NULL;
+                    int num = 0;
+                    if( owner < 0 || owner == sync->GetRank() ){
+                        sentry = &entry[ e.start ]; num = e.len;
+                    }
+                    if( owner >= 0 ) this->sync_split_rows( tsk, owner, sentry, num );
                     // re-arrange idset, push tasks
-                    this->make_split( tsk, &entry[ e.start ], e.len, e.loss_chg, base_weight ); 
+                    this->make_split( tsk, sentry, num, e.loss_chg, base_weight ); 
                 }else{
                     // make leaf if we didn't meet requirement
                     this->make_leaf( tsk, rsum_grad, rsum_hess, false );
                 }
             }
         private:
+            // initialize position of rows, if pre-sorted column access is available
+            inline void init_position( size_t ngrads ){
+                position.resize( 0 );
+                // position is used by pre-sorted columns, and to mark rows in the tree when scanning pages
+                if( !smat.HaveColAccess() && !smat.IsPaged() ) return;
+                position.resize( ngrads, -1 );
+                for( size_t i = 0; i < task_stack.size(); i ++ ){
+                    this->set_position( task_stack[i] );
+                }
+            }
             // initialize the tasks
             inline void init_tasks( size_t ngrads ){
+                ws.row_mark.resize( ngrads, 0 );
                 // add group partition if necessary
                 if( group_id.size() == 0 ){       
                     if( param.subsample > 1.0f - 1e-6f ){ 
@@ -390,12 +1847,15 @@ namespace xgboost{
                     }else{
                         idset.resize( 0 );
                         for( size_t i = 0; i < ngrads; i ++ ){
+                            if( hess[i] < 0.0f ) continue;
                             if( random::SampleBinary( param.subsample ) != 0 ){
                                 idset.push_back( (unsigned)i );
                             }
                         } 
+                        this->sync_rows( idset );
                     }
-                    this->add_task( Task( 0, &idset[0], idset.size() ) ); return;
+                    // a worker can have no rows in distributed mode, it still takes part in building the tree
+                    this->add_task( Task( 0, idset.size() == 0 ? NULL : &idset[0], idset.size() ) ); return;
                 }
                 
                 utils::Assert( group_id.size() == ngrads, "number of groups must be exact" );            
@@ -430,18 +1890,50 @@ namespace xgboost{
                           std::vector<float> &pgrad,
                           std::vector<float> &phess,
                           const FMatrixS::Image &psmat, 
-                          const std::vector<unsigned> &pgroup_id ):
+                          const std::vector<unsigned> &pgroup_id,
+                          std::vector<int> *pleaf_index = NULL,
+                          BoostStats *pstats = NULL,
+                          sync::ISync *psync = NULL ):
                 param( pparam ), tree( ptree ), grad( pgrad ), hess( phess ),
-                smat( psmat ), group_id( pgroup_id ){
+                smat( psmat ), group_id( pgroup_id ), leaf_index( pleaf_index ), stats( pstats ), sync( psync ), ws( GetWorkspace() ),
+                task_stack( ws.task_stack ), idset( ws.idset ), position( ws.position ), col_entry( ws.col_entry ),
+                hcut( ws.hcut ), bin_ptr( ws.bin_ptr ), bin_code( ws.bin_code ), hist_pool( ws.hist_pool ),
+                hist_free( ws.hist_free ), thread_hist( ws.thread_hist ), split_task( ws.split_task ), split_owner( ws.split_owner ),
+                tree_feat( ws.tree_feat ), tree_fmask( ws.tree_fmask ), node_feat( ws.node_feat ),
+                node_fmask( ws.node_fmask ), tmp_rptr( ws.tmp_rptr ){
+                utils::Assert( task_stack.size() == 0, "RTreeUpdater: only one updater can run in a thread at a time" );
             }
             inline int do_boost( int &num_pruned ){
+                if( this->is_dist() ){
+                    if( param.dsplit == 0 ) utils::Assert( param.tree_method == 1, "distributed training over rows requires tree_method=hist" );
+                    if( param.dsplit == 1 ) utils::Assert( param.tree_method == 0, "distributed training over features requires tree_method=exact" );
+                }
+                if( leaf_index != NULL ) leaf_index->assign( grad.size(), -1 );
+                this->init_feat();
                 this->init_tasks( grad.size() );
+                this->init_position( grad.size() );
+                if( param.tree_method == 1 ){
+                    ScopedTimer timer( stats, BoostStats::kHistInit );
+                    this->init_hist( grad.size() );
+                }
                 this->max_depth = 0;
                 this->num_pruned = 0;
-                Task tsk;
-                while( this->next_task( tsk ) ){
-                    this->expand( tsk );
+                if( this->use_levelwise() ){
+                    // the tasks of roots make the first level
+                    std::vector<Task> &level = ws.level;
+                    level.assign( task_stack.begin(), task_stack.end() );
+                    task_stack.resize( 0 );
+                    while( level.size() != 0 ){
+                        this->expand_level( level );
+                        level.swap( ws.next_level );
+                    }
+                }else{
+                    Task tsk;
+                    while( this->next_task( tsk ) ){
+                        this->expand( tsk );
+                    }
                 }
+                if( leaf_index != NULL && this->is_dist_col() ) this->sync_rest_leaf();
                 num_pruned = this->num_pruned;
                 return max_depth;
             }
@@ -452,6 +1944,10 @@ namespace xgboost{
         class RTreeTrainer : public IBooster{
         private:
             int silent;
+            // statistics to add profile to, NULL if not profiling
+            BoostStats *stats;
+            // synchronization engine of distributed training, NULL if not distributed
+            sync::ISync *sync;
             // tree of current shape 
             RTree tree;
             TreeParamTrain param;
@@ -481,7 +1977,7 @@ namespace xgboost{
                 tree.InitModel();
             }
         private:
-            inline int get_next( int pid, float fvalue, bool is_unknown ){
+            inline int get_next( int pid, float fvalue, bool is_unknown ) const{
                 float split_value = tree[ pid ].split_cond();
                 if( is_unknown ){
                     if( tree[ pid ].default_left() ) return tree[ pid ].cleft();
@@ -491,17 +1987,58 @@ namespace xgboost{
                     else return tree[ pid ].cright();
                 }
             }
+            // add the prediction of rows to out, row rows[k] is feats[ rows[k] - offset ], rows == NULL means rows [0,n),
+            // threadsafe, each thread has its own scratch space
+            inline void predict_rows( const FMatrixS::Image &feats, size_t offset, const unsigned *rows, size_t n,
+                                      const std::vector<unsigned> &root_index, float *out ) const{
+                const unsigned nfeat = static_cast<unsigned>( tree.param.num_feature );
+                const long ndata = static_cast<long>( n );
+                const int nthread = param.nthread > 0 ? param.nthread : omp_get_max_threads();
+                #pragma omp parallel num_threads( nthread )
+                {
+                    // scratch space of each thread, allocated once per call and reset after each row
+                    std::vector<float> feat( nfeat );
+                    std::vector<bool>  funknown( nfeat, true );
+                    #pragma omp for schedule( static, 256 )
+                    for( long k = 0; k < ndata; k ++ ){
+                        const size_t ridx = rows == NULL ? (size_t)k : rows[ k ];
+                        FMatrixS::Line sp = feats[ ridx - offset ];
+                        for( unsigned j = 0; j < sp.len; j ++ ){
+                            utils::Assert( sp.findex[j] < nfeat, "input feature execeed bound" );
+                            funknown[ sp.findex[j] ] = false;
+                            feat[ sp.findex[j] ] = sp.fvalue[j];
+                        }
+                        int pid = root_index.size() == 0 ? 0 : (int)root_index[ ridx ];
+                        while( !tree[ pid ].is_leaf() ){
+                            unsigned split_index = tree[ pid ].split_index();
+                            pid = this->get_next( pid, feat[ split_index ], funknown[ split_index ] );
+                        }
+                        out[ ridx ] += tree[ pid ].leaf_value();
+                        for( unsigned j = 0; j < sp.len; j ++ ){
+                            funknown[ sp.findex[j] ] = true;
+                        }
+                    }
+                }
+            }
         public:
-            virtual void DoBoost( std::vector<float> &grad, 
-                                  std::vector<float> &hess,
-                                  const FMatrixS::Image &smat,
-                                  const std::vector<unsigned> &group_id ){
+            // build the tree, record leaf of each row if leaf_index is not NULL
+            inline void build_tree( std::vector<float> &grad, 
+                                    std::vector<float> &hess,
+                                    const FMatrixS::Image &smat,
+                                    const std::vector<unsigned> &group_id,
+                                    std::vector<int> *leaf_index ){
                 utils::Assert( grad.size() < UINT_MAX, "number of instance exceed what we can handle" );
                 if( !silent ){
                     printf( "\nbuild GBRT with %u instances\n", (unsigned)grad.size() );
+                    // warned once in the process, the trees of all rounds fall back the same way
+                    static bool warned_levelwise = false;
+                    if( param.grow_policy == 1 && param.tree_method == 0 && !smat.HaveColAccess() && !warned_levelwise ){
+                        printf( "warning: grow_policy=levelwise needs pre-sorted columns with tree_method=exact, the tree is grown depth-first\n" );
+                        warned_levelwise = true;
+                    }
                 }
                 // start with a id set
-                RTreeUpdater updater( param, tree, grad, hess, smat, group_id );
+                RTreeUpdater updater( param, tree, grad, hess, smat, group_id, leaf_index, stats, sync );
                 int num_pruned;
                 tree.param.max_depth = updater.do_boost( num_pruned );
                 
@@ -509,6 +2046,54 @@ namespace xgboost{
                     printf( "tree train end, %d roots, %d extra nodes, %d pruned nodes ,max_depth=%d\n", 
                             tree.param.num_roots, tree.num_extra_nodes(), num_pruned, tree.param.max_depth );
                 }
+                if( param.report_scratch != 0 ){
+                    // buffers only grow, so this is also the peak usage of the thread up to now
+                    printf( "tree scratch space of thread: %lu KB\n", 
+                            (unsigned long)( RTreeUpdater::GetWorkspace().Bytes() >> 10 ) );
+                }
+            }
+        public:
+            virtual void DoBoost( std::vector<float> &grad, 
+                                  std::vector<float> &hess,
+                                  const FMatrixS::Image &smat,
+                                  const std::vector<unsigned> &group_id ){
+                this->build_tree( grad, hess, smat, group_id, NULL );
+            }
+            virtual bool DoBoostUpdatePred( std::vector<float> &grad, 
+                                            std::vector<float> &hess,
+                                            const FMatrixS::Image &smat,
+                                            const std::vector<unsigned> &group_id,
+                                            float *pred ){
+                std::vector<int> leaf_index;
+                this->build_tree( grad, hess, smat, group_id, &leaf_index );
+                ScopedTimer timer( stats, BoostStats::kPredUpdate );
+                const long ndata = static_cast<long>( leaf_index.size() );
+                const int nthread = param.nthread > 0 ? param.nthread : omp_get_max_threads();
+                #pragma omp parallel for schedule( static ) num_threads( nthread )
+                for( long i = 0; i < ndata; i ++ ){
+                    if( leaf_index[ i ] >= 0 ) pred[ i ] += tree[ leaf_index[ i ] ].leaf_value();
+                }
+                // rows left out of training, e.g. by sampling, still need to go through the tree
+                std::vector<unsigned> rest;
+                for( long i = 0; i < ndata; i ++ ){
+                    if( leaf_index[ i ] < 0 ) rest.push_back( (unsigned)i );
+                }
+                if( rest.size() == 0 ) return true;
+                if( !smat.IsPaged() ){
+                    this->predict_rows( smat, 0, &rest[0], rest.size(), group_id, pred );
+                    return true;
+                }
+                // paged rows are not threadsafe, the rows are predicted page by page
+                const FMatrixS::IPagedRows &paged = *smat.Paged();
+                size_t top = 0;
+                for( size_t pid = 0; pid < paged.NumPage() && top < rest.size(); pid ++ ){
+                    size_t begin, end, n = 0;
+                    const FMatrixS &page = paged.GetPage( pid, begin, end );
+                    while( top + n < rest.size() && rest[ top + n ] < end ) n ++;
+                    if( n != 0 ) this->predict_rows( FMatrixS::Image( page ), begin, &rest[ top ], n, group_id, pred );
+                    top += n;
+                }
+                return true;
             }
             
             virtual int GetLeafIndex( const std::vector<float> &feat,
@@ -545,8 +2130,84 @@ namespace xgboost{
                 int pid = this->GetLeafIndex( feat, funknown, gid );
                 return tree[ pid ].leaf_value();
             }        
+            virtual void PredictBatch( const FMatrixS::Image &feats, size_t nrow,
+                                       const std::vector<unsigned> &root_index, float *out ){
+                this->predict_rows( feats, 0, NULL, nrow, root_index, out );
+            }
+            virtual void PredictBatchDistCol( const FMatrixS::Image &feats, size_t nrow,
+                                              const std::vector<unsigned> &root_index, float *out ){
+                if( sync == NULL || sync->GetWorldSize() == 1 ){
+                    this->PredictBatch( feats, nrow, root_index, out ); return;
+                }
+                // the rows go down one level at a time, the worker holding the split feature of a row gives 1 for left,
+                // 2 for right, the others give 0, so the sum over workers is 0 only when the feature is missing
+                std::vector<int> nid( nrow );
+                std::vector<double> step( nrow );
+                for( size_t i = 0; i < nrow; i ++ ){
+                    nid[i] = root_index.size() == 0 ? 0 : (int)root_index[i];
+                }
+                while( true ){
+                    bool active = false;
+                    for( size_t i = 0; i < nrow; i ++ ){
+                        step[i] = 0.0;
+                        const RTree::Node &n = tree[ nid[i] ];
+                        if( n.is_leaf() ) continue;
+                        active = true;
+                        FMatrixS::Line sp = feats[ i ];
+                        for( unsigned j = 0; j < sp.len; j ++ ){
+                            if( sp.findex[j] != n.split_index() ) continue;
+                            step[i] = sp.fvalue[j] < n.split_cond() ? 1.0 : 2.0;
+                            break;
+                        }
+                    }
+                    // all workers see the same positions, so they leave the loop together
+                    if( !active ) break;
+                    sync->AllreduceSum( &step[0], nrow );
+                    for( size_t i = 0; i < nrow; i ++ ){
+                        const RTree::Node &n = tree[ nid[i] ];
+                        if( n.is_leaf() ) continue;
+                        utils::Assert( step[i] < 2.5, "a feature is held by more than one worker" );
+                        if( step[i] < 0.5 ){
+                            nid[i] = n.default_left() ? n.cleft() : n.cright();
+                        }else{
+                            nid[i] = step[i] < 1.5 ? n.cleft() : n.cright();
+                        }
+                    }
+                }
+                for( size_t i = 0; i < nrow; i ++ ){
+                    out[i] += tree[ nid[i] ].leaf_value();
+                }
+            }
+            virtual bool AppendCompiled( CompiledForest &forest ) const{
+                // re-number the nodes breadth-first, roots first, children of a node are adjacent
+                std::vector<CompiledForest::Node> cnodes( tree.param.num_roots );
+                std::vector<int> qnode;
+                for( int r = 0; r < tree.param.num_roots; r ++ ){
+                    qnode.push_back( r );
+                }
+                for( size_t i = 0; i < qnode.size(); i ++ ){
+                    const RTree::Node &n = tree[ qnode[i] ];
+                    if( n.is_leaf() ){
+                        cnodes[ i ].set_leaf( n.leaf_value() );
+                    }else{
+                        cnodes[ i ].set_split( n.split_index(), n.split_cond(), n.default_left(), (int)qnode.size() );
+                        qnode.push_back( n.cleft() );
+                        qnode.push_back( n.cright() );
+                        cnodes.resize( qnode.size() );
+                    }
+                }
+                forest.AddTree( cnodes );
+                return true;
+            }
+        public:
+            virtual void SetStats( BoostStats *stats ){
+                this->stats = stats;
+            }
+            virtual void SetSync( sync::ISync *sync ){
+                this->sync = sync;
+            }
         public:
-            RTreeTrainer( void ){ silent = 0; }
+            RTreeTrainer( void ){ silent = 0; stats = NULL; sync = NULL; }
             virtual ~RTreeTrainer( void ){}
         };
     };
@@ -208,6 +208,10 @@ namespace xgboost{
             inline Node &operator[]( int nid ){
                 return nodes[ nid ];
             }
+            /*! \brief get node given nid */
+            inline const Node &operator[]( int nid ) const{
+                return nodes[ nid ];
+            }
             /*! \brief get node statistics given nid */
             inline NodeStat &stat( int nid ){
                 return stats[ nid ];
@@ -227,9 +231,9 @@ namespace xgboost{
              * \param fi input stream
              */
             inline void LoadModel( utils::IStream &fi ){
-                utils::Assert( fi.Read( &param, sizeof(Param) ) > 0, "TreeModel" );
+                utils::Assert( fi.Read( &param, sizeof(Param) ) == sizeof(Param), "TreeModel" );
                 nodes.resize( param.num_nodes );
-                utils::Assert( fi.Read( &nodes[0], sizeof(Node) * nodes.size() ) > 0, "TreeModel::Node" );
+                utils::Assert( fi.Read( &nodes[0], sizeof(Node) * nodes.size() ) == sizeof(Node) * nodes.size(), "TreeModel::Node" );
                 
                 deleted_nodes.resize( 0 );
                 for( int i = param.num_roots; i < param.num_nodes; i ++ ){
@@ -307,18 +311,55 @@ namespace xgboost{
             int   default_direction;
             // whether we want to do subsample
             float subsample;
+            // fraction of features sampled for each tree
+            float colsample_bytree;
+            // fraction of the features of the tree sampled for each node
+            float colsample_bynode;
             // whether to use layerwise aware regularization
             int   use_layerwise;
+            // nodes with at least this fraction of training rows scan the pre-sorted columns, 
+            // smaller nodes build and sort their own columns
+            float presort_ratio;
+            // number of threads used in split finding, 0 means the OpenMP default
+            int   nthread;
+            // method of split finding, 0: exact greedy over sorted feature values, 1: approximate over histogram of quantized bins
+            int   tree_method;
+            // order of growing the tree, 0: depth-first, each node scans its own rows,
+            // 1: level-wise, all nodes of a depth, including all the roots, are expanded together, in one pass over the columns
+            //    for exact method, and with the histograms of the level built and summed over workers together for histogram method;
+            //    exact method without pre-sorted columns grows depth-first
+            int   grow_policy;
+            // maximum number of bins of each feature in histogram method
+            int   max_bin;
+            // level-wise histogram method: memory budget in MB of the histograms held for nodes of a level,
+            // nodes over the budget build their histograms from data in later batches of the level
+            int   level_hist_mb;
+            // how data is split over workers in distributed training, 0: rows are sharded, needs histogram method,
+            // 1: features are sharded, each worker holds all rows with its own features, needs exact method
+            int   dsplit;
+            // whether to print the scratch space held by the tree updater after each tree
+            int   report_scratch;
             /*! \brief constructor */
             TreeParamTrain( void ){
                 learning_rate = 0.3f;
+                min_split_loss = 0.0f;
                 min_child_weight = 1.0f;
                 max_depth = 6;
                 reg_lambda = 1.0f;
                 reg_method = 2;
                 default_direction = 0;
                 subsample = 1.0f;
+                colsample_bytree = 1.0f;
+                colsample_bynode = 1.0f;
                 use_layerwise = 0;
+                presort_ratio = 0.1f;
+                nthread = 0;
+                tree_method = 0;
+                grow_policy = 0;
+                max_bin = 256;
+                level_hist_mb = 256;
+                dsplit = 0;
+                report_scratch = 0;
             }
             /*! 
              * \brief set parameters from outside 
@@ -338,7 +379,26 @@ namespace xgboost{
                 if( !strcmp( name, "reg_lambda") )        reg_lambda = (float)atof( val );
                 if( !strcmp( name, "reg_method") )        reg_method = (float)atof( val );
                 if( !strcmp( name, "subsample") )         subsample  = (float)atof( val );
+                if( !strcmp( name, "colsample_bytree") )  colsample_bytree = (float)atof( val );
+                if( !strcmp( name, "colsample_bynode") )  colsample_bynode = (float)atof( val );
                 if( !strcmp( name, "use_layerwise") )     use_layerwise = atoi( val );
+                if( !strcmp( name, "presort_ratio") )     presort_ratio = (float)atof( val );
+                if( !strcmp( name, "nthread") )           nthread = atoi( val );
+                if( !strcmp( name, "max_bin") )           max_bin = atoi( val );
+                if( !strcmp( name, "level_hist_mb") )     level_hist_mb = atoi( val );
+                if( !strcmp( name, "report_scratch") )    report_scratch = atoi( val );
+                if( !strcmp( name, "tree_method") ) {
+                    if( !strcmp( val, "exact") )  tree_method = 0;
+                    if( !strcmp( val, "hist") )   tree_method = 1;
+                }
+                if( !strcmp( name, "grow_policy") ) {
+                    if( !strcmp( val, "depthwise") )  grow_policy = 0;
+                    if( !strcmp( val, "levelwise") )  grow_policy = 1;
+                }
+                if( !strcmp( name, "dsplit") ) {
+                    if( !strcmp( val, "row") )  dsplit = 0;
+                    if( !strcmp( val, "col") )  dsplit = 1;
+                }
                 if( !strcmp( name, "default_direction") ) {
                     if( !strcmp( val, "learn") )  default_direction = 0;
                     if( !strcmp( val, "left") )   default_direction = 1;
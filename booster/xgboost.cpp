@@ -28,6 +28,9 @@ namespace xgboost{
             default: utils::Error("unknown booster_type"); return NULL;
             }
         }
+        void FreeTrainSpace( void ){
+            RTreeUpdater::FreeWorkspace();
+        }
     };
 };
 
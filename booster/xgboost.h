@@ -10,7 +10,10 @@
 #include "../utils/xgboost_utils.h"
 #include "../utils/xgboost_stream.h"
 #include "../utils/xgboost_config.h"
+#include "../utils/xgboost_sync.h"
 #include "xgboost_data.h"
+#include "xgboost_forest.h"
+#include "xgboost_stats.h"
 
 /*! \brief namespace for xboost package */
 namespace xgboost{
@@ -63,6 +66,25 @@ namespace xgboost{
                                   std::vector<float> &hess,
                                   const FMatrixS::Image &feats,
                                   const std::vector<unsigned> &root_index ) = 0;
+            /*! 
+             * \brief do gradient boost training for one step, and add the prediction of the updated booster 
+             *        on the training instances to pred, a booster can do this with what it learned in training,
+             *        which is cheaper than predicting the instances again, default implementation only calls DoBoost
+             * \param grad first order gradient of each instance
+             * \param hess second order gradient of each instance
+             * \param feats features of each instance
+             * \param root_index pre-partitioned root index of each instance
+             * \param pred array of length grad.size(), prediction of instance i is added to pred[i]
+             * \return whether pred is updated, pred is not touched when false is returned
+             */
+            virtual bool DoBoostUpdatePred( std::vector<float> &grad,
+                                            std::vector<float> &hess,
+                                            const FMatrixS::Image &feats,
+                                            const std::vector<unsigned> &root_index,
+                                            float *pred ){
+                this->DoBoost( grad, hess, feats, root_index );
+                return false;
+            }
             /*! 
              * \brief predict values for given sparse feature vector
              *   NOTE: in tree implementation, this is not threadsafe, used dense version to ensure threadsafety
@@ -87,11 +109,53 @@ namespace xgboost{
                 utils::Error( "not implemented" );            
                 return 0.0f;
             }
+            /*! 
+             * \brief predict values for a batch of rows, the prediction of each row is added to out
+             *   NOTE: this function is threadsafe, several batches can be predicted concurrently by the same booster
+             * \param feats features of the rows
+             * \param nrow number of rows, rows [0,nrow) of feats are predicted
+             * \param root_index root id of each row, root_index.size() can be 0 which means all rows use root 0
+             * \param out output array of length nrow, prediction of row i is added to out[i]
+             */
+            virtual void PredictBatch( const FMatrixS::Image &feats, size_t nrow,
+                                       const std::vector<unsigned> &root_index, float *out ){
+                utils::Error( "not implemented" );
+            }
+            /*!
+             * \brief predict values for a batch of rows in distributed training with bst:dsplit=col, a collective call,
+             *        each worker holds all the rows with its own features, so each step of a row is taken by the worker
+             *        holding the split feature, the prediction of each row is added to out, see PredictBatch for the parameters
+             */
+            virtual void PredictBatchDistCol( const FMatrixS::Image &feats, size_t nrow,
+                                              const std::vector<unsigned> &root_index, float *out ){
+                utils::Error( "not implemented" );
+            }
+            /*!
+             * \brief append the compiled form of the booster to a forest, used to speedup prediction
+             * \param forest the forest to append to
+             * \return whether the booster can be compiled, boosters other than trees return false
+             */
+            virtual bool AppendCompiled( CompiledForest &forest ) const{
+                return false;
+            }
             /*! 
              * \brief print information
              * \param fo output stream 
              */        
             virtual void PrintInfo( FILE *fo ){}
+            /*!
+             * \brief set statistics that training adds its profile to, the booster does not own it
+             * \param stats statistics to add to, NULL disables profiling
+             */
+            virtual void SetStats( BoostStats *stats ){}
+            /*!
+             * \brief set synchronization engine of distributed training, the booster does not own it,
+             *        boosters that do not support distributed training only accept a single worker
+             * \param sync synchronization engine, NULL means training in a single process
+             */
+            virtual void SetSync( sync::ISync *sync ){
+                utils::Assert( sync == NULL || sync->GetWorldSize() == 1, "booster does not support distributed training" );
+            }
         public:
             /*! \brief virtual destructor */
             virtual ~IBooster( void ){}
@@ -107,6 +171,11 @@ namespace xgboost{
          * \return the pointer to the gradient booster created
          */
         IBooster *CreateBooster( int booster_type );
+        /*!
+         * \brief free the training space the boosters keep for the calling thread, called when training ends,
+         *        spaces of other threads are freed when they exit
+         */
+        void FreeTrainSpace( void );
     };
 };
 #endif
@@ -0,0 +1,260 @@
+#ifndef _XGBOOST_CHECKPOINT_H_
+#define _XGBOOST_CHECKPOINT_H_
+/*!
+ * \file xgboost_checkpoint.h
+ * \brief incremental checkpoint of GBMBaseModel written by a background thread, so training is not stalled by IO
+ *
+ *        Files of a checkpoint with prefix p:
+ *          p.log       boosters appended in order, each record is the size of the booster in bytes followed by
+ *                      the booster in its SaveModel format, only boosters added since last checkpoint are appended
+ *          p.snapshot  header, user head, model parameters, boosters not in log, booster info and prediction buffer,
+ *                      written to p.snapshot.tmp and renamed, so p.snapshot is always a complete snapshot
+ *        The snapshot records how many boosters and bytes of the log belong to it, the log is written and synced
+ *        before the snapshot is renamed, so a crash at any point leaves the latest consistent snapshot loadable,
+ *        bytes of log after the recorded size are dropped when writing resumes.
+ *
+ *        When the model updates a booster in place ( do_reboost ), boosters are kept in the snapshot instead of log.
+ *        In distributed training the prediction buffer is local to each worker, so each worker uses its own prefix.
+ */
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include <unistd.h>
+#include "xgboost_gbmbase.h"
+#include "../utils/xgboost_utils.h"
+#include "../utils/xgboost_stream.h"
+
+namespace xgboost{
+    namespace booster{
+        /*!
+         * \brief writer of checkpoints, at most one checkpoint is being written at a time,
+         *        Save copies what is needed from the model and returns, a later Save waits for the earlier one
+         */
+        class CheckpointWriter{
+        public:
+            /*! \brief constructor */
+            CheckpointWriter( void ){
+                flog = NULL; running = false; ok = true;
+                num_logged = 0; log_bytes = 0;
+            }
+            /*! \brief destructor, waits for the checkpoint being written */
+            ~CheckpointWriter( void ){
+                this->Close();
+            }
+            /*!
+             * \brief start writing checkpoints with prefix
+             * \param prefix prefix of checkpoint files
+             * \param resume whether to continue the log of existing snapshot, the model saved later must be the one
+             *        loaded by Load with the same prefix; otherwise the existing checkpoint is overwritten
+             */
+            inline void Init( const char *prefix, bool resume ){
+                this->Close();
+                fname = prefix;
+                const std::string flog_name = fname + ".log";
+                Header h;
+                if( resume && ReadHeader( prefix, h ) ){
+                    flog = utils::FopenCheck( flog_name.c_str(), "r+b" );
+                    // drop the records that were written after the snapshot
+                    utils::Assert( ftruncate( fileno( flog ), static_cast<off_t>( h.log_bytes ) ) == 0 &&
+                                   fseek( flog, 0, SEEK_END ) == 0, "CheckpointWriter: fail to truncate checkpoint log" );
+                    num_logged = static_cast<size_t>( h.num_logged ); log_bytes = h.log_bytes;
+                }else{
+                    // a stale snapshot must not be resumed with the new log
+                    remove( ( fname + ".snapshot" ).c_str() );
+                    flog = utils::FopenCheck( flog_name.c_str(), "wb" );
+                    num_logged = 0; log_bytes = 0;
+                }
+            }
+            /*!
+             * \brief checkpoint the model, the boosters added since last checkpoint are serialized and the prediction buffer
+             *        is copied before return, then they are written in background, the model can be updated right away
+             * \param model the model to save
+             * \param head extra bytes saved with the snapshot, e.g. parameters of the learner, can be NULL
+             * \param head_size number of bytes of head
+             */
+            inline void Save( const GBMBaseModel &model, const void *head = NULL, size_t head_size = 0 ){
+                utils::Assert( flog != NULL, "CheckpointWriter: Init must be called before Save" );
+                this->Wait();
+                const size_t nbst = model.boosters.size();
+                const size_t nlog = model.param.do_reboost != 0 ? 0 : nbst;
+                utils::Assert( nbst == (size_t)model.param.num_boosters, "CheckpointWriter: inconsistent number of boosters" );
+                utils::Assert( nlog >= num_logged, "CheckpointWriter: model has fewer boosters than checkpoint log" );
+                pending_log.clear();
+                for( size_t i = num_logged; i < nlog; i ++ ){
+                    record.clear();
+                    utils::MemoryStream so( record );
+                    model.boosters[ i ]->SaveModel( so );
+                    const uint64_t len = record.length();
+                    pending_log.append( reinterpret_cast<const char*>( &len ), sizeof(len) );
+                    pending_log.append( record );
+                }
+                snap_boosters.clear();
+                {
+                    utils::MemoryStream so( snap_boosters );
+                    for( size_t i = nlog; i < nbst; i ++ ){
+                        model.boosters[ i ]->SaveModel( so );
+                    }
+                }
+                if( head_size != 0 ) snap_head.assign( static_cast<const char*>( head ), head_size );
+                else snap_head.clear();
+                snap_param = model.param;
+                snap_info = model.booster_info;
+                // double buffering: the writer keeps its own copy of the prediction buffer, capacity is reused
+                snap_buffer = model.pred_buffer;
+                snap_counter = model.pred_counter;
+                num_logged = nlog;
+                log_bytes += pending_log.length();
+                running = true;
+                utils::Assert( pthread_create( &worker, NULL, WriteThread, this ) == 0,
+                               "CheckpointWriter: fail to start writer thread" );
+            }
+            /*! \brief wait for the checkpoint being written, raise error if it failed */
+            inline void Wait( void ){
+                if( !running ) return;
+                pthread_join( worker, NULL );
+                running = false;
+                utils::Assert( ok, "CheckpointWriter: fail to write checkpoint" );
+            }
+            /*! \brief wait for the checkpoint being written and close the log */
+            inline void Close( void ){
+                this->Wait();
+                if( flog != NULL ){
+                    fclose( flog ); flog = NULL;
+                }
+            }
+            /*!
+             * \brief load the latest snapshot into model, replaces the boosters and prediction buffer of the model
+             * \param prefix prefix of checkpoint files
+             * \param model the model to load into, configure it by InitTrainer before training
+             * \param head output extra bytes saved with the snapshot, can be NULL
+             * \return whether a snapshot is found
+             */
+            inline static bool Load( const char *prefix, GBMBaseModel &model, std::string *head = NULL ){
+                const std::string fsnap = std::string( prefix ) + ".snapshot";
+                FILE *fi = fopen( fsnap.c_str(), "rb" );
+                if( fi == NULL ) return false;
+                utils::FileStream fs( fi, utils::FileStream::kBufferSize );
+                Header h;
+                if( fs.Read( &h, sizeof(h) ) != sizeof(h) || h.magic != kMagic || h.version != 1 ){
+                    fs.Close(); return false;
+                }
+                std::string buf( static_cast<size_t>( h.head_size ), '\0' );
+                if( h.head_size != 0 ) utils::Assert( fs.Read( &buf[0], buf.length() ) == buf.length(), "CheckpointWriter: invalid snapshot" );
+                if( head != NULL ) *head = buf;
+                if( model.boosters.size() != 0 ) model.FreeSpace();
+                utils::Assert( fs.Read( &model.param, sizeof(GBMBaseModel::Param) ) == sizeof(GBMBaseModel::Param), "CheckpointWriter: invalid snapshot" );
+                utils::Assert( h.num_logged <= (uint64_t)model.param.num_boosters, "CheckpointWriter: invalid snapshot" );
+                model.boosters.resize( model.param.num_boosters, NULL );
+                if( h.num_logged != 0 ){
+                    FILE *fl = utils::FopenCheck( ( std::string( prefix ) + ".log" ).c_str(), "rb" );
+                    utils::FileStream ls( fl, utils::FileStream::kBufferSize );
+                    uint64_t offset = 0;
+                    for( size_t i = 0; i < h.num_logged; i ++ ){
+                        uint64_t len;
+                        utils::Assert( ls.Read( &len, sizeof(len) ) == sizeof(len), "CheckpointWriter: checkpoint log is truncated" );
+                        offset += sizeof(len) + len;
+                        utils::Assert( offset <= h.log_bytes, "CheckpointWriter: checkpoint log is inconsistent with snapshot" );
+                        model.boosters[ i ] = booster::CreateBooster( model.param.booster_type );
+                        model.boosters[ i ]->LoadModel( ls );
+                        utils::Assert( (uint64_t)ftell( fl ) == offset, "CheckpointWriter: invalid booster record in log" );
+                    }
+                    ls.Close();
+                }
+                for( size_t i = h.num_logged; i < model.boosters.size(); i ++ ){
+                    model.boosters[ i ] = booster::CreateBooster( model.param.booster_type );
+                    model.boosters[ i ]->LoadModel( fs );
+                }
+                model.booster_info.resize( model.param.num_boosters );
+                if( model.param.num_boosters != 0 ){
+                    utils::Assert( fs.Read( &model.booster_info[0], sizeof(int) * model.param.num_boosters ) == sizeof(int) * model.param.num_boosters,
+                                   "CheckpointWriter: invalid snapshot" );
+                }
+                model.pred_buffer.resize( model.param.num_pbuffer );
+                model.pred_counter.resize( model.param.num_pbuffer );
+                if( model.param.num_pbuffer != 0 ){
+                    utils::Assert( fs.Read( &model.pred_buffer[0], model.pred_buffer.size() * sizeof(float) ) == model.pred_buffer.size() * sizeof(float) &&
+                                   fs.Read( &model.pred_counter[0], model.pred_counter.size() * sizeof(unsigned) ) == model.pred_counter.size() * sizeof(unsigned),
+                                   "CheckpointWriter: invalid snapshot" );
+                }
+                fs.Close();
+                model.SyncForest();
+                return true;
+            }
+        private:
+            /*! \brief header of snapshot */
+            struct Header{
+                uint32_t magic, version;
+                /*! \brief number of boosters in log */
+                uint64_t num_logged;
+                /*! \brief bytes of log that belong to the snapshot */
+                uint64_t log_bytes;
+                /*! \brief number of extra bytes from user */
+                uint64_t head_size;
+            };
+            inline static bool ReadHeader( const char *prefix, Header &h ){
+                FILE *fi = fopen( ( std::string( prefix ) + ".snapshot" ).c_str(), "rb" );
+                if( fi == NULL ) return false;
+                const bool ret = fread( &h, sizeof(h), 1, fi ) == 1 && h.magic == kMagic && h.version == 1;
+                fclose( fi );
+                return ret;
+            }
+            inline static bool WriteAll( FILE *fo, const void *ptr, size_t size ){
+                return size == 0 || fwrite( ptr, size, 1, fo ) == 1;
+            }
+            inline static void *WriteThread( void *p ){
+                static_cast<CheckpointWriter*>( p )->WriteSnapshot();
+                return NULL;
+            }
+            /*! \brief runs in writer thread: append the log, then write and rename the snapshot */
+            inline void WriteSnapshot( void ){
+                ok = WriteAll( flog, pending_log.data(), pending_log.length() ) &&
+                    fflush( flog ) == 0 && fsync( fileno( flog ) ) == 0;
+                if( !ok ) return;
+                const std::string fsnap = fname + ".snapshot", ftmp = fsnap + ".tmp";
+                FILE *fo = fopen( ftmp.c_str(), "wb" );
+                if( fo == NULL ){
+                    ok = false; return;
+                }
+                Header h;
+                memset( &h, 0, sizeof(h) );
+                h.magic = kMagic; h.version = 1;
+                h.num_logged = num_logged; h.log_bytes = log_bytes; h.head_size = snap_head.length();
+                ok = WriteAll( fo, &h, sizeof(h) ) &&
+                    WriteAll( fo, snap_head.data(), snap_head.length() ) &&
+                    WriteAll( fo, &snap_param, sizeof(snap_param) ) &&
+                    WriteAll( fo, snap_boosters.data(), snap_boosters.length() ) &&
+                    ( snap_info.size() == 0 || WriteAll( fo, &snap_info[0], snap_info.size() * sizeof(int) ) ) &&
+                    ( snap_buffer.size() == 0 || WriteAll( fo, &snap_buffer[0], snap_buffer.size() * sizeof(float) ) ) &&
+                    ( snap_counter.size() == 0 || WriteAll( fo, &snap_counter[0], snap_counter.size() * sizeof(unsigned) ) ) &&
+                    fflush( fo ) == 0 && fsync( fileno( fo ) ) == 0;
+                ok = fclose( fo ) == 0 && ok;
+                ok = ok && rename( ftmp.c_str(), fsnap.c_str() ) == 0;
+            }
+        private:
+            /*! \brief magic number of snapshot */
+            static const uint32_t kMagic = 0xfe7c4b01;
+            /*! \brief prefix of files */
+            std::string fname;
+            /*! \brief log of boosters */
+            FILE *flog;
+            /*! \brief number of boosters and bytes in log, including the checkpoint being written */
+            size_t num_logged;
+            uint64_t log_bytes;
+            /*! \brief writer thread, running when a checkpoint is being written */
+            pthread_t worker;
+            bool running;
+            /*! \brief result of last write */
+            bool ok;
+            /*! \brief content of the checkpoint being written, owned by writer thread while running */
+            std::string pending_log, record, snap_head, snap_boosters;
+            GBMBaseModel::Param snap_param;
+            std::vector<int> snap_info;
+            std::vector<float> snap_buffer;
+            std::vector<unsigned> snap_counter;
+        };
+    };
+};
+#endif
@@ -8,8 +8,13 @@
  */
 
 #include <vector>
+#include <climits>
+#include <cstring>
+#include <algorithm>
+#include <stdint.h>
 #include "../utils/xgboost_utils.h"
 #include "../utils/xgboost_stream.h"
+#include "../utils/xgboost_matrix_csr.h"
 
 namespace xgboost{
     namespace booster{
@@ -39,27 +44,124 @@ namespace xgboost{
                 /*! \brief size of the data */
                 bst_uint len;
             };
+            /*! \brief entry of the column major index, one nonzero of a column */
+            struct REntry{
+                /*! \brief row index of the entry */
+                bst_uint  rindex;
+                /*! \brief feature value of the entry */
+                bst_float fvalue;
+                /*! \brief default constructor */
+                REntry( void ){}
+                /*! \brief constructor */
+                REntry( bst_uint rindex, bst_float fvalue ){
+                    this->rindex = rindex; this->fvalue = fvalue;
+                }
+                /*! \brief compare by feature value, used to sort the column */
+                inline bool operator<( const REntry &p ) const{
+                    return fvalue < p.fvalue;
+                }
+            };
+            /*! \brief one column of the column major index, entries are sorted by feature value, or by row in the row ordered copy */
+            struct Col{
+                /*! \brief array of entries */
+                const REntry *data;
+                /*! \brief size of the data */
+                bst_uint len;
+            };
+            /*!
+             * \brief interface of rows stored out of core in pages, implemented by FMatrixPaged in xgboost_data_paged.h,
+             *        only one page is guaranteed to be in memory at a time, so the rows should be visited page by page,
+             *        none of the functions is threadsafe
+             */
+            class IPagedRows{
+            public:
+                /*! \brief number of rows */
+                virtual size_t NumRow( void ) const = 0;
+                /*! \brief number of pages */
+                virtual size_t NumPage( void ) const = 0;
+                /*! \brief index of the page that contains row ridx */
+                virtual size_t PageOfRow( size_t ridx ) const = 0;
+                /*!
+                 * \brief get a page, the returned matrix is valid until next call of GetPage or GetRow
+                 * \param pid page index
+                 * \param begin output, first row in the page
+                 * \param end output, rows [begin,end) are in the page, row begin + i is row i of the returned matrix
+                 */
+                virtual const FMatrixS &GetPage( size_t pid, size_t &begin, size_t &end ) const = 0;
+                /*! \brief get a row, the returned line is valid until next call of GetPage or GetRow */
+                virtual Line GetRow( size_t ridx ) const = 0;
+                /*! \brief number of entries that fit in the page cache, used by learners to bound their own temporal copy */
+                virtual size_t BudgetEntry( void ) const = 0;
+                /*! \brief virtual destructor */
+                virtual ~IPagedRows( void ){}
+            };
             /*! 
              * \brief remapped image of sparse matrix, 
-             *  allows use a subset of sparse matrix, by specifying a rowmap
+             *  allows use a subset of sparse matrix, by specifying a rowmap,
+             *  or refers to rows that are paged out of core
              */
             struct Image{
             public:
-                Image( const FMatrixS &smat ):smat(smat), row_map( tmp_rowmap ){                
+                Image( const FMatrixS &smat ):smat(smat), row_map( tmp_rowmap ), paged( NULL ){                
                 }
                 Image( const FMatrixS &smat, const std::vector<unsigned> &row_map )
-                    :smat(smat), row_map(row_map){
+                    :smat(smat), row_map(row_map), paged( NULL ){
                 }
-                /*! \brief get sparse part of current row */
+                /*! 
+                 * \brief image of paged rows
+                 * \param smat in memory matrix, used when paged is NULL
+                 * \param paged paged rows, can be NULL
+                 */
+                Image( const FMatrixS &smat, const IPagedRows *paged )
+                    :smat(smat), row_map( tmp_rowmap ), paged( paged ){
+                }
+                /*! \brief get sparse part of current row, for paged rows the line is valid until next row access */
                 inline Line operator[]( size_t sidx ) const{
+                    if( paged != NULL ) return paged->GetRow( sidx );
                     if( row_map.size() == 0 ) return smat[ sidx ];
                     else return smat[ row_map[ sidx ] ];
                 }
+                /*! \brief whether the rows are paged out of core */
+                inline bool IsPaged( void ) const{
+                    return paged != NULL;
+                }
+                /*! \brief get the paged rows, NULL if rows are in memory */
+                inline const IPagedRows *Paged( void ) const{
+                    return paged;
+                }
+                /*! 
+                 * \brief whether sorted column access is available, 
+                 *        row index in the column index refers to smat, so it is only valid without rowmap
+                 */
+                inline bool HaveColAccess( void ) const{
+                    return paged == NULL && row_map.size() == 0 && smat.HaveColAccess();
+                }
+                /*! \brief number of columns in column index */
+                inline size_t NumCol( void ) const{
+                    return smat.NumCol();
+                }
+                /*! \brief get sorted column, can only be called when HaveColAccess is true */
+                inline Col GetSortedCol( size_t cidx ) const{
+                    return smat.GetSortedCol( cidx );
+                }
+                /*! \brief whether the row ordered column copy is available, only valid without rowmap, see InitRowOrderCol */
+                inline bool HaveRowOrderCol( void ) const{
+                    return paged == NULL && row_map.size() == 0 && smat.HaveRowOrderCol();
+                }
+                /*! \brief number of columns in row ordered column copy */
+                inline size_t NumRowOrderCol( void ) const{
+                    return smat.NumRowOrderCol();
+                }
+                /*! \brief get column in row order, can only be called when HaveRowOrderCol is true */
+                inline Col GetRowOrderCol( size_t cidx ) const{
+                    return smat.GetRowOrderCol( cidx );
+                }
             private:
                 // used to set the simple case
                 std::vector<unsigned> tmp_rowmap;
                 const FMatrixS &smat;
                 const std::vector<unsigned> &row_map;
+                const IPagedRows *paged;
             };
         public:
             // -----Note: unless needed for hacking, these fields should not be accessed directly -----
@@ -69,6 +171,36 @@ namespace xgboost{
             std::vector<bst_uint>   findex;
             /*! \brief value of CSR format */
             std::vector<bst_float>  fvalue;
+            /*! \brief column pointer of column major index, empty if column access is not initialized */
+            std::vector<size_t>  col_ptr;
+            /*! \brief data of column major index, each column is sorted by feature value */
+            std::vector<REntry>  col_data;
+            /*! \brief column pointer of row ordered column copy, empty if it is not initialized */
+            std::vector<size_t>  rcol_ptr;
+            /*! \brief data of row ordered column copy, each column is in row order without duplicated features of a row */
+            std::vector<REntry>  rcol_data;
+            /*! \brief number of entries of the matrix when the row ordered column copy is built */
+            size_t rcol_num_entry;
+        public:
+            /*! \brief header of binary format, followed by row_ptr, findex and fvalue, each starts at aligned offset */
+            struct BinaryHeader{
+                /*! \brief magic number, identifies the format */
+                uint32_t magic;
+                /*! \brief version of the format */
+                uint32_t version;
+                /*! \brief number of rows */
+                uint64_t num_row;
+                /*! \brief number of nonzero entries */
+                uint64_t num_entry;
+                /*! \brief reserved fields, padding the header to kBinaryAlign bytes */
+                uint64_t reserved[ 5 ];
+            };
+            /*! \brief magic number of binary format */
+            static const uint32_t kBinaryMagic = 0x4d424758;
+            /*! \brief current version of binary format */
+            static const uint32_t kBinaryVersion = 1;
+            /*! \brief alignment of header and arrays in binary format */
+            static const size_t kBinaryAlign = 64;
         public:
             /*! \brief constructor */
             FMatrixS( void ){ this->Clear(); }
@@ -77,6 +209,7 @@ namespace xgboost{
              * \return number of rows
              */
             inline size_t NumRow( void ) const{
+                if( this->IsView() ) return view.num_row;
                 return row_ptr.size() - 1;
             }
             /*! 
@@ -84,14 +217,25 @@ namespace xgboost{
              * \return number of nonzero entries
              */
             inline size_t NumEntry( void ) const{
+                if( this->IsView() ) return view.row_ptr[ view.num_row ];
                 return findex.size();
             }
+            /*! \brief whether the matrix is a read-only view of binary data, see LoadView */
+            inline bool IsView( void ) const{
+                return view.row_ptr != NULL;
+            }
             /*! \brief clear the storage */
             inline void Clear( void ){
                 row_ptr.resize( 0 );
                 findex.resize( 0 );
                 fvalue.resize( 0 );
                 row_ptr.push_back( 0 );
+                col_ptr.resize( 0 );
+                col_data.resize( 0 );
+                rcol_ptr.resize( 0 );
+                rcol_data.resize( 0 );
+                rcol_num_entry = 0;
+                memset( &view, 0, sizeof(view) );
             }
             /*! 
              * \brief add a row to the matrix, but only accept features from fstart to fend
@@ -102,6 +246,7 @@ namespace xgboost{
              */
             inline size_t AddRow( const Line &feat, unsigned fstart = 0, unsigned fend = UINT_MAX ){
                 utils::Assert( feat.len >= 0, "sparse feature length can not be negative" );
+                utils::Assert( !this->IsView(), "can not add row to a read-only view" );
                 unsigned cnt = 0;
                 for( unsigned i = 0; i < feat.len; i ++ ){
                     if( feat.findex[i] < fstart || feat.findex[i] >= fend ) continue;
@@ -132,45 +277,244 @@ namespace xgboost{
             inline Line operator[]( size_t sidx ) const{
                 Line sp;
                 utils::Assert( !bst_debug || sidx < this->NumRow(), "row id exceed bound" );
-                sp.len = static_cast<bst_uint>( row_ptr[ sidx + 1 ] - row_ptr[ sidx ] );
-                sp.findex = &findex[ row_ptr[ sidx ] ];
-                sp.fvalue = &fvalue[ row_ptr[ sidx ] ];
+                if( this->IsView() ){
+                    sp.len = static_cast<bst_uint>( view.row_ptr[ sidx + 1 ] - view.row_ptr[ sidx ] );
+                    sp.findex = view.findex + view.row_ptr[ sidx ];
+                    sp.fvalue = view.fvalue + view.row_ptr[ sidx ];
+                }else{
+                    sp.len = static_cast<bst_uint>( row_ptr[ sidx + 1 ] - row_ptr[ sidx ] );
+                    sp.findex = &findex[ row_ptr[ sidx ] ];
+                    sp.fvalue = &fvalue[ row_ptr[ sidx ] ];
+                }
                 return sp;
             }
         public:
+            /*! 
+             * \brief build the column major index of the matrix, each column sorted by feature value
+             *        this only needs to be done once before training, the index can be shared by all 
+             *        the boosters, calling AddRow afterwards invalidates the index
+             */
+            inline void InitColAccess( void ){
+                if( this->HaveColAccess() ) return;
+                size_t ncol = 0;
+                for( size_t i = 0; i < this->NumRow(); i ++ ){
+                    Line sp = (*this)[i];
+                    for( bst_uint j = 0; j < sp.len; j ++ ){
+                        if( ncol <= sp.findex[j] ) ncol = sp.findex[j] + 1;
+                    }
+                }
+                utils::SparseCSRMBuilder<REntry> builder( col_ptr, col_data );
+                builder.InitBudget( ncol );
+                for( size_t i = 0; i < this->NumRow(); i ++ ){
+                    Line sp = (*this)[i];
+                    for( bst_uint j = 0; j < sp.len; j ++ ){
+                        builder.AddBudget( sp.findex[j] );
+                    }
+                }
+                builder.InitStorage();
+                for( size_t i = 0; i < this->NumRow(); i ++ ){
+                    Line sp = (*this)[i];
+                    for( bst_uint j = 0; j < sp.len; j ++ ){
+                        builder.PushElem( sp.findex[j], REntry( (bst_uint)i, sp.fvalue[j] ) );
+                    }
+                }
+                // sort columns by feature value
+                for( size_t i = 0; i < ncol; i ++ ){
+                    std::sort( col_data.begin() + col_ptr[i], col_data.begin() + col_ptr[i+1] );
+                }
+            }
+            /*! \brief whether column index is ready and consistent with current content */
+            inline bool HaveColAccess( void ) const{
+                return col_ptr.size() != 0 && col_data.size() == this->NumEntry();
+            }
+            /*! \brief number of columns in column index, 0 if column access is not initialized */
+            inline size_t NumCol( void ) const{
+                if( col_ptr.size() == 0 ) return 0;
+                return col_ptr.size() - 1;
+            }
+            /*! \brief get sorted column, InitColAccess must be called before */
+            inline Col GetSortedCol( size_t cidx ) const{
+                Col c;
+                utils::Assert( !bst_debug || cidx < this->NumCol(), "column id exceed bound" );
+                c.len  = static_cast<bst_uint>( col_ptr[ cidx + 1 ] - col_ptr[ cidx ] );
+                c.data = &col_data[ col_ptr[ cidx ] ];
+                return c;
+            }
+            /*! 
+             * \brief build the row ordered column copy of the matrix, used by coordinate descent of linear booster,
+             *        the rows of a column are visited in order, so the updates of gradient go through memory sequentially,
+             *        later duplicates of a feature in a row are dropped, the copy is built once and shared by all the rounds,
+             *        calling AddRow afterwards invalidates the copy
+             */
+            inline void InitRowOrderCol( void ){
+                if( this->HaveRowOrderCol() ) return;
+                size_t ncol = 0;
+                for( size_t i = 0; i < this->NumRow(); i ++ ){
+                    Line sp = (*this)[i];
+                    for( bst_uint j = 0; j < sp.len; j ++ ){
+                        if( ncol <= sp.findex[j] ) ncol = sp.findex[j] + 1;
+                    }
+                }
+                utils::SparseCSRMBuilder<REntry> builder( rcol_ptr, rcol_data );
+                builder.InitBudget( ncol );
+                for( size_t i = 0; i < this->NumRow(); i ++ ){
+                    Line sp = (*this)[i];
+                    for( bst_uint j = 0; j < sp.len; j ++ ){
+                        if( j == 0 || sp.findex[j-1] != sp.findex[j] ) builder.AddBudget( sp.findex[j] );
+                    }
+                }
+                builder.InitStorage();
+                for( size_t i = 0; i < this->NumRow(); i ++ ){
+                    Line sp = (*this)[i];
+                    for( bst_uint j = 0; j < sp.len; j ++ ){
+                        if( j == 0 || sp.findex[j-1] != sp.findex[j] ) builder.PushElem( sp.findex[j], REntry( (bst_uint)i, sp.fvalue[j] ) );
+                    }
+                }
+                rcol_num_entry = this->NumEntry();
+            }
+            /*! \brief whether row ordered column copy is ready and consistent with current content */
+            inline bool HaveRowOrderCol( void ) const{
+                return rcol_ptr.size() != 0 && rcol_num_entry == this->NumEntry();
+            }
+            /*! \brief number of columns in row ordered column copy, 0 if it is not initialized */
+            inline size_t NumRowOrderCol( void ) const{
+                if( rcol_ptr.size() == 0 ) return 0;
+                return rcol_ptr.size() - 1;
+            }
+            /*! \brief get column in row order, InitRowOrderCol must be called before */
+            inline Col GetRowOrderCol( size_t cidx ) const{
+                Col c;
+                utils::Assert( !bst_debug || cidx < this->NumRowOrderCol(), "column id exceed bound" );
+                c.len  = static_cast<bst_uint>( rcol_ptr[ cidx + 1 ] - rcol_ptr[ cidx ] );
+                c.data = &rcol_data[ rcol_ptr[ cidx ] ];
+                return c;
+            }
+        public:
+            /*!
+             * \brief size in bytes of binary format of a matrix, padding included
+             * \param num_row number of rows
+             * \param num_entry number of nonzero entries
+             */
+            inline static size_t BinarySize( size_t num_row, size_t num_entry ){
+                return sizeof(BinaryHeader) 
+                    + BinaryPad( ( num_row + 1 ) * sizeof(uint64_t) ) 
+                    + BinaryPad( num_entry * sizeof(bst_uint) ) 
+                    + BinaryPad( num_entry * sizeof(bst_float) );
+            }
             /*!
-             * \brief save data to binary stream 
-             *        note: since we have size_t in row_ptr, 
-             *              the function is not consistent between 64bit and 32bit machine
+             * \brief save data to binary stream, 
+             *        the format uses fixed width fields, so it is the same on 32bit and 64bit machine
              * \param fo output stream
              */
-			inline void SaveBinary(utils::IStream &fo ) const{
-                size_t nrow = this->NumRow();
-                fo.Write( &nrow, sizeof(size_t) );
-                fo.Write( &row_ptr[0], row_ptr.size() * sizeof(size_t) );
-                if( findex.size() != 0 ){
-                    fo.Write( &findex[0] , findex.size() * sizeof(bst_uint) );
-                    fo.Write( &fvalue[0] , fvalue.size() * sizeof(bst_float) );
+            inline void SaveBinary( utils::IStream &fo ) const{
+                BinaryHeader header;
+                memset( &header, 0, sizeof(header) );
+                header.magic = kBinaryMagic;
+                header.version = kBinaryVersion;
+                header.num_row = this->NumRow();
+                header.num_entry = this->NumEntry();
+                fo.Write( &header, sizeof(header) );
+                {// row pointer, converted to 64 bit
+                    std::vector<uint64_t> rptr( this->NumRow() + 1 );
+                    rptr[ 0 ] = 0;
+                    for( size_t i = 0; i < this->NumRow(); i ++ ){
+                        rptr[ i + 1 ] = rptr[ i ] + (*this)[ i ].len;
+                    }
+                    WritePadded( fo, &rptr[0], rptr.size() * sizeof(uint64_t) );
                 }
+                const bst_uint  *pindex = this->IsView() ? view.findex : ( findex.size() != 0 ? &findex[0] : NULL );
+                const bst_float *pvalue = this->IsView() ? view.fvalue : ( fvalue.size() != 0 ? &fvalue[0] : NULL );
+                WritePadded( fo, pindex, this->NumEntry() * sizeof(bst_uint) );
+                WritePadded( fo, pvalue, this->NumEntry() * sizeof(bst_float) );
             }
             /*!
-             * \brief load data from binary stream 
-             *        note: since we have size_t in row_ptr, 
-             *              the function is not consistent between 64bit and 32bit machine
-             * \param fi output stream
+             * \brief load data from binary stream, content is copied into the matrix
+             * \param fi input stream
              */
             inline void LoadBinary( utils::IStream &fi ){
-                size_t nrow;
-                utils::Assert( fi.Read( &nrow, sizeof(size_t) ) != 0, "Load FMatrixS" );
-                row_ptr.resize( nrow + 1 );
-                utils::Assert( fi.Read( &row_ptr[0], row_ptr.size() * sizeof(size_t) ), "Load FMatrixS" );
-
-                findex.resize( row_ptr.back() ); fvalue.resize( row_ptr.back() );                
+                this->Clear();
+                BinaryHeader header;
+                utils::Assert( fi.Read( &header, sizeof(header) ) == sizeof(header), "Load FMatrixS" );
+                utils::Assert( header.magic == kBinaryMagic && header.version == kBinaryVersion, 
+                               "Load FMatrixS: invalid binary format" );
+                std::vector<uint64_t> rptr( header.num_row + 1 );
+                ReadPadded( fi, &rptr[0], rptr.size() * sizeof(uint64_t) );
+                utils::Assert( rptr.back() == header.num_entry, "Load FMatrixS: inconsistent header" );
+                row_ptr.resize( rptr.size() );
+                for( size_t i = 0; i < rptr.size(); i ++ ){
+                    row_ptr[ i ] = static_cast<size_t>( rptr[ i ] );
+                }
+                findex.resize( header.num_entry ); fvalue.resize( header.num_entry );
                 if( findex.size() != 0 ){
-                    utils::Assert( fi.Read( &findex[0] , findex.size() * sizeof(bst_uint) ) , "Load FMatrixS" );
-                    utils::Assert( fi.Read( &fvalue[0] , fvalue.size() * sizeof(bst_float) ), "Load FMatrixS" );
+                    ReadPadded( fi, &findex[0], findex.size() * sizeof(bst_uint) );
+                    ReadPadded( fi, &fvalue[0], fvalue.size() * sizeof(bst_float) );
+                }
+            }
+            /*!
+             * \brief set the matrix to be a read-only view of binary data in memory, usually a mapped file,
+             *        nothing is copied except row pointer on 32bit machine, the memory must outlive the view,
+             *        rows can not be added to the view, Clear releases the view
+             * \param dptr start of binary data, must be aligned to 8 bytes
+             * \param size size of available data in bytes
+             * \return number of bytes used by the matrix, 0 if the data is not valid binary format of current version
+             */
+            inline size_t LoadView( const void *dptr, size_t size ){
+                this->Clear();
+                const char *p = static_cast<const char*>( dptr );
+                if( size < sizeof(BinaryHeader) ) return 0;
+                const BinaryHeader &header = *reinterpret_cast<const BinaryHeader*>( p );
+                if( header.magic != kBinaryMagic || header.version != kBinaryVersion ) return 0;
+                const size_t nbyte = BinarySize( header.num_row, header.num_entry );
+                if( size < nbyte ) return 0;
+                const size_t optr = sizeof(BinaryHeader);
+                const size_t oindex = optr + BinaryPad( ( header.num_row + 1 ) * sizeof(uint64_t) );
+                const size_t ovalue = oindex + BinaryPad( header.num_entry * sizeof(bst_uint) );
+                const uint64_t *rptr = reinterpret_cast<const uint64_t*>( p + optr );
+                if( rptr[ header.num_row ] != header.num_entry ) return 0;
+                if( sizeof(size_t) == sizeof(uint64_t) ){
+                    view.row_ptr = reinterpret_cast<const size_t*>( rptr );
+                }else{
+                    row_ptr.resize( header.num_row + 1 );
+                    for( size_t i = 0; i < row_ptr.size(); i ++ ){
+                        row_ptr[ i ] = static_cast<size_t>( rptr[ i ] );
+                    }
+                    view.row_ptr = &row_ptr[0];
                 }
+                view.findex  = reinterpret_cast<const bst_uint*>( p + oindex );
+                view.fvalue  = reinterpret_cast<const bst_float*>( p + ovalue );
+                view.num_row = header.num_row;
+                return nbyte;
             }
+        private:
+            /*! \brief size rounded up to kBinaryAlign */
+            inline static size_t BinaryPad( size_t size ){
+                return ( size + kBinaryAlign - 1 ) / kBinaryAlign * kBinaryAlign;
+            }
+            /*! \brief write data followed by zero padding up to alignment */
+            inline static void WritePadded( utils::IStream &fo, const void *ptr, size_t size ){
+                char zeros[ kBinaryAlign ];
+                memset( zeros, 0, sizeof(zeros) );
+                if( size != 0 ) fo.Write( ptr, size );
+                if( BinaryPad( size ) != size ) fo.Write( zeros, BinaryPad( size ) - size );
+            }
+            /*! \brief read data and skip padding */
+            inline static void ReadPadded( utils::IStream &fi, void *ptr, size_t size ){
+                char buf[ kBinaryAlign ];
+                if( size != 0 ) utils::Assert( fi.Read( ptr, size ) == size, "Load FMatrixS" );
+                if( BinaryPad( size ) != size ){
+                    utils::Assert( fi.Read( buf, BinaryPad( size ) - size ) == BinaryPad( size ) - size, "Load FMatrixS" );
+                }
+            }
+        private:
+            /*! \brief read-only storage referred by a view, row_ptr is NULL when the matrix owns its content */
+            struct View{
+                const size_t    *row_ptr;
+                const bst_uint  *findex;
+                const bst_float *fvalue;
+                size_t num_row;
+            };
+            /*! \brief view to external content */
+            View view;
         };
     };    
 };
@@ -0,0 +1,288 @@
+#ifndef _XGBOOST_DATA_COMPRESSED_H_
+#define _XGBOOST_DATA_COMPRESSED_H_
+/*!
+ * \file xgboost_data_compressed.h
+ * \brief feature matrix compressed in memory, used to keep data sets that are large but very sparse or low cardinality in RAM
+ *
+ *        Rows are grouped into blocks, each block is a byte stream of rows, a row is its length followed by its entries.
+ *        Feature index is delta to the previous index of the row, stored as zigzag variable length integer.
+ *        Value is coded by the type of the feature, decided from the distinct values of the feature over the whole matrix:
+ *        features with one distinct value, e.g. binary indicators, store no value, features with at most 256 or 65536
+ *        distinct values store one or two bytes of code into the dictionary of the feature, other features store raw floats.
+ *        The coding is lossless. The matrix is exposed as paged rows, GetPage decodes one block into a plain matrix,
+ *        so boosters that support paged rows read it without change.
+ */
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include "xgboost_data.h"
+#include "../utils/xgboost_utils.h"
+
+namespace xgboost{
+    namespace booster{
+        /*! \brief feature matrix compressed in memory */
+        class FMatrixCompressed : public FMatrixS::IPagedRows{
+        public:
+            /*! \brief constructor */
+            FMatrixCompressed( void ){
+                block_entry = 1 << 20;
+                this->Clear();
+            }
+            /*!
+             * \brief set parameters from outside
+             * \param name name of the parameter
+             * \param val  value of the parameter
+             */
+            inline void SetParam( const char *name, const char *val ){
+                // number of entries in each block, larger blocks compress the same but take more memory when decoded
+                if( !strcmp( "compress_block", name ) ) block_entry = std::max( 1, atoi( val ) );
+            }
+            /*! \brief clear the storage */
+            inline void Clear( void ){
+                blocks.clear(); row_begin.resize( 1, 0 ); row_begin[0] = 0; entry_begin = row_begin;
+                ftype.clear(); dict_ptr.resize( 1, 0 ); dict_ptr[0] = 0; dict.clear();
+                num_col = 0; num_entry = 0; max_block_entry = 0;
+                cur_block = -1; page.Clear();
+            }
+            /*!
+             * \brief compress rows of a matrix, previous content is cleared, the source is scanned twice
+             * \param smat in memory matrix, used when paged is NULL
+             * \param paged paged rows, can be NULL
+             */
+            inline void Build( const FMatrixS &smat, const FMatrixS::IPagedRows *paged ){
+                this->Clear();
+                std::vector<FeatStat> stat;
+                for( size_t pid = 0; pid < NumSourcePage( paged ); pid ++ ){
+                    size_t begin, end;
+                    const FMatrixS &src = GetSourcePage( smat, paged, pid, begin, end );
+                    for( size_t i = 0; i < end - begin; i ++ ){
+                        FMatrixS::Line sp = src[ i ];
+                        for( bst_uint j = 0; j < sp.len; j ++ ){
+                            if( stat.size() <= sp.findex[j] ) stat.resize( sp.findex[j] + 1 );
+                            stat[ sp.findex[j] ].Add( sp.fvalue[j] );
+                        }
+                    }
+                }
+                this->InitCoding( stat );
+                std::vector<unsigned char> buf;
+                size_t nrow = 0, nentry = 0;
+                for( size_t pid = 0; pid < NumSourcePage( paged ); pid ++ ){
+                    size_t begin, end;
+                    const FMatrixS &src = GetSourcePage( smat, paged, pid, begin, end );
+                    for( size_t i = 0; i < end - begin; i ++ ){
+                        FMatrixS::Line sp = src[ i ];
+                        this->EncodeRow( sp, buf );
+                        nrow ++; nentry += sp.len;
+                        if( nentry >= block_entry ){
+                            this->PushBlock( buf, nrow, nentry ); nrow = 0; nentry = 0;
+                        }
+                    }
+                }
+                if( nrow != 0 ) this->PushBlock( buf, nrow, nentry );
+            }
+            /*! \brief whether the matrix holds rows */
+            inline bool IsReady( void ) const{
+                return blocks.size() != 0;
+            }
+            /*! \brief maximum feature index plus one */
+            inline unsigned NumCol( void ) const{
+                return num_col;
+            }
+            /*! \brief number of nonzero entries */
+            inline size_t NumEntry( void ) const{
+                return num_entry;
+            }
+            /*! \brief bytes of memory held by the compressed rows and the dictionaries */
+            inline size_t Bytes( void ) const{
+                size_t n = dict.size() * sizeof(uint32_t) + dict_ptr.size() * sizeof(size_t)
+                    + ftype.size() + ( row_begin.size() + entry_begin.size() ) * sizeof(size_t);
+                for( size_t i = 0; i < blocks.size(); i ++ ) n += blocks[i].size();
+                return n;
+            }
+        public:
+            virtual size_t NumRow( void ) const{
+                return row_begin.back();
+            }
+            virtual size_t NumPage( void ) const{
+                return blocks.size();
+            }
+            virtual size_t PageOfRow( size_t ridx ) const{
+                return std::upper_bound( row_begin.begin(), row_begin.end(), ridx ) - row_begin.begin() - 1;
+            }
+            virtual const FMatrixS &GetPage( size_t pid, size_t &begin, size_t &end ) const{
+                utils::Assert( pid < blocks.size(), "FMatrixCompressed: page index exceed bound" );
+                begin = row_begin[ pid ]; end = row_begin[ pid + 1 ];
+                if( (int)pid != cur_block ){
+                    this->DecodeBlock( pid ); cur_block = (int)pid;
+                }
+                return page;
+            }
+            virtual FMatrixS::Line GetRow( size_t ridx ) const{
+                if( cur_block >= 0 && ridx >= row_begin[ cur_block ] && ridx < row_begin[ cur_block + 1 ] ){
+                    return page[ ridx - row_begin[ cur_block ] ];
+                }
+                size_t begin, end;
+                const FMatrixS &p = this->GetPage( this->PageOfRow( ridx ), begin, end );
+                return p[ ridx - begin ];
+            }
+            virtual size_t BudgetEntry( void ) const{
+                return max_block_entry;
+            }
+        private:
+            /*! \brief coding of feature values */
+            enum ValueType{ kImplicit = 0, kCode8 = 1, kCode16 = 2, kRaw = 3 };
+            /*! \brief distinct values of a feature seen in the first pass, as bit patterns so that the coding is exact */
+            struct FeatStat{
+                /*! \brief distinct values, only values[0,nsorted) are sorted and unique */
+                std::vector<uint32_t> values;
+                size_t nsorted;
+                /*! \brief whether there are more than 65536 distinct values */
+                bool overflow;
+                FeatStat( void ){ nsorted = 0; overflow = false; }
+                inline void Add( bst_float fv ){
+                    if( overflow ) return;
+                    values.push_back( ToBits( fv ) );
+                    if( values.size() >= std::max( nsorted * 2, (size_t)4096 ) ) this->Compact();
+                }
+                inline void Compact( void ){
+                    std::sort( values.begin(), values.end() );
+                    values.resize( std::unique( values.begin(), values.end() ) - values.begin() );
+                    nsorted = values.size();
+                    if( nsorted > 65536 ){
+                        overflow = true; std::vector<uint32_t>().swap( values ); nsorted = 0;
+                    }
+                }
+            };
+            inline static uint32_t ToBits( bst_float fv ){
+                uint32_t b; memcpy( &b, &fv, sizeof(b) ); return b;
+            }
+            inline static bst_float FromBits( uint32_t b ){
+                bst_float fv; memcpy( &fv, &b, sizeof(fv) ); return fv;
+            }
+            inline static size_t NumSourcePage( const FMatrixS::IPagedRows *paged ){
+                return paged != NULL ? paged->NumPage() : 1;
+            }
+            inline static const FMatrixS &GetSourcePage( const FMatrixS &smat, const FMatrixS::IPagedRows *paged,
+                                                        size_t pid, size_t &begin, size_t &end ){
+                if( paged != NULL ) return paged->GetPage( pid, begin, end );
+                begin = 0; end = smat.NumRow();
+                return smat;
+            }
+            // decide the coding of each feature from the distinct values
+            inline void InitCoding( std::vector<FeatStat> &stat ){
+                num_col = static_cast<unsigned>( stat.size() );
+                ftype.resize( stat.size() ); dict_ptr.resize( stat.size() + 1 );
+                for( size_t fid = 0; fid < stat.size(); fid ++ ){
+                    FeatStat &s = stat[ fid ];
+                    if( !s.overflow ) s.Compact();
+                    if( s.overflow ) ftype[ fid ] = kRaw;
+                    else if( s.nsorted <= 1 ) ftype[ fid ] = kImplicit;
+                    else if( s.nsorted <= 256 ) ftype[ fid ] = kCode8;
+                    else ftype[ fid ] = kCode16;
+                    if( ftype[ fid ] != kRaw ) dict.insert( dict.end(), s.values.begin(), s.values.end() );
+                    dict_ptr[ fid + 1 ] = dict.size();
+                    std::vector<uint32_t>().swap( s.values );
+                }
+            }
+            inline static void PutVarint( std::vector<unsigned char> &buf, uint64_t x ){
+                while( x >= 0x80 ){
+                    buf.push_back( static_cast<unsigned char>( x | 0x80 ) ); x >>= 7;
+                }
+                buf.push_back( static_cast<unsigned char>( x ) );
+            }
+            inline static uint64_t GetVarint( const unsigned char *&p ){
+                uint64_t x = 0;
+                for( int shift = 0; ; shift += 7 ){
+                    const unsigned char c = *p ++;
+                    x |= static_cast<uint64_t>( c & 0x7f ) << shift;
+                    if( c < 0x80 ) return x;
+                }
+            }
+            // append a row to the byte stream
+            inline void EncodeRow( const FMatrixS::Line &sp, std::vector<unsigned char> &buf ) const{
+                PutVarint( buf, sp.len );
+                int64_t last = 0;
+                for( bst_uint j = 0; j < sp.len; j ++ ){
+                    const unsigned fid = sp.findex[j];
+                    // rows are usually sorted by index, zigzag keeps unsorted rows valid
+                    const int64_t delta = static_cast<int64_t>( fid ) - last;
+                    PutVarint( buf, static_cast<uint64_t>( ( delta << 1 ) ^ ( delta >> 63 ) ) );
+                    last = fid;
+                    const uint32_t bits = ToBits( sp.fvalue[j] );
+                    if( ftype[ fid ] == kRaw ){
+                        const unsigned char *b = reinterpret_cast<const unsigned char*>( &bits );
+                        buf.insert( buf.end(), b, b + sizeof(bits) );
+                        continue;
+                    }
+                    if( ftype[ fid ] == kImplicit ) continue;
+                    const unsigned code = static_cast<unsigned>( std::lower_bound( dict.begin() + dict_ptr[ fid ],
+                                                                                   dict.begin() + dict_ptr[ fid + 1 ], bits )
+                                                                 - ( dict.begin() + dict_ptr[ fid ] ) );
+                    buf.push_back( static_cast<unsigned char>( code & 0xff ) );
+                    if( ftype[ fid ] == kCode16 ) buf.push_back( static_cast<unsigned char>( code >> 8 ) );
+                }
+            }
+            // finish a block, the block is copied to exact size so the stream buffer can be reused
+            inline void PushBlock( std::vector<unsigned char> &buf, size_t nrow, size_t nentry ){
+                blocks.push_back( std::vector<unsigned char>( buf.begin(), buf.end() ) );
+                row_begin.push_back( row_begin.back() + nrow );
+                entry_begin.push_back( entry_begin.back() + nentry );
+                num_entry += nentry;
+                max_block_entry = std::max( max_block_entry, nentry );
+                buf.resize( 0 );
+            }
+            // decode block pid into page
+            inline void DecodeBlock( size_t pid ) const{
+                const size_t nrow = row_begin[ pid + 1 ] - row_begin[ pid ];
+                page.row_ptr.resize( nrow + 1 ); page.row_ptr[0] = 0;
+                page.findex.resize( entry_begin[ pid + 1 ] - entry_begin[ pid ] );
+                page.fvalue.resize( page.findex.size() );
+                const unsigned char *p = &blocks[ pid ][0];
+                size_t top = 0;
+                for( size_t i = 0; i < nrow; i ++ ){
+                    const size_t len = static_cast<size_t>( GetVarint( p ) );
+                    int64_t last = 0;
+                    for( size_t j = 0; j < len; j ++ ){
+                        const uint64_t z = GetVarint( p );
+                        last += static_cast<int64_t>( z >> 1 ) ^ -static_cast<int64_t>( z & 1 );
+                        const unsigned fid = static_cast<unsigned>( last );
+                        uint32_t bits;
+                        switch( ftype[ fid ] ){
+                        case kImplicit: bits = dict[ dict_ptr[ fid ] ]; break;
+                        case kCode8: bits = dict[ dict_ptr[ fid ] + p[0] ]; p += 1; break;
+                        case kCode16: bits = dict[ dict_ptr[ fid ] + ( p[0] | ( p[1] << 8 ) ) ]; p += 2; break;
+                        default: memcpy( &bits, p, sizeof(bits) ); p += sizeof(bits);
+                        }
+                        page.findex[ top ] = fid;
+                        page.fvalue[ top ] = FromBits( bits ); top ++;
+                    }
+                    page.row_ptr[ i + 1 ] = top;
+                }
+            }
+        private:
+            /*! \brief number of entries in each block */
+            size_t block_entry;
+            /*! \brief byte stream of each block */
+            std::vector< std::vector<unsigned char> > blocks;
+            /*! \brief block i contains rows [row_begin[i], row_begin[i+1]) and entries [entry_begin[i], entry_begin[i+1]) */
+            std::vector<size_t> row_begin, entry_begin;
+            /*! \brief value type of each feature */
+            std::vector<unsigned char> ftype;
+            /*! \brief dictionary of feature fid is dict[dict_ptr[fid], dict_ptr[fid+1]), sorted bit patterns of the values */
+            std::vector<size_t> dict_ptr;
+            std::vector<uint32_t> dict;
+            /*! \brief maximum feature index plus one */
+            unsigned num_col;
+            /*! \brief number of nonzero entries */
+            size_t num_entry;
+            /*! \brief maximum number of entries in a block */
+            size_t max_block_entry;
+            /*! \brief block decoded in page, -1 if none */
+            mutable int cur_block;
+            /*! \brief decoded rows of current block */
+            mutable FMatrixS page;
+        };
+    };
+};
+#endif
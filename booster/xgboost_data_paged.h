@@ -0,0 +1,353 @@
+#ifndef _XGBOOST_DATA_PAGED_H_
+#define _XGBOOST_DATA_PAGED_H_
+/*!
+ * \file xgboost_data_paged.h
+ * \brief feature matrix stored out of core in pages on disk, used to train on data that does not fit in memory
+ *
+ *        File layout: pages, each in binary format of FMatrixS, followed by index of pages and a trailer.
+ *        Pages are read into a cache of page_cache slots, when a page is requested the following pages are
+ *        prefetched by a background thread, so sequential scans over the rows overlap IO with computation.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "xgboost_data.h"
+#include "../utils/xgboost_utils.h"
+#include "../utils/xgboost_stream.h"
+
+namespace xgboost{
+    namespace booster{
+        /*! \brief feature matrix paged on disk */
+        class FMatrixPaged : public FMatrixS::IPagedRows{
+        public:
+            /*! \brief constructor */
+            FMatrixPaged( void ){
+                page_size = 64 << 20;
+                page_cache = 4;
+                fd = -1; fo = NULL;
+                num_col = 0; num_entry = 0; max_page_entry = 0;
+                pthread_mutex_init( &mutex, NULL );
+                pthread_cond_init( &cond, NULL );
+                cur_page = NULL;
+            }
+            /*! \brief destructor */
+            virtual ~FMatrixPaged( void ){
+                this->Close();
+                pthread_mutex_destroy( &mutex );
+                pthread_cond_destroy( &cond );
+            }
+            /*!
+             * \brief set parameters from outside
+             * \param name name of the parameter
+             * \param val  value of the parameter
+             */
+            inline void SetParam( const char *name, const char *val ){
+                // size of each page in bytes, used when writing
+                if( !strcmp( "page_size", name ) )  page_size = static_cast<size_t>( atof( val ) );
+                // number of pages kept in memory, used when opening, 1 disables prefetching
+                if( !strcmp( "page_cache", name ) ) page_cache = std::max( 1, atoi( val ) );
+            }
+        public:
+            /*!
+             * \brief start writing a page file, rows are added by AddRow
+             * \param fname name of the page file
+             */
+            inline void InitWrite( const char *fname ){
+                this->Close();
+                fo = utils::FopenCheck( fname, "wb" );
+                fname_ = fname;
+                buf.Clear();
+                page_offset.resize( 1, 0 ); row_begin.resize( 1, 0 );
+                num_col = 0; num_entry = 0;
+            }
+            /*! \brief add a row to the page file being written */
+            inline void AddRow( const FMatrixS::Line &sp ){
+                utils::Assert( fo != NULL, "FMatrixPaged: InitWrite must be called before AddRow" );
+                buf.AddRow( sp );
+                for( bst_uint j = 0; j < sp.len; j ++ ){
+                    if( num_col <= sp.findex[j] ) num_col = sp.findex[j] + 1;
+                }
+                if( FMatrixS::BinarySize( buf.NumRow(), buf.NumEntry() ) >= page_size ) this->FlushPage();
+            }
+            /*! \brief finish writing and open the page file for reading */
+            inline void FinishWrite( void ){
+                utils::Assert( fo != NULL, "FMatrixPaged: InitWrite must be called before FinishWrite" );
+                if( buf.NumRow() != 0 ) this->FlushPage();
+                utils::FileStream fs( fo );
+                Trailer t;
+                memset( &t, 0, sizeof(t) );
+                t.magic = kMagic; t.version = 1;
+                t.num_page = page_offset.size() - 1;
+                t.num_col = num_col; t.num_entry = num_entry;
+                t.index_offset = page_offset.back();
+                fs.Write( &page_offset[0], page_offset.size() * sizeof(uint64_t) );
+                fs.Write( &row_begin[0], row_begin.size() * sizeof(uint64_t) );
+                fs.Write( &t, sizeof(t) );
+                fs.Close(); fo = NULL;
+                buf.Clear();
+                utils::Assert( this->Open( fname_.c_str() ), "FMatrixPaged: fail to reopen page file" );
+            }
+            /*!
+             * \brief open a page file for reading
+             * \param fname name of the page file
+             * \return whether the file is a valid page file
+             */
+            inline bool Open( const char *fname ){
+                this->Close();
+                fd = open( fname, O_RDONLY );
+                if( fd < 0 ) return false;
+                struct stat st;
+                Trailer t;
+                if( fstat( fd, &st ) != 0 || (size_t)st.st_size < sizeof(t) ||
+                    !this->ReadAt( &t, sizeof(t), st.st_size - sizeof(t) ) || t.magic != kMagic || t.version != 1 ){
+                    this->Close(); return false;
+                }
+                page_offset.resize( t.num_page + 1 ); row_begin.resize( t.num_page + 1 );
+                utils::Assert( this->ReadAt( &page_offset[0], page_offset.size() * sizeof(uint64_t), t.index_offset ) &&
+                               this->ReadAt( &row_begin[0], row_begin.size() * sizeof(uint64_t),
+                                             t.index_offset + page_offset.size() * sizeof(uint64_t) ),
+                               "FMatrixPaged: invalid page index" );
+                num_col = static_cast<unsigned>( t.num_col );
+                num_entry = t.num_entry;
+                max_page_entry = 0;
+                for( size_t i = 0; i < t.num_page; i ++ ){
+                    max_page_entry = std::max( max_page_entry, static_cast<size_t>( page_offset[i+1] - page_offset[i] ) / 8 );
+                }
+                // prepare the cache and start prefetcher
+                slots.resize( page_cache );
+                for( size_t i = 0; i < slots.size(); i ++ ) slots[i] = new Slot();
+                tick = 0; stop = false; cur_pid = -1; cur_page = NULL;
+                if( slots.size() > 1 ){
+                    pthread_create( &worker, NULL, PrefetchThread, this );
+                }
+                return true;
+            }
+            /*! \brief close the page file, release the cache */
+            inline void Close( void ){
+                if( fo != NULL ){
+                    fclose( fo ); fo = NULL;
+                }
+                if( fd < 0 ) return;
+                if( slots.size() > 1 ){
+                    pthread_mutex_lock( &mutex );
+                    stop = true;
+                    pthread_cond_broadcast( &cond );
+                    pthread_mutex_unlock( &mutex );
+                    pthread_join( worker, NULL );
+                }
+                for( size_t i = 0; i < slots.size(); i ++ ) delete slots[i];
+                slots.clear(); queue.clear();
+                close( fd ); fd = -1;
+                cur_page = NULL;
+            }
+            /*! \brief whether a page file is opened for reading */
+            inline bool IsOpen( void ) const{
+                return fd >= 0;
+            }
+            /*! \brief maximum feature index plus one */
+            inline unsigned NumCol( void ) const{
+                return num_col;
+            }
+            /*! \brief number of nonzero entries */
+            inline size_t NumEntry( void ) const{
+                return num_entry;
+            }
+        public:
+            virtual size_t NumRow( void ) const{
+                return row_begin.size() == 0 ? 0 : row_begin.back();
+            }
+            virtual size_t NumPage( void ) const{
+                return page_offset.size() == 0 ? 0 : page_offset.size() - 1;
+            }
+            virtual size_t PageOfRow( size_t ridx ) const{
+                return std::upper_bound( row_begin.begin(), row_begin.end(), (uint64_t)ridx ) - row_begin.begin() - 1;
+            }
+            virtual const FMatrixS &GetPage( size_t pid, size_t &begin, size_t &end ) const{
+                utils::Assert( fd >= 0 && pid < this->NumPage(), "FMatrixPaged: page index exceed bound" );
+                begin = row_begin[ pid ]; end = row_begin[ pid + 1 ];
+                if( (int)pid == cur_pid && cur_page != NULL ) return *cur_page;
+                pthread_mutex_lock( &mutex );
+                // pin the page, the prefetcher never replaces it
+                cur_pid = (int)pid;
+                Slot *s = NULL;
+                while( true ){
+                    s = this->FindSlot( pid );
+                    if( s != NULL && s->state == kReady ) break;
+                    if( s == NULL ){
+                        s = this->PickVictim();
+                        if( s != NULL ){
+                            this->LoadSlot( s, pid ); break;
+                        }
+                    }
+                    // wait for pending load
+                    pthread_cond_wait( &cond, &mutex );
+                }
+                s->last_use = ++ tick;
+                cur_page = &s->mat;
+                cur_begin = begin; cur_end = end;
+                // prefetch following pages
+                for( size_t k = 1; k < slots.size() && pid + k < this->NumPage(); k ++ ){
+                    if( this->FindSlot( pid + k ) == NULL &&
+                        std::find( queue.begin(), queue.end(), pid + k ) == queue.end() ){
+                        queue.push_back( pid + k );
+                    }
+                }
+                pthread_cond_broadcast( &cond );
+                pthread_mutex_unlock( &mutex );
+                return *cur_page;
+            }
+            virtual FMatrixS::Line GetRow( size_t ridx ) const{
+                if( cur_page != NULL && ridx >= cur_begin && ridx < cur_end ){
+                    return (*cur_page)[ ridx - cur_begin ];
+                }
+                size_t begin, end;
+                const FMatrixS &page = this->GetPage( this->PageOfRow( ridx ), begin, end );
+                return page[ ridx - begin ];
+            }
+            virtual size_t BudgetEntry( void ) const{
+                return max_page_entry * page_cache;
+            }
+        private:
+            // the cache can not be copied
+            FMatrixPaged( const FMatrixPaged &src );
+            void operator=( const FMatrixPaged &src );
+            /*! \brief trailer of the page file */
+            struct Trailer{
+                uint64_t num_page;
+                uint64_t num_entry;
+                uint64_t index_offset;
+                uint32_t num_col;
+                uint32_t reserved;
+                uint32_t magic;
+                uint32_t version;
+            };
+            /*! \brief magic number of page file */
+            static const uint32_t kMagic = 0x50424758;
+            /*! \brief state of a cache slot */
+            enum SlotState{ kEmpty = 0, kLoading = 1, kReady = 2 };
+            /*! \brief a slot of the page cache */
+            struct Slot{
+                int pid;
+                int state;
+                size_t last_use;
+                std::vector<char> data;
+                FMatrixS mat;
+                Slot( void ){ pid = -1; state = kEmpty; last_use = 0; }
+            };
+            // write buffered rows as a page
+            inline void FlushPage( void ){
+                utils::FileStream fs( fo );
+                buf.SaveBinary( fs );
+                page_offset.push_back( page_offset.back() + FMatrixS::BinarySize( buf.NumRow(), buf.NumEntry() ) );
+                row_begin.push_back( row_begin.back() + buf.NumRow() );
+                num_entry += buf.NumEntry();
+                buf.Clear();
+            }
+            // read size bytes at offset of the file, threadsafe
+            inline bool ReadAt( void *ptr, size_t size, size_t offset ) const{
+                char *p = static_cast<char*>( ptr );
+                while( size != 0 ){
+                    ssize_t n = pread( fd, p, size, offset );
+                    if( n <= 0 ) return false;
+                    p += n; size -= n; offset += n;
+                }
+                return true;
+            }
+            // find slot holding page pid, must hold the lock
+            inline Slot *FindSlot( size_t pid ) const{
+                for( size_t i = 0; i < slots.size(); i ++ ){
+                    if( slots[i]->pid == (int)pid && slots[i]->state != kEmpty ) return slots[i];
+                }
+                return NULL;
+            }
+            // least recently used slot that is not loading nor pinned, must hold the lock
+            inline Slot *PickVictim( void ) const{
+                Slot *v = NULL;
+                for( size_t i = 0; i < slots.size(); i ++ ){
+                    Slot *s = slots[i];
+                    if( s->state == kLoading || ( s->state == kReady && s->pid == cur_pid ) ) continue;
+                    if( v == NULL || s->last_use < v->last_use ) v = s;
+                }
+                return v;
+            }
+            // load page pid into slot, must hold the lock, the lock is released during IO
+            inline void LoadSlot( Slot *s, size_t pid ) const{
+                s->pid = (int)pid; s->state = kLoading;
+                pthread_mutex_unlock( &mutex );
+                const size_t size = page_offset[ pid + 1 ] - page_offset[ pid ];
+                s->data.resize( size );
+                utils::Assert( this->ReadAt( &s->data[0], size, page_offset[ pid ] ), "FMatrixPaged: fail to read page" );
+                utils::Assert( s->mat.LoadView( &s->data[0], size ) == size, "FMatrixPaged: invalid page" );
+                pthread_mutex_lock( &mutex );
+                s->state = kReady;
+                s->last_use = ++ tick;
+                pthread_cond_broadcast( &cond );
+            }
+            // prefetch pages in queue
+            inline void Prefetch( void ){
+                pthread_mutex_lock( &mutex );
+                while( !stop ){
+                    if( queue.size() == 0 ){
+                        pthread_cond_wait( &cond, &mutex ); continue;
+                    }
+                    const size_t pid = queue.front(); queue.pop_front();
+                    if( this->FindSlot( pid ) != NULL ) continue;
+                    Slot *s = this->PickVictim();
+                    // every slot is busy, drop the request
+                    if( s == NULL ) continue;
+                    this->LoadSlot( s, pid );
+                }
+                pthread_mutex_unlock( &mutex );
+            }
+            static void *PrefetchThread( void *self ){
+                static_cast<FMatrixPaged*>( self )->Prefetch();
+                return NULL;
+            }
+        private:
+            /*! \brief size of each page in bytes */
+            size_t page_size;
+            /*! \brief number of pages in cache */
+            int page_cache;
+            /*! \brief name of the page file being written */
+            std::string fname_;
+            /*! \brief output file when writing */
+            FILE *fo;
+            /*! \brief buffered rows of the page being written */
+            FMatrixS buf;
+            /*! \brief descriptor of the page file when reading */
+            int fd;
+            /*! \brief page i is in bytes [page_offset[i], page_offset[i+1]) of the file */
+            std::vector<uint64_t> page_offset;
+            /*! \brief page i contains rows [row_begin[i], row_begin[i+1]) */
+            std::vector<uint64_t> row_begin;
+            /*! \brief maximum feature index plus one */
+            unsigned num_col;
+            /*! \brief number of nonzero entries */
+            size_t num_entry;
+            /*! \brief estimated upper bound of number of entries in a page, from the page sizes */
+            size_t max_page_entry;
+            // cache state, guarded by mutex, except the fields of the current page used by the reader
+            mutable pthread_mutex_t mutex;
+            mutable pthread_cond_t cond;
+            mutable std::vector<Slot*> slots;
+            mutable std::deque<size_t> queue;
+            mutable size_t tick;
+            mutable bool stop;
+            /*! \brief the page returned last by GetPage, pinned in cache */
+            mutable int cur_pid;
+            mutable const FMatrixS *cur_page;
+            mutable size_t cur_begin, cur_end;
+            /*! \brief prefetch thread */
+            pthread_t worker;
+        };
+    };
+};
+#endif
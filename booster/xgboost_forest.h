@@ -0,0 +1,704 @@
+#ifndef _XGBOOST_FOREST_H_
+#define _XGBOOST_FOREST_H_
+/*!
+ * \file xgboost_forest.h
+ * \brief compiled forest: inference only layout of an ensemble of trees
+ *        nodes of all trees are packed into one contiguous array of 12 byte nodes, each tree is laid out breadth-first
+ *        and the two children of a node are adjacent, so the top levels of each tree share a few cache lines;
+ *        a leaf holds its value in place of the split condition and its left child is itself
+ *
+ *        PredictBlock advances a block of rows through each tree in lockstep,
+ *        using AVX2 gathers when the cpu supports it (checked at runtime), SSE2 compares otherwise
+ *
+ *        traversal of single rows is specialized at compile time: the walk of trees of depth at most kMaxFixedDepth
+ *        is unrolled to the depth of the tree without leaf test, since leaves go to themselves,
+ *        and rows that have all the features skip the missing value test
+ *
+ *        PredictRowAbove decides whether the sum is above a threshold, using bounds of leaf values of the trees
+ *        to stop once the remaining trees can not change the decision
+ *
+ *        Serving format: SaveServing writes only the arrays used by prediction, each section aligned to kAlign bytes,
+ *        LoadMapped uses them in place from memory, e.g. a file mapped by ServingModel in xgboost_serving.h,
+ *        so loading does not copy or allocate per tree; the format uses the byte order of the machine
+ */
+#include <vector>
+#include <climits>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <stdint.h>
+#include "xgboost_data.h"
+#include "../utils/xgboost_utils.h"
+#include "../utils/xgboost_stream.h"
+#include "../utils/xgboost_omp.h"
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define XGBOOST_FOREST_AVX2 1
+#include <immintrin.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace xgboost{
+    namespace booster{
+        /*! \brief inference only layout of tree ensemble */
+        class CompiledForest{
+        public:
+            /*! \brief node of a tree given to AddTree */
+            struct Node{
+                /*! \brief split feature index, highest bit indicates default left */
+                unsigned sindex;
+                /*! \brief split condition in split node, leaf value in leaf node */
+                float value;
+                /*! \brief position of left child in nodes, right child is next to it, -1 for leaf node */
+                int cleft;
+                /*! \brief feature index of split condition */
+                inline unsigned split_index( void ) const{
+                    return sindex & ( (1U<<31) - 1U );
+                }
+                /*! \brief when feature is unknown, whether goes to left child */
+                inline bool default_left( void ) const{
+                    return (sindex >> 31) != 0;
+                }
+                /*! \brief whether current node is leaf node */
+                inline bool is_leaf( void ) const{
+                    return cleft < 0;
+                }
+                /*!
+                 * \brief set split of the node
+                 * \param split_index feature index to split
+                 * \param split_cond  split condition
+                 * \param default_left the default direction when feature is unknown
+                 * \param cleft position of left child
+                 */
+                inline void set_split( unsigned split_index, float split_cond, bool default_left, int cleft ){
+                    if( default_left ) split_index |= (1U << 31);
+                    this->sindex = split_index;
+                    this->value = split_cond;
+                    this->cleft = cleft;
+                }
+                /*! \brief set the leaf value of the node */
+                inline void set_leaf( float value ){
+                    this->sindex = 0;
+                    this->value = value;
+                    this->cleft = -1;
+                }
+            };
+            /*! \brief node as stored in the forest, the right child is next to the left child, the left child of a leaf is itself */
+            struct FixedNode{
+                /*! \brief split feature index in the low 30 bits, bit 31 indicates default left, bit 30 indicates leaf */
+                unsigned sindex;
+                /*! \brief split condition in split node, leaf value in leaf node */
+                float cond;
+                /*! \brief position of left child in the forest */
+                int cleft;
+            };
+        public:
+            /*! \brief number of rows in a full block of PredictBlock, the block buffers should be sized by it */
+            static const int kBlockSize = 8;
+            /*! \brief trees up to this depth are walked by unrolled code */
+            static const int kMaxFixedDepth = 8;
+            /*! \brief flag of leaf in FixedNode::sindex */
+            static const unsigned kLeafFlag = 1U << 30;
+            /*! \brief mask of feature index in FixedNode::sindex */
+            static const unsigned kIndexMask = ( 1U << 30 ) - 1U;
+            /*! \brief alignment of sections in serving format */
+            static const size_t kAlign = 64;
+            /*! \brief constructor */
+            CompiledForest( void ){
+                use_avx2 = false;
+                #ifdef XGBOOST_FOREST_AVX2
+                use_avx2 = __builtin_cpu_supports( "avx2" ) != 0;
+                #endif
+                this->Clear();
+            }
+            /*! \brief copy constructor, a mapped forest refers to the same memory */
+            CompiledForest( const CompiledForest &src ){
+                *this = src;
+            }
+            /*! \brief assignment, a mapped forest refers to the same memory */
+            inline CompiledForest &operator=( const CompiledForest &src ){
+                if( this == &src ) return *this;
+                fnodes = src.fnodes; tree_ptr = src.tree_ptr; tree_depth = src.tree_depth;
+                bound_min = src.bound_min; bound_max = src.bound_max; bound_abs = src.bound_abs;
+                num_feature = src.num_feature; use_avx2 = src.use_avx2;
+                mapped = src.mapped; view = src.view;
+                if( !mapped ) this->RefreshView();
+                return *this;
+            }
+            /*! \brief clear the forest */
+            inline void Clear( void ){
+                fnodes.clear(); tree_ptr.clear(); tree_depth.clear();
+                bound_min.assign( 1, 0.0 ); bound_max.assign( 1, 0.0 ); bound_abs.assign( 1, 0.0 );
+                tree_ptr.push_back( 0 );
+                num_feature = 0;
+                mapped = false;
+                this->RefreshView();
+            }
+            /*! \brief number of trees in the forest */
+            inline size_t NumTree( void ) const{
+                return view.num_tree;
+            }
+            /*! \brief whether the forest refers to memory given by LoadMapped */
+            inline bool IsMapped( void ) const{
+                return mapped;
+            }
+            /*! \brief number of features needed for traversal, dense feature vectors must be at least this long */
+            inline unsigned NumFeature( void ) const{
+                return num_feature;
+            }
+            /*! \brief row stride of dense feature block used in PredictBlock */
+            inline size_t BlockStride( void ) const{
+                // one extra column, leaf nodes refer to feature 0, so the stride is never 0
+                return num_feature + 1;
+            }
+            /*!
+             * \brief add a tree to the forest
+             * \param tnodes nodes of the tree, laid out breadth-first, root r is tnodes[r],
+             *        cleft is position in tnodes
+             */
+            inline void AddTree( const std::vector<Node> &tnodes ){
+                utils::Assert( !mapped, "CompiledForest: can not add tree to mapped forest" );
+                const int base = static_cast<int>( fnodes.size() );
+                // depth of each node, parents come before children in breadth-first layout
+                std::vector<int> depth( tnodes.size(), 0 );
+                int tdepth = 0;
+                // range of leaf values of the tree
+                double vmin = DBL_MAX, vmax = -DBL_MAX;
+                for( size_t i = 0; i < tnodes.size(); i ++ ){
+                    const Node &n = tnodes[i];
+                    FixedNode f;
+                    f.cond = n.value;
+                    if( !n.is_leaf() ){
+                        depth[ n.cleft ] = depth[ n.cleft + 1 ] = depth[i] + 1;
+                        tdepth = std::max( tdepth, depth[i] + 1 );
+                        utils::Assert( n.split_index() <= kIndexMask, "compiled forest: feature index too large" );
+                        if( num_feature <= n.split_index() ) num_feature = n.split_index() + 1;
+                        f.sindex = n.sindex;
+                        f.cleft = base + n.cleft;
+                    }else{
+                        f.sindex = kLeafFlag;
+                        f.cleft = base + static_cast<int>( i );
+                        vmin = std::min( vmin, (double)n.value ); vmax = std::max( vmax, (double)n.value );
+                    }
+                    fnodes.push_back( f );
+                }
+                // gathers address nodes as int array
+                utils::Assert( fnodes.size() < INT_MAX / 4, "compiled forest too large" );
+                tree_ptr.push_back( fnodes.size() );
+                tree_depth.push_back( tdepth );
+                if( vmin > vmax ) vmin = vmax = 0.0;
+                bound_min.push_back( bound_min.back() + vmin );
+                bound_max.push_back( bound_max.back() + vmax );
+                bound_abs.push_back( bound_abs.back() + std::max( fabs( vmin ), fabs( vmax ) ) );
+                this->RefreshView();
+            }
+            /*!
+             * \brief get the leaf value of a tree for a dense feature vector
+             * \param tid tree index
+             * \param feat dense feature vector of length at least NumFeature()
+             * \param known indicator whether each feature is present, non-zero means present
+             * \param rid root id of current instance
+             * \return leaf value
+             */
+            inline float PredictTree( size_t tid, const float *feat, const int *known, unsigned rid = 0 ) const{
+                return this->PredictTreeT<true>( tid, feat, known, rid );
+            }
+            /*!
+             * \brief get the sum of trees [tstart,NumTree()) for a dense feature vector, 
+             *        the trees are added in order, the result is the same as summing PredictTree
+             * \param tstart index of first tree
+             * \param feat dense feature vector of length at least NumFeature()
+             * \param known indicator whether each feature is present, non-zero means present, not used when full
+             * \param rid root id of current instance
+             * \param full whether all features in [0,NumFeature()) are present
+             * \return sum of leaf values
+             */
+            inline float PredictRow( size_t tstart, const float *feat, const int *known, unsigned rid, bool full ) const{
+                float psum = 0.0f;
+                if( full ){
+                    for( size_t t = tstart; t < this->NumTree(); t ++ ){
+                        psum += this->PredictTreeT<false>( t, feat, known, rid );
+                    }
+                }else{
+                    for( size_t t = tstart; t < this->NumTree(); t ++ ){
+                        psum += this->PredictTreeT<true>( t, feat, known, rid );
+                    }
+                }
+                return psum;
+            }
+            /*!
+             * \brief decide whether psum plus the sum of trees [tstart,tend) for a dense feature vector is above threshold,
+             *        trees are added to psum in order, and the evaluation stops once the bounds of leaf values 
+             *        of the remaining trees can not move the sum to the other side of threshold
+             * \param tstart index of first tree
+             * \param tend end of trees, at most NumTree()
+             * \param feat dense feature vector of length at least NumFeature()
+             * \param known indicator whether each feature is present, non-zero means present, not used when full
+             * \param rid root id of current instance
+             * \param full whether all features in [0,NumFeature()) are present
+             * \param threshold decision threshold of the sum
+             * \param bound_scale fraction of the bounds of remaining trees that is trusted, 1 makes the decision exact 
+             *        up to float rounding, smaller values stop earlier and can give wrong decisions near threshold
+             * \param psum input start value of the sum, output partial sum when the decision is made
+             * \param ntree output number of trees evaluated
+             * \return whether the sum of the trees is above threshold
+             */
+            inline bool PredictRowAbove( size_t tstart, size_t tend, const float *feat, const int *known, unsigned rid, bool full,
+                                         float threshold, float bound_scale, float &psum, size_t &ntree ) const{
+                for( size_t t = tstart; t < tend; t ++ ){
+                    // bounds of the sum of remaining trees, widened by the rounding of the remaining float additions
+                    const double eps = ( fabs( psum ) + view.bound_abs[ tend ] - view.bound_abs[ t ] ) * ( tend - t ) * FLT_EPSILON;
+                    const double lo = psum + bound_scale * ( view.bound_min[ tend ] - view.bound_min[ t ] ) - eps;
+                    const double hi = psum + bound_scale * ( view.bound_max[ tend ] - view.bound_max[ t ] ) + eps;
+                    if( lo > threshold || hi <= threshold ){
+                        ntree = t - tstart;
+                        return lo > threshold;
+                    }
+                    psum += full ? this->PredictTreeT<false>( t, feat, known, rid ) : this->PredictTreeT<true>( t, feat, known, rid );
+                }
+                ntree = tend - tstart;
+                return psum > threshold;
+            }
+            /*!
+             * \brief add the sum of trees [tstart,NumTree()) of each row in a dense block to out,
+             *        the trees are added in order, the result is the same as summing PredictTree
+             * \param tstart index of first tree
+             * \param block dense features, feature j of row i is block[ i * BlockStride() + j ]
+             * \param known same layout as block, -1 means feature present, 0 means missing
+             * \param nrow number of rows in the block
+             * \param rid root id of each row
+             * \param out output, sum of row i is added to out[i]
+             * \param full whether all rows in the block have all features in [0,NumFeature()), then known is not read
+             */
+            inline void PredictBlock( size_t tstart, const float *block, const int *known, size_t nrow,
+                                      const unsigned *rid, float *out, bool full = false ) const{
+                if( full ){
+                    this->PredictBlockT<false>( tstart, block, known, nrow, rid, out );
+                }else{
+                    this->PredictBlockT<true>( tstart, block, known, nrow, rid, out );
+                }
+            }
+            /*!
+             * \brief dense scratch space of PredictBatch, reused across calls by the caller, e.g. one for each server worker,
+             *        the known flags are cleared after each block, so only the slots written by the rows are touched
+             */
+            struct BlockScratch{
+                std::vector<float> block;
+                std::vector<int> known;
+                /*! \brief size the scratch space for a forest, nothing is done when it is already sized */
+                inline void Init( size_t stride ){
+                    if( block.size() == kBlockSize * stride ) return;
+                    block.resize( kBlockSize * stride );
+                    known.assign( kBlockSize * stride, 0 );
+                }
+            };
+            /*!
+             * \brief add the sum of trees of each sparse row to out, each row starts from its own first tree,
+             *        rows are scattered into dense blocks that go through the trees together
+             * \param feats features of the rows, must be in memory
+             * \param nrow number of rows, rows [0,nrow) of feats are predicted
+             * \param out output, sum of trees [tstart[i],NumTree()) of row i is added to out[i]
+             * \param tstart index of first tree of each row, NULL means all rows start from first tree
+             * \param root_index root id of each row, size 0 means all rows use root 0
+             * \param nthread number of threads, 0 means default of openmp
+             * \param scratch scratch space kept by the caller, then the rows are predicted in the calling thread and nthread is not used,
+             *        NULL means each thread allocates its own for the call
+             */
+            inline void PredictBatch( const FMatrixS::Image &feats, size_t nrow, float *out, const unsigned *tstart,
+                                      const std::vector<unsigned> &root_index, int nthread = 0, BlockScratch *scratch = NULL ) const{
+                const long nblock = static_cast<long>( ( nrow + kBlockSize - 1 ) / kBlockSize );
+                if( scratch != NULL ){
+                    scratch->Init( this->BlockStride() );
+                    for( long b = 0; b < nblock; b ++ ){
+                        this->PredictBlockRows( feats, b * kBlockSize, nrow, out, tstart, root_index, *scratch );
+                    }
+                    return;
+                }
+                if( nthread <= 0 ) nthread = omp_get_max_threads();
+                #pragma omp parallel num_threads( nthread )
+                {
+                    BlockScratch s;
+                    s.Init( this->BlockStride() );
+                    #pragma omp for schedule( static, 32 )
+                    for( long b = 0; b < nblock; b ++ ){
+                        this->PredictBlockRows( feats, b * kBlockSize, nrow, out, tstart, root_index, s );
+                    }
+                }
+            }
+        public:
+            /*!
+             * \brief save the forest in serving format
+             * \param fo output stream
+             * \param head extra bytes saved with the forest, e.g. parameters of the learner, can be NULL
+             * \param head_size number of bytes of head
+             */
+            inline void SaveServing( utils::IStream &fo, const void *head = NULL, size_t head_size = 0 ) const{
+                ServingHeader h;
+                memset( &h, 0, sizeof(h) );
+                h.magic = kServingMagic; h.version = 1;
+                h.num_feature = num_feature;
+                h.num_tree = view.num_tree; h.num_node = view.tree_ptr[ view.num_tree ];
+                h.head_size = head_size;
+                uint64_t size[ kNumSection ];
+                SectionSize( h.num_tree, h.num_node, h.head_size, size );
+                uint64_t pos = sizeof(h);
+                for( int k = 0; k < kNumSection; k ++ ){
+                    h.offset[ k ] = ( pos + kAlign - 1 ) / kAlign * kAlign;
+                    pos = h.offset[ k ] + size[ k ];
+                }
+                const void *sec[ kNumSection ] = { view.fnodes, view.tree_ptr, view.tree_depth,
+                                                   view.bound_min, view.bound_max, view.bound_abs, head };
+                const char zero[ kAlign ] = { 0 };
+                fo.Write( &h, sizeof(h) );
+                pos = sizeof(h);
+                for( int k = 0; k < kNumSection; k ++ ){
+                    if( h.offset[ k ] != pos ) fo.Write( zero, h.offset[ k ] - pos );
+                    if( size[ k ] != 0 ) fo.Write( sec[ k ], size[ k ] );
+                    pos = h.offset[ k ] + size[ k ];
+                }
+            }
+            /*!
+             * \brief use a forest in serving format from memory in place, nothing is copied,
+             *        the forest becomes read only, Clear releases it
+             * \param data start of serving format, aligned to 8 bytes, must be kept until the forest is cleared
+             * \param size number of bytes of data
+             * \param head output pointer to extra bytes saved with the forest, can be NULL
+             * \param head_size output number of extra bytes, can be NULL
+             * \return whether data is a valid forest in serving format, the sections and every node are checked,
+             *         so a corrupt or truncated file is rejected instead of being walked out of bounds
+             */
+            inline bool LoadMapped( const void *data, size_t size, const void **head = NULL, size_t *head_size = NULL ){
+                ServingHeader h;
+                if( size < sizeof(h) || reinterpret_cast<size_t>( data ) % sizeof(uint64_t) != 0 ) return false;
+                memcpy( &h, data, sizeof(h) );
+                if( h.magic != kServingMagic || h.version != 1 || h.num_node >= INT_MAX / 4 ) return false;
+                // counts are bounded by the size of data before sizes of sections are computed from them
+                if( h.num_tree >= size / sizeof(uint64_t) || h.num_node > size / sizeof(FixedNode) || h.head_size > size ) return false;
+                uint64_t sz[ kNumSection ];
+                SectionSize( h.num_tree, h.num_node, h.head_size, sz );
+                for( int k = 0; k < kNumSection; k ++ ){
+                    if( h.offset[ k ] % sizeof(uint64_t) != 0 || h.offset[ k ] > size || sz[ k ] > size - h.offset[ k ] ) return false;
+                }
+                const char *p = static_cast<const char*>( data );
+                View v;
+                v.fnodes = reinterpret_cast<const FixedNode*>( p + h.offset[0] );
+                v.tree_ptr = reinterpret_cast<const uint64_t*>( p + h.offset[1] );
+                v.tree_depth = reinterpret_cast<const int*>( p + h.offset[2] );
+                v.bound_min = reinterpret_cast<const double*>( p + h.offset[3] );
+                v.bound_max = reinterpret_cast<const double*>( p + h.offset[4] );
+                v.bound_abs = reinterpret_cast<const double*>( p + h.offset[5] );
+                v.num_tree = static_cast<size_t>( h.num_tree );
+                if( !CheckMapped( v, h.num_node, h.num_feature ) ) return false;
+                this->Clear();
+                view = v; mapped = true;
+                num_feature = h.num_feature;
+                if( head != NULL ) *head = p + h.offset[6];
+                if( head_size != NULL ) *head_size = static_cast<size_t>( h.head_size );
+                return true;
+            }
+        private:
+            // predict rows of the block starting at begin, the scratch space is left with all known flags cleared
+            inline void PredictBlockRows( const FMatrixS::Image &feats, size_t begin, size_t nrow, float *out, const unsigned *tstart,
+                                          const std::vector<unsigned> &root_index, BlockScratch &s ) const{
+                const unsigned nfeat = this->NumFeature();
+                const size_t stride = this->BlockStride();
+                const size_t end = std::min( begin + kBlockSize, nrow );
+                std::vector<float> &block = s.block;
+                std::vector<int> &known = s.known;
+                unsigned rid[ kBlockSize ];
+                float    psum[ kBlockSize ];
+                bool same_start = true;
+                // whether all rows of the block have all the features, then the missing value test is skipped
+                bool full = true;
+                for( size_t i = begin; i < end; i ++ ){
+                    FMatrixS::Line sp = feats[ i ];
+                    const size_t off = ( i - begin ) * stride;
+                    unsigned nknown = 0;
+                    for( unsigned j = 0; j < sp.len; j ++ ){
+                        if( sp.findex[j] >= nfeat ) continue;
+                        if( known[ off + sp.findex[j] ] == 0 ) nknown ++;
+                        known[ off + sp.findex[j] ] = -1;
+                        block[ off + sp.findex[j] ] = sp.fvalue[j];
+                    }
+                    rid [ i - begin ] = root_index.size() == 0 ? 0 : root_index[ i ];
+                    psum[ i - begin ] = 0.0f;
+                    if( nknown != nfeat ) full = false;
+                    if( tstart != NULL && tstart[ i ] != tstart[ begin ] ) same_start = false;
+                }
+                if( same_start ){
+                    this->PredictBlock( tstart == NULL ? 0 : tstart[ begin ], &block[0], &known[0], end - begin, rid, psum, full );
+                }else{
+                    for( size_t i = begin; i < end; i ++ ){
+                        const size_t off = ( i - begin ) * stride;
+                        this->PredictBlock( tstart[ i ], &block[off], &known[off], 1, &rid[ i - begin ], &psum[ i - begin ], full );
+                    }
+                }
+                for( size_t i = begin; i < end; i ++ ){
+                    FMatrixS::Line sp = feats[ i ];
+                    const size_t off = ( i - begin ) * stride;
+                    out[ i ] += psum[ i - begin ];
+                    for( unsigned j = 0; j < sp.len; j ++ ){
+                        if( sp.findex[j] < nfeat ) known[ off + sp.findex[j] ] = 0;
+                    }
+                }
+            }
+            // walk of kDepth levels in fixed depth layout, unrolled at compile time,
+            // kMissing: whether features can be missing, otherwise known is not read
+            template<int kDepth, bool kMissing>
+            struct FixedWalk{
+                inline static int Run( const FixedNode *fnodes, int nid, const float *feat, const int *known ){
+                    const FixedNode &n = fnodes[ nid ];
+                    const unsigned fid = n.sindex & kIndexMask;
+                    const bool right = ( kMissing && known[ fid ] == 0 ) ? ( n.sindex >> 31 ) == 0 : !( feat[ fid ] < n.cond );
+                    // a leaf stays at itself: bit 0 of sindex >> 30 is the leaf flag
+                    const unsigned step = static_cast<unsigned>( right ) & ~( n.sindex >> 30 );
+                    return FixedWalk<kDepth - 1, kMissing>::Run( fnodes, n.cleft + static_cast<int>( step ), feat, known );
+                }
+            };
+            template<bool kMissing>
+            struct FixedWalk<0, kMissing>{
+                inline static int Run( const FixedNode *fnodes, int nid, const float *feat, const int *known ){
+                    return nid;
+                }
+            };
+            // leaf value of tree tid, trees within kMaxFixedDepth take the unrolled walk of their depth
+            template<bool kMissing>
+            inline float PredictTreeT( size_t tid, const float *feat, const int *known, unsigned rid ) const{
+                const FixedNode *f = view.fnodes;
+                const int root = static_cast<int>( view.tree_ptr[ tid ] + rid );
+                int nid;
+                switch( view.tree_depth[ tid ] ){
+                case 0: nid = root; break;
+                case 1: nid = FixedWalk<1, kMissing>::Run( f, root, feat, known ); break;
+                case 2: nid = FixedWalk<2, kMissing>::Run( f, root, feat, known ); break;
+                case 3: nid = FixedWalk<3, kMissing>::Run( f, root, feat, known ); break;
+                case 4: nid = FixedWalk<4, kMissing>::Run( f, root, feat, known ); break;
+                case 5: nid = FixedWalk<5, kMissing>::Run( f, root, feat, known ); break;
+                case 6: nid = FixedWalk<6, kMissing>::Run( f, root, feat, known ); break;
+                case 7: nid = FixedWalk<7, kMissing>::Run( f, root, feat, known ); break;
+                case 8: nid = FixedWalk<8, kMissing>::Run( f, root, feat, known ); break;
+                default:{
+                    // deeper trees walk until a leaf
+                    nid = root;
+                    while( ( f[ nid ].sindex & kLeafFlag ) == 0 ){
+                        const FixedNode &n = f[ nid ];
+                        const unsigned fid = n.sindex & kIndexMask;
+                        const bool right = ( kMissing && known[ fid ] == 0 ) ? ( n.sindex >> 31 ) == 0 : !( feat[ fid ] < n.cond );
+                        nid = n.cleft + ( right ? 1 : 0 );
+                    }
+                }
+                }
+                return f[ nid ].cond;
+            }
+            // PredictBlock specialized on whether features can be missing
+            template<bool kMissing>
+            inline void PredictBlockT( size_t tstart, const float *block, const int *known, size_t nrow,
+                                       const unsigned *rid, float *out ) const{
+                const size_t stride = this->BlockStride();
+                size_t i = 0;
+                #ifdef XGBOOST_FOREST_AVX2
+                if( use_avx2 ){
+                    for( ; i + 8 <= nrow; i += 8 ){
+                        PredictBlockAVX2<kMissing>( view.fnodes, view.tree_ptr, tstart, this->NumTree(),
+                                                    block + i * stride, known + i * stride, (int)stride, rid + i, out + i );
+                    }
+                }
+                #endif
+                #ifdef __SSE2__
+                for( ; i + 4 <= nrow; i += 4 ){
+                    PredictBlockSSE2<kMissing>( view.fnodes, view.tree_ptr, tstart, this->NumTree(),
+                                                block + i * stride, known + i * stride, stride, rid + i, out + i );
+                }
+                #endif
+                for( ; i < nrow; i ++ ){
+                    float psum = 0.0f;
+                    for( size_t t = tstart; t < this->NumTree(); t ++ ){
+                        psum += this->PredictTreeT<kMissing>( t, block + i * stride, known + i * stride, rid[i] );
+                    }
+                    out[ i ] += psum;
+                }
+            }
+            #ifdef XGBOOST_FOREST_AVX2
+            // lockstep traversal of 8 rows, node fields and features are fetched by gathers
+            template<bool kMissing>
+            __attribute__((target("avx2")))
+            static void PredictBlockAVX2( const FixedNode *fnodes, const uint64_t *tree_ptr, size_t tstart, size_t tend,
+                                          const float *block, const int *known, int stride,
+                                          const unsigned *rid, float *out ){
+                // nodes are viewed as int array of 3 fields: sindex, cond, cleft
+                const int   *ibase = reinterpret_cast<const int*>( fnodes );
+                const float *vbase = reinterpret_cast<const float*>( fnodes ) + 1;
+                const __m256i lane_off = _mm256_mullo_epi32( _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ),
+                                                             _mm256_set1_epi32( stride ) );
+                const __m256i vrid = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( rid ) );
+                const __m256i mask_findex = _mm256_set1_epi32( (int)kIndexMask );
+                const __m256i leaf_flag = _mm256_set1_epi32( (int)kLeafFlag );
+                const __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi32( 1 );
+                __m256 sum = _mm256_setzero_ps();
+                for( size_t t = tstart; t < tend; t ++ ){
+                    __m256i nid    = _mm256_add_epi32( vrid, _mm256_set1_epi32( (int)tree_ptr[ t ] ) );
+                    __m256i nid3   = _mm256_add_epi32( nid, _mm256_slli_epi32( nid, 1 ) );
+                    __m256i sindex = _mm256_i32gather_epi32( ibase, nid3, 4 );
+                    __m256i split  = _mm256_cmpeq_epi32( _mm256_and_si256( sindex, leaf_flag ), zero );
+                    while( _mm256_movemask_epi8( split ) != 0 ){
+                        __m256i cleft  = _mm256_i32gather_epi32( ibase + 2, nid3, 4 );
+                        __m256  cond   = _mm256_i32gather_ps( vbase, nid3, 4 );
+                        __m256i addr   = _mm256_add_epi32( lane_off, _mm256_and_si256( sindex, mask_findex ) );
+                        __m256  fv     = _mm256_i32gather_ps( block, addr, 4 );
+                        __m256i left   = _mm256_castps_si256( _mm256_cmp_ps( fv, cond, _CMP_LT_OQ ) );
+                        if( kMissing ){
+                            __m256i kn    = _mm256_i32gather_epi32( known, addr, 4 );
+                            __m256i dleft = _mm256_srai_epi32( sindex, 31 );
+                            left = _mm256_or_si256( _mm256_and_si256( kn, left ), _mm256_andnot_si256( kn, dleft ) );
+                        }
+                        // right child is next to left child, computed without waiting for another gather
+                        __m256i next   = _mm256_add_epi32( cleft, _mm256_add_epi32( one, left ) );
+                        nid    = _mm256_blendv_epi8( nid, next, split );
+                        nid3   = _mm256_add_epi32( nid, _mm256_slli_epi32( nid, 1 ) );
+                        sindex = _mm256_i32gather_epi32( ibase, nid3, 4 );
+                        split  = _mm256_cmpeq_epi32( _mm256_and_si256( sindex, leaf_flag ), zero );
+                    }
+                    sum = _mm256_add_ps( sum, _mm256_i32gather_ps( vbase, nid3, 4 ) );
+                }
+                float psum[ 8 ];
+                _mm256_storeu_ps( psum, sum );
+                for( int k = 0; k < 8; k ++ ) out[ k ] += psum[ k ];
+            }
+            #endif
+            #ifdef __SSE2__
+            // lockstep traversal of 4 rows, fields are loaded per lane, decisions are made with SSE2
+            template<bool kMissing>
+            static void PredictBlockSSE2( const FixedNode *fnodes, const uint64_t *tree_ptr, size_t tstart, size_t tend,
+                                          const float *block, const int *known, size_t stride,
+                                          const unsigned *rid, float *out ){
+                const __m128i one = _mm_set1_epi32( 1 ), zero = _mm_setzero_si128();
+                const __m128i leaf_flag = _mm_set1_epi32( (int)kLeafFlag );
+                __m128 sum = _mm_setzero_ps();
+                int nid[ 4 ], cleft[ 4 ], sindex[ 4 ], kn[ 4 ];
+                float fv[ 4 ], value[ 4 ];
+                for( size_t t = tstart; t < tend; t ++ ){
+                    for( int k = 0; k < 4; k ++ ) nid[ k ] = (int)( tree_ptr[ t ] + rid[ k ] );
+                    while( true ){
+                        for( int k = 0; k < 4; k ++ ){
+                            const FixedNode &n = fnodes[ nid[ k ] ];
+                            const size_t off = k * stride + ( n.sindex & kIndexMask );
+                            cleft[ k ] = n.cleft; sindex[ k ] = (int)n.sindex; value[ k ] = n.cond;
+                            fv[ k ] = block[ off ];
+                            if( kMissing ) kn[ k ] = known[ off ];
+                        }
+                        __m128i vsindex = _mm_loadu_si128( reinterpret_cast<const __m128i*>( sindex ) );
+                        __m128i split   = _mm_cmpeq_epi32( _mm_and_si128( vsindex, leaf_flag ), zero );
+                        if( _mm_movemask_epi8( split ) == 0 ) break;
+                        __m128i left  = _mm_castps_si128( _mm_cmplt_ps( _mm_loadu_ps( fv ), _mm_loadu_ps( value ) ) );
+                        if( kMissing ){
+                            __m128i vkn   = _mm_loadu_si128( reinterpret_cast<const __m128i*>( kn ) );
+                            __m128i dleft = _mm_srai_epi32( vsindex, 31 );
+                            left = _mm_or_si128( _mm_and_si128( vkn, left ), _mm_andnot_si128( vkn, dleft ) );
+                        }
+                        // right child is next to left child
+                        __m128i vcleft = _mm_loadu_si128( reinterpret_cast<const __m128i*>( cleft ) );
+                        __m128i next  = _mm_add_epi32( vcleft, _mm_add_epi32( one, left ) );
+                        __m128i vnid  = _mm_loadu_si128( reinterpret_cast<const __m128i*>( nid ) );
+                        vnid = _mm_or_si128( _mm_and_si128( split, next ), _mm_andnot_si128( split, vnid ) );
+                        _mm_storeu_si128( reinterpret_cast<__m128i*>( nid ), vnid );
+                    }
+                    // all lanes are at leaf, value holds the leaf values
+                    sum = _mm_add_ps( sum, _mm_loadu_ps( value ) );
+                }
+                float psum[ 4 ];
+                _mm_storeu_ps( psum, sum );
+                for( int k = 0; k < 4; k ++ ) out[ k ] += psum[ k ];
+            }
+            #endif
+        private:
+            /*! \brief arrays used by prediction, point to the vectors below or to mapped memory */
+            struct View{
+                const FixedNode *fnodes;
+                const uint64_t *tree_ptr;
+                const int *tree_depth;
+                const double *bound_min, *bound_max, *bound_abs;
+                size_t num_tree;
+            };
+            /*! \brief sections of serving format: nodes, tree_ptr, tree_depth, bound_min, bound_max, bound_abs and user head */
+            static const int kNumSection = 7;
+            /*! \brief header of serving format */
+            struct ServingHeader{
+                uint32_t magic, version;
+                uint32_t num_feature, reserved;
+                uint64_t num_tree, num_node;
+                /*! \brief number of extra bytes from user */
+                uint64_t head_size;
+                /*! \brief offset of each section from start of data */
+                uint64_t offset[ kNumSection ];
+            };
+            /*! \brief magic number of serving format */
+            static const uint32_t kServingMagic = 0x46424758;
+            template<typename T>
+            inline static const T *VecPtr( const std::vector<T> &v ){
+                return v.size() == 0 ? NULL : &v[0];
+            }
+            inline void RefreshView( void ){
+                view.fnodes = VecPtr( fnodes ); view.tree_ptr = VecPtr( tree_ptr ); view.tree_depth = VecPtr( tree_depth );
+                view.bound_min = VecPtr( bound_min ); view.bound_max = VecPtr( bound_max ); view.bound_abs = VecPtr( bound_abs );
+                view.num_tree = tree_ptr.size() - 1;
+            }
+            /*!
+             * \brief check the arrays of a mapped forest: tree_ptr is non-decreasing up to num_node, children of a split node
+             *        come after it in its own tree, a leaf goes to itself, split features are below num_feature,
+             *        and the depth of each tree is the one AddTree gives, so every walk stays in its tree
+             */
+            inline static bool CheckMapped( const View &v, uint64_t num_node, unsigned num_feature ){
+                if( v.tree_ptr[ 0 ] != 0 || v.tree_ptr[ v.num_tree ] != num_node ) return false;
+                std::vector<int> depth;
+                for( size_t t = 0; t < v.num_tree; t ++ ){
+                    const uint64_t begin = v.tree_ptr[ t ], end = v.tree_ptr[ t + 1 ];
+                    if( begin > end || end > num_node ) return false;
+                    depth.assign( static_cast<size_t>( end - begin ), 0 );
+                    int tdepth = 0;
+                    for( uint64_t nid = begin; nid < end; nid ++ ){
+                        const FixedNode &n = v.fnodes[ nid ];
+                        if( ( n.sindex & kLeafFlag ) != 0 ){
+                            if( ( n.sindex & kIndexMask ) != 0 || n.cleft != static_cast<int>( nid ) ) return false;
+                            continue;
+                        }
+                        if( ( n.sindex & kIndexMask ) >= num_feature ) return false;
+                        if( n.cleft < 0 || static_cast<uint64_t>( n.cleft ) <= nid || static_cast<uint64_t>( n.cleft ) + 1 >= end ) return false;
+                        const int d = depth[ nid - begin ] + 1;
+                        depth[ n.cleft - begin ] = depth[ n.cleft + 1 - begin ] = d;
+                        tdepth = std::max( tdepth, d );
+                    }
+                    if( v.tree_depth[ t ] != tdepth ) return false;
+                }
+                return true;
+            }
+            /*! \brief sizes in bytes of sections in serving format, the last one is the user head */
+            inline static void SectionSize( uint64_t num_tree, uint64_t num_node, uint64_t head_size, uint64_t size[ kNumSection ] ){
+                size[0] = num_node * sizeof(FixedNode); size[1] = ( num_tree + 1 ) * sizeof(uint64_t);
+                size[2] = num_tree * sizeof(int);
+                size[3] = size[4] = size[5] = ( num_tree + 1 ) * sizeof(double);
+                size[6] = head_size;
+            }
+        private:
+            /*! \brief nodes of all trees */
+            std::vector<FixedNode> fnodes;
+            /*! \brief nodes of tree i is in [tree_ptr[i], tree_ptr[i+1]) */
+            std::vector<uint64_t> tree_ptr;
+            /*! \brief depth of each tree */
+            std::vector<int> tree_depth;
+            /*! \brief prefix sums of the minimum, maximum and maximum absolute leaf value of trees, tree i adds entry i+1 */
+            std::vector<double> bound_min, bound_max, bound_abs;
+            /*! \brief maximum split index plus one */
+            unsigned num_feature;
+            /*! \brief whether avx2 kernel is used */
+            bool use_avx2;
+            /*! \brief whether view refers to memory given by LoadMapped */
+            bool mapped;
+            /*! \brief arrays used by prediction */
+            View view;
+        };
+    };
+};
+#endif
@@ -2,8 +2,10 @@
 #define _XGBOOST_GBMBASE_H_
 
 #include <cstring>
+#include <algorithm>
 #include "xgboost.h"
 #include "../utils/xgboost_config.h"
+#include "../utils/xgboost_omp.h"
 /*!
  * \file xgboost_gbmbase.h
  * \brief a base model class, 
@@ -17,6 +19,7 @@
  */
 namespace xgboost{
     namespace booster{
+        class CheckpointWriter;
         /*!
          * \brief a base model class, 
          *        that assembles the ensembles of booster together and provide single routines to do prediction buffer and update
@@ -43,8 +46,15 @@ namespace xgboost{
          *              this helps to speedup training, so consider assign buffer_index 
          *              for each training instances, if buffer_index = -1, the code
          *              recalculate things from scratch and will still works correctly
+         *
+         *  Compiled forest: when all boosters are trees, they are also compiled into a flat forest
+         *              after each DoBoost and LoadModel, Predict on sparse input and PredictBatch use it
+         *
+         *  Checkpoint: CheckpointWriter in xgboost_checkpoint.h saves the model incrementally in background,
+         *              use it instead of SaveModel when the prediction buffer is large
          */
         class GBMBaseModel{
+            friend class CheckpointWriter;
         public:
             /*! \brief model parameters */
             struct Param{
@@ -88,9 +98,14 @@ namespace xgboost{
                 }
             };
         public:
+            /*! \brief constructor */
+            GBMBaseModel( void ){
+                nthread = 0; profile = 0; sync = NULL;
+            }
             /*! \brief destructor */
             virtual ~GBMBaseModel( void ){
                 this->FreeSpace();
+                booster::FreeTrainSpace();
             }
             /*! 
              * \brief set parameters from outside 
@@ -104,6 +119,8 @@ namespace xgboost{
                 if( !strcmp( name, "silent") ){
                     cfg.PushBack( name, val );
                 }
+                if( !strcmp( name, "bst:nthread") ) nthread = atoi( val );
+                if( !strcmp( name, "profile") ) profile = atoi( val );
                 if( boosters.size() == 0 ) param.SetParam( name, val );
             }
             /*! 
@@ -112,7 +129,7 @@ namespace xgboost{
              */
             inline void LoadModel( utils::IStream &fi ){
                 if( boosters.size() != 0 ) this->FreeSpace();
-                utils::Assert( fi.Read( &param, sizeof(Param) ) != 0 );
+                utils::Assert( fi.Read( &param, sizeof(Param) ) == sizeof(Param) );
                 boosters.resize( param.num_boosters );
                 for( size_t i = 0; i < boosters.size(); i ++ ){
                     boosters[ i ] = booster::CreateBooster( param.booster_type );
@@ -121,15 +138,16 @@ namespace xgboost{
                 {// load info 
                     booster_info.resize( param.num_boosters );
                     if( param.num_boosters != 0 ){
-                        utils::Assert( fi.Read( &booster_info[0], sizeof(int)*param.num_boosters ) != 0 );
+                        utils::Assert( fi.Read( &booster_info[0], sizeof(int)*param.num_boosters ) == sizeof(int)*param.num_boosters );
                     }
                 }
                 if( param.num_pbuffer != 0 ){
                     pred_buffer.resize ( param.num_pbuffer );
                     pred_counter.resize( param.num_pbuffer );
-                    utils::Assert( fi.Read( &pred_buffer[0] , pred_buffer.size()*sizeof(float) ) != 0 );
-                    utils::Assert( fi.Read( &pred_counter[0], pred_counter.size()*sizeof(unsigned) ) != 0 );
+                    utils::Assert( fi.Read( &pred_buffer[0] , pred_buffer.size()*sizeof(float) ) == pred_buffer.size()*sizeof(float) );
+                    utils::Assert( fi.Read( &pred_counter[0], pred_counter.size()*sizeof(unsigned) ) == pred_counter.size()*sizeof(unsigned) );
                 }
+                this->SyncForest();
             }
             /*! 
              * \brief save model to stream
@@ -149,6 +167,17 @@ namespace xgboost{
                     fo.Write( &pred_counter[0], pred_counter.size()*sizeof(unsigned) );
                 }
             }
+            /*!
+             * \brief save the compiled forest in serving format, which has no training statistics or prediction buffer,
+             *        load it with ServingModel in xgboost_serving.h, only supported when all boosters are trees
+             * \param fo output stream
+             * \param head extra bytes saved with the forest, can be NULL
+             * \param head_size number of bytes of head
+             */
+            inline void SaveServing( utils::IStream &fo, const void *head = NULL, size_t head_size = 0 ) const{
+                utils::Assert( boosters.size() == 0 || this->UseForest(), "SaveServing: serving format needs all boosters to be trees" );
+                forest.SaveServing( fo, head, head_size );
+            }
             /*!
              * \brief initialize the current data storage for model, if the model is used first time, call this function
              */
@@ -158,6 +187,7 @@ namespace xgboost{
                 pred_counter.resize( param.num_pbuffer, 0 );
                 utils::Assert( param.num_boosters == 0 );
                 utils::Assert( boosters.size() == 0 );
+                forest.Clear();
             }
             /*!
              * \brief initialize solver before training, called before training
@@ -178,13 +208,63 @@ namespace xgboost{
              * \param feats features of each instance
              * \param root_index pre-partitioned root index of each instance, 
              *          root_index.size() can be 0 which indicates that no pre-partition involved
+             * \param buffer_offset buffer index of instance 0, instance i uses buffer index buffer_offset + i,
+             *          when given, buffered predictions of the instances are updated with the new booster during training,
+             *          so the next Predict of the instances does not need to go through it, default -1 means no buffer
              */
             inline void DoBoost( std::vector<float> &grad,
                                  std::vector<float> &hess,
                                  const booster::FMatrixS::Image &feats,
-                                 const std::vector<unsigned> &root_index ) {
+                                 const std::vector<unsigned> &root_index,
+                                 int buffer_offset = -1 ) {
                 booster::IBooster *bst = this->GetUpdateBooster();
-                bst->DoBoost( grad, hess, feats, root_index );
+                const size_t ndata = grad.size();
+                if( param.do_reboost == 0 && buffer_offset >= 0 && ndata != 0 ){
+                    utils::Assert( buffer_offset + ndata <= (size_t)param.num_pbuffer, "buffer index exceed num_pbuffer" );
+                    std::vector<float> pred( ndata, 0.0f );
+                    if( bst->DoBoostUpdatePred( grad, hess, feats, root_index, &pred[0] ) ){
+                        booster::ScopedTimer timer( profile != 0 ? &stats : NULL, booster::BoostStats::kPredUpdate );
+                        // only buffers that contain all the previous boosters can take the new one
+                        const unsigned nbst = static_cast<unsigned>( boosters.size() );
+                        for( size_t i = 0; i < ndata; i ++ ){
+                            if( pred_counter[ buffer_offset + i ] + 1 == nbst ){
+                                pred_buffer [ buffer_offset + i ] += pred[ i ];
+                                pred_counter[ buffer_offset + i ] = nbst;
+                            }
+                        }
+                    }
+                }else{
+                    bst->DoBoost( grad, hess, feats, root_index );
+                }
+                this->SyncForest();
+                if( profile != 0 ) stats.num_update += 1;
+            }
+            /*! \brief type of the boosters, set by parameter booster_type */
+            inline int BoosterType( void ) const{
+                return param.booster_type;
+            }
+            /*! \brief whether training is profiled, set by parameter profile */
+            inline bool Profiling( void ) const{
+                return profile != 0;
+            }
+            /*! \brief statistics of training since last ClearStats, only collected when profiling */
+            inline const booster::BoostStats &Stats( void ) const{
+                return stats;
+            }
+            /*! \brief clear the statistics of training */
+            inline void ClearStats( void ){
+                stats.Clear();
+            }
+            /*!
+             * \brief set synchronization engine for distributed training, the model does not own it,
+             *        all workers get the same boosters, see parameter dsplit of tree booster for how data is split:
+             *        row: each worker trains on its own shard of rows, the prediction buffers only hold the rows of the worker;
+             *        col: each worker holds all rows with its own features, prediction buffers of the training rows are right,
+             *        while other prediction needs all the features
+             * \param sync synchronization engine, NULL means training in a single process
+             */
+            inline void SetSync( sync::ISync *sync ){
+                this->sync = sync;
             }
             /*! 
              * \brief predict values for given sparse feature vector
@@ -205,8 +285,14 @@ namespace xgboost{
                     psum   = this->pred_buffer [ buffer_index ];
                 }
             
-                for( size_t i = istart; i < this->boosters.size(); i ++ ){
-                    psum += this->boosters[ i ]->Predict( feat, rid );
+                if( this->UseForest() ){
+                    const bool full = this->load_tmpfeat( feat );
+                    psum += forest.PredictRow( istart, &tmp_feat[0], &tmp_known[0], rid, full );
+                    this->clear_tmpfeat( feat );
+                }else{
+                    for( size_t i = istart; i < this->boosters.size(); i ++ ){
+                        psum += this->boosters[ i ]->Predict( feat, rid );
+                    }
                 }
                 
                 // updated the buffered results
@@ -216,6 +302,40 @@ namespace xgboost{
                 }
                 return psum;
             }
+            /*!
+             * \brief decide whether the prediction of a row is above threshold, with early exit:
+             *        boosters are evaluated in order, and the evaluation stops once the bounds of leaf values of the remaining trees
+             *        can not move the sum to the other side of threshold, bounds are only known when all boosters are trees
+             *   NOTE: in tree implementation, this is not threadsafe
+             * \param feat vector in sparse format
+             * \param threshold decision threshold of the sum of boosters
+             * \param bound_scale fraction of the bounds of remaining trees that is trusted, 1 makes the decision exact
+             *        up to float rounding, smaller values stop earlier and can give wrong decisions near threshold
+             * \param tree_limit only the first tree_limit boosters are used, which bounds the latency, 0 means all boosters
+             * \param rid root id of current instance, default = 0
+             * \param ntree output number of boosters evaluated, can be NULL
+             * \return whether the prediction is above threshold
+             */
+            inline bool PredictAbove( const booster::FMatrixS::Line &feat, float threshold, float bound_scale = 1.0f,
+                                      unsigned tree_limit = 0, unsigned rid = 0, unsigned *ntree = NULL ){
+                const size_t nbst = tree_limit == 0 ? boosters.size() : std::min( (size_t)tree_limit, boosters.size() );
+                float psum = 0.0f;
+                size_t nused = nbst;
+                bool above;
+                if( this->UseForest() ){
+                    const bool full = this->load_tmpfeat( feat );
+                    above = forest.PredictRowAbove( 0, nbst, &tmp_feat[0], &tmp_known[0], rid, full,
+                                                    threshold, bound_scale, psum, nused );
+                    this->clear_tmpfeat( feat );
+                }else{
+                    for( size_t i = 0; i < nbst; i ++ ){
+                        psum += this->boosters[ i ]->Predict( feat, rid );
+                    }
+                    above = psum > threshold;
+                }
+                if( ntree != NULL ) *ntree = static_cast<unsigned>( nused );
+                return above;
+            }
             /*! 
              * \brief predict values for given dense feature vector
              * \param feat feature vector in dense format
@@ -239,8 +359,22 @@ namespace xgboost{
                     psum   = this->pred_buffer [ buffer_index ];
                 }
             
-                for( size_t i = istart; i < this->boosters.size(); i ++ ){
-                    psum += this->boosters[ i ]->Predict( feat, funknown, rid );
+                if( this->UseForest() ){
+                    const unsigned nfeat = forest.NumFeature();
+                    utils::Assert( feat.size() >= nfeat && funknown.size() >= nfeat, "input data smaller than num feature" );
+                    this->init_tmpfeat();
+                    bool full = true;
+                    for( unsigned i = 0; i < nfeat; i ++ ){
+                        if( funknown[ i ] ){ full = false; continue; }
+                        tmp_known[ i ] = 1;
+                    }
+                    // trees that are only leaves read no feature
+                    psum += forest.PredictRow( istart, nfeat != 0 ? &feat[0] : &tmp_feat[0], &tmp_known[0], rid, full );
+                    std::fill( tmp_known.begin(), tmp_known.begin() + nfeat, 0 );
+                }else{
+                    for( size_t i = istart; i < this->boosters.size(); i ++ ){
+                        psum += this->boosters[ i ]->Predict( feat, funknown, rid );
+                    }
                 }
                 
                 // updated the buffered results
@@ -250,14 +384,188 @@ namespace xgboost{
                 }
                 return psum;
             }
+            /*! 
+             * \brief predict values for a batch of rows, equivalent to calling Predict for each row
+             *   NOTE: this function is threadsafe when buffer is not used, 
+             *         or when concurrent calls use disjoint ranges of the buffer,
+             *         paged rows are not threadsafe, they are predicted page by page
+             * \param feats features of the rows
+             * \param nrow number of rows, rows [0,nrow) of feats are predicted
+             * \param out output array of length nrow, prediction of row i is stored in out[i]
+             * \param buffer_offset buffer index of row 0, row i uses buffer index buffer_offset + i, 
+             *                      default -1 means no buffer assigned
+             * \param root_index root id of each row, root_index.size() can be 0 which means all rows use root 0
+             */
+            inline void PredictBatch( const booster::FMatrixS::Image &feats, size_t nrow, float *out, 
+                                      int buffer_offset = -1, 
+                                      const std::vector<unsigned> &root_index = std::vector<unsigned>() ){
+                if( nrow == 0 ) return;
+                if( feats.IsPaged() ){
+                    // predict page by page, the rows of a page are in memory
+                    const FMatrixS::IPagedRows &paged = *feats.Paged();
+                    std::vector<unsigned> rindex;
+                    for( size_t pid = 0; pid < paged.NumPage(); pid ++ ){
+                        size_t begin, end;
+                        const FMatrixS &page = paged.GetPage( pid, begin, end );
+                        if( begin >= nrow ) break;
+                        end = std::min( end, nrow );
+                        if( root_index.size() != 0 ) rindex.assign( root_index.begin() + begin, root_index.begin() + end );
+                        FMatrixS::Image img( page );
+                        this->PredictBatch( img, end - begin, out + begin, 
+                                            buffer_offset < 0 ? -1 : buffer_offset + (int)begin, rindex );
+                    }
+                    return;
+                }
+                const bool use_buffer = param.do_reboost == 0 && buffer_offset >= 0;
+                // start position of each row in the ensemble, usually the same for all rows
+                size_t istart = 0; bool same_start = true;
+                if( use_buffer ){
+                    utils::Assert( buffer_offset + nrow <= (size_t)param.num_pbuffer, "buffer index exceed num_pbuffer" );
+                    istart = this->pred_counter[ buffer_offset ];
+                    for( size_t i = 0; i < nrow; i ++ ){
+                        out[ i ] = this->pred_buffer[ buffer_offset + i ];
+                        if( this->pred_counter[ buffer_offset + i ] != istart ) same_start = false;
+                        istart = std::min( istart, (size_t)this->pred_counter[ buffer_offset + i ] );
+                    }
+                }else{
+                    std::fill( out, out + nrow, 0.0f );
+                }
+                // all rows are up to date in buffer
+                if( use_buffer && same_start && istart == this->boosters.size() ) return;
+                if( this->UseForest() ){
+                    for( size_t i = 0; i < nrow; i ++ ) this->check_feature( feats[ i ] );
+                    forest.PredictBatch( feats, nrow, out, use_buffer ? &pred_counter[ buffer_offset ] : NULL, root_index, nthread );
+                }else if( same_start ){
+                    for( size_t j = istart; j < this->boosters.size(); j ++ ){
+                        this->boosters[ j ]->PredictBatch( feats, nrow, root_index, out );
+                    }
+                }else{
+                    // rows have different progress in buffer, only add boosters after their own start
+                    std::vector<float> tmp( nrow );
+                    for( size_t j = istart; j < this->boosters.size(); j ++ ){
+                        std::fill( tmp.begin(), tmp.end(), 0.0f );
+                        this->boosters[ j ]->PredictBatch( feats, nrow, root_index, &tmp[0] );
+                        for( size_t i = 0; i < nrow; i ++ ){
+                            if( this->pred_counter[ buffer_offset + i ] <= j ) out[ i ] += tmp[ i ];
+                        }
+                    }
+                }
+                // updated the buffered results
+                if( use_buffer ){
+                    for( size_t i = 0; i < nrow; i ++ ){
+                        this->pred_counter[ buffer_offset + i ] = static_cast<unsigned>( boosters.size() );
+                        this->pred_buffer [ buffer_offset + i ] = out[ i ];
+                    }
+                }
+            }
+            /*!
+             * \brief predict values for a batch of rows in distributed training with bst:dsplit=col, a collective call,
+             *        each worker holds all the rows with its own features, see IBooster::PredictBatchDistCol,
+             *        rows in memory are assumed, see PredictBatch for the parameters
+             */
+            inline void PredictBatchDistCol( const booster::FMatrixS::Image &feats, size_t nrow, float *out,
+                                             int buffer_offset = -1,
+                                             const std::vector<unsigned> &root_index = std::vector<unsigned>() ){
+                if( nrow == 0 ) return;
+                const bool use_buffer = param.do_reboost == 0 && buffer_offset >= 0;
+                // boosters before the start of a row are in its buffer
+                size_t istart = 0;
+                if( use_buffer ){
+                    utils::Assert( buffer_offset + nrow <= (size_t)param.num_pbuffer, "buffer index exceed num_pbuffer" );
+                    istart = this->boosters.size();
+                    for( size_t i = 0; i < nrow; i ++ ){
+                        out[ i ] = this->pred_buffer[ buffer_offset + i ];
+                        istart = std::min( istart, (size_t)this->pred_counter[ buffer_offset + i ] );
+                    }
+                }else{
+                    std::fill( out, out + nrow, 0.0f );
+                }
+                std::vector<float> tmp( nrow );
+                for( size_t j = istart; j < this->boosters.size(); j ++ ){
+                    std::fill( tmp.begin(), tmp.end(), 0.0f );
+                    this->boosters[ j ]->PredictBatchDistCol( feats, nrow, root_index, &tmp[0] );
+                    for( size_t i = 0; i < nrow; i ++ ){
+                        if( !use_buffer || this->pred_counter[ buffer_offset + i ] <= j ) out[ i ] += tmp[ i ];
+                    }
+                }
+                if( use_buffer ){
+                    for( size_t i = 0; i < nrow; i ++ ){
+                        this->pred_counter[ buffer_offset + i ] = static_cast<unsigned>( boosters.size() );
+                        this->pred_buffer [ buffer_offset + i ] = out[ i ];
+                    }
+                }
+            }
             //-----------non public fields afterwards-------------
         protected:
+            /*! \brief whether compiled forest is in sync with boosters and can be used for prediction */
+            inline bool UseForest( void ) const{
+                return boosters.size() != 0 && forest.NumTree() == boosters.size();
+            }
+            /*! 
+             * \brief compile the boosters that are not yet in the forest,
+             *        the forest is dropped when some booster can not be compiled, or boosters are updated in place
+             */
+            inline void SyncForest( void ){
+                if( param.do_reboost != 0 || forest.NumTree() > boosters.size() ){
+                    forest.Clear();
+                    if( param.do_reboost != 0 ) return;
+                }
+                for( size_t i = forest.NumTree(); i < boosters.size(); i ++ ){
+                    if( !boosters[ i ]->AppendCompiled( forest ) ){
+                        forest.Clear(); return;
+                    }
+                }
+            }
+            /*! \brief prepare dense scratch space for single row prediction using forest */
+            inline void init_tmpfeat( void ){
+                const size_t n = forest.BlockStride();
+                if( tmp_feat.size() != n ){
+                    tmp_feat.resize( n );
+                    tmp_known.resize( n );
+                    std::fill( tmp_known.begin(), tmp_known.end(), 0 );
+                }
+            }
+            /*! 
+             * \brief scatter a sparse row into the dense scratch space of forest, undone by clear_tmpfeat
+             * \return whether the row has all the features of forest, then the missing value test can be skipped
+             */
+            inline bool load_tmpfeat( const booster::FMatrixS::Line &feat ){
+                this->check_feature( feat );
+                this->init_tmpfeat();
+                const unsigned nfeat = forest.NumFeature();
+                // number of distinct features present
+                unsigned nknown = 0;
+                for( unsigned i = 0; i < feat.len; i ++ ){
+                    if( feat.findex[i] >= nfeat ) continue;
+                    if( tmp_known[ feat.findex[i] ] == 0 ) nknown ++;
+                    tmp_known[ feat.findex[i] ] = 1;
+                    tmp_feat [ feat.findex[i] ] = feat.fvalue[i];
+                }
+                return nknown == nfeat;
+            }
+            /*! 
+             * \brief features of the model are below num_feature, the forest skips the ones it does not split on,
+             *        so the bound the boosters check is kept on the prediction paths of the model
+             */
+            inline void check_feature( const booster::FMatrixS::Line &feat ) const{
+                for( unsigned i = 0; i < feat.len; i ++ ){
+                    utils::Assert( feat.findex[i] < (unsigned)param.num_feature, "input feature execeed bound" );
+                }
+            }
+            /*! \brief reset the indicators set by load_tmpfeat */
+            inline void clear_tmpfeat( const booster::FMatrixS::Line &feat ){
+                const unsigned nfeat = forest.NumFeature();
+                for( unsigned i = 0; i < feat.len; i ++ ){
+                    if( feat.findex[i] < nfeat ) tmp_known[ feat.findex[i] ] = 0;
+                }
+            }
             /*! \brief free space of the model */
             inline void FreeSpace( void ){
                 for( size_t i = 0; i < boosters.size(); i ++ ){
                     delete boosters[i];
                 }
                 boosters.clear(); booster_info.clear(); param.num_boosters = 0; 
+                forest.Clear();
             }
             /*! \brief configure a booster */
             inline void ConfigBooster( booster::IBooster *bst ){
@@ -265,6 +573,8 @@ namespace xgboost{
                 while( cfg.Next() ){
                     bst->SetParam( cfg.name(), cfg.val() );
                 }
+                bst->SetStats( profile != 0 ? &stats : NULL );
+                bst->SetSync( sync );
             }
             /*! 
              * \brief get a booster to update 
@@ -295,6 +605,20 @@ namespace xgboost{
             std::vector<unsigned> pred_counter;
             /*! \brief configurations saved for each booster */
             utils::ConfigSaver cfg;
+            /*! \brief number of threads used in batch prediction, 0 means default of openmp */
+            int nthread;
+            /*! \brief whether to collect statistics of training */
+            int profile;
+            /*! \brief statistics of training */
+            booster::BoostStats stats;
+            /*! \brief synchronization engine of distributed training, NULL if not distributed */
+            sync::ISync *sync;
+            /*! \brief compiled form of boosters, used in prediction when all boosters are trees */
+            CompiledForest forest;
+            /*! \brief temp dense feature used in single row prediction */
+            std::vector<float> tmp_feat;
+            /*! \brief temp indicator of whether feature is present in single row prediction */
+            std::vector<int> tmp_known;
         };
     };
 };
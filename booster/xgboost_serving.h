@@ -0,0 +1,162 @@
+#ifndef _XGBOOST_SERVING_H_
+#define _XGBOOST_SERVING_H_
+/*!
+ * \file xgboost_serving.h
+ * \brief model for serving: compiled forest in serving format mapped read only from file,
+ *        loading takes constant time, and processes that load the same file share its pages,
+ *        see GBMBaseModel::SaveServing for the export
+ */
+#include <vector>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "xgboost_data.h"
+#include "xgboost_forest.h"
+#include "../utils/xgboost_utils.h"
+
+namespace xgboost{
+    namespace booster{
+        /*! \brief sum of trees in serving format, the output is the sum of leaf values without any bias */
+        class ServingModel{
+        public:
+            /*! \brief constructor */
+            ServingModel( void ){
+                map_addr = NULL; map_size = 0;
+                head = NULL; head_size = 0;
+            }
+            /*! \brief destructor */
+            ~ServingModel( void ){
+                this->Close();
+            }
+            /*!
+             * \brief map a model file in serving format
+             * \param fname name of the file
+             * \return whether the file is a valid model in serving format
+             */
+            inline bool Load( const char *fname ){
+                this->Close();
+                int fd = open( fname, O_RDONLY );
+                if( fd < 0 ) return false;
+                struct stat st;
+                if( fstat( fd, &st ) != 0 || st.st_size == 0 ){
+                    close( fd ); return false;
+                }
+                void *addr = mmap( NULL, static_cast<size_t>( st.st_size ), PROT_READ, MAP_SHARED, fd, 0 );
+                close( fd );
+                if( addr == MAP_FAILED ) return false;
+                map_addr = addr; map_size = static_cast<size_t>( st.st_size );
+                if( !forest.LoadMapped( map_addr, map_size, &head, &head_size ) ){
+                    this->Close(); return false;
+                }
+                return true;
+            }
+            /*!
+             * \brief use a model in serving format from memory, the memory is not copied
+             * \param data start of model, aligned to 8 bytes, must be kept until the model is closed
+             * \param size number of bytes of data
+             * \return whether data is a valid model in serving format
+             */
+            inline bool LoadMemory( const void *data, size_t size ){
+                this->Close();
+                return forest.LoadMapped( data, size, &head, &head_size );
+            }
+            /*! \brief release the model */
+            inline void Close( void ){
+                forest.Clear();
+                head = NULL; head_size = 0;
+                tmp_feat.clear(); tmp_known.clear();
+                if( map_addr != NULL ){
+                    munmap( map_addr, map_size );
+                    map_addr = NULL; map_size = 0;
+                }
+            }
+            /*! \brief the forest */
+            inline const CompiledForest &Forest( void ) const{
+                return forest;
+            }
+            /*! \brief extra bytes saved with the model */
+            inline const void *Head( void ) const{
+                return head;
+            }
+            /*! \brief number of extra bytes saved with the model */
+            inline size_t HeadSize( void ) const{
+                return head_size;
+            }
+            /*!
+             * \brief predict a sparse row
+             *   NOTE: this is not threadsafe, use PredictBatch in threads
+             * \param feat features of the row
+             * \param rid root id of the row
+             * \return sum of trees
+             */
+            inline float Predict( const FMatrixS::Line &feat, unsigned rid = 0 ){
+                const size_t n = forest.BlockStride();
+                if( tmp_feat.size() != n ){
+                    tmp_feat.resize( n ); tmp_known.assign( n, 0 );
+                }
+                const unsigned nfeat = forest.NumFeature();
+                unsigned nknown = 0;
+                for( unsigned i = 0; i < feat.len; i ++ ){
+                    if( feat.findex[i] >= nfeat ) continue;
+                    if( tmp_known[ feat.findex[i] ] == 0 ) nknown ++;
+                    tmp_known[ feat.findex[i] ] = 1;
+                    tmp_feat [ feat.findex[i] ] = feat.fvalue[i];
+                }
+                const float psum = forest.PredictRow( 0, &tmp_feat[0], &tmp_known[0], rid, nknown == nfeat );
+                for( unsigned i = 0; i < feat.len; i ++ ){
+                    if( feat.findex[i] < nfeat ) tmp_known[ feat.findex[i] ] = 0;
+                }
+                return psum;
+            }
+            /*!
+             * \brief predict rows in parallel, this is threadsafe for rows in memory,
+             *        paged rows are not threadsafe, they are predicted page by page
+             * \param feats features of the rows
+             * \param nrow number of rows, rows [0,nrow) of feats are predicted
+             * \param out output array of length nrow
+             * \param root_index root id of each row, size 0 means all rows use root 0
+             * \param nthread number of threads, 0 means default of openmp
+             * \param scratch scratch space kept by the caller to predict in the calling thread, see CompiledForest::PredictBatch
+             */
+            inline void PredictBatch( const FMatrixS::Image &feats, size_t nrow, float *out,
+                                      const std::vector<unsigned> &root_index = std::vector<unsigned>(), int nthread = 0,
+                                      CompiledForest::BlockScratch *scratch = NULL ) const{
+                if( feats.IsPaged() ){
+                    const FMatrixS::IPagedRows &paged = *feats.Paged();
+                    std::vector<unsigned> rindex;
+                    for( size_t pid = 0; pid < paged.NumPage(); pid ++ ){
+                        size_t begin, end;
+                        const FMatrixS &page = paged.GetPage( pid, begin, end );
+                        if( begin >= nrow ) break;
+                        end = std::min( end, nrow );
+                        if( root_index.size() != 0 ) rindex.assign( root_index.begin() + begin, root_index.begin() + end );
+                        FMatrixS::Image img( page );
+                        this->PredictBatch( img, end - begin, out + begin, rindex, nthread, scratch );
+                    }
+                    return;
+                }
+                std::fill( out, out + nrow, 0.0f );
+                forest.PredictBatch( feats, nrow, out, NULL, root_index, nthread, scratch );
+            }
+        private:
+            // the mapping is owned, no copy
+            ServingModel( const ServingModel &src );
+            ServingModel &operator=( const ServingModel &src );
+        private:
+            /*! \brief mapped file, NULL if not mapped */
+            void *map_addr;
+            size_t map_size;
+            /*! \brief extra bytes saved with the model */
+            const void *head;
+            size_t head_size;
+            /*! \brief forest referring to mapped memory */
+            CompiledForest forest;
+            /*! \brief dense scratch space of Predict */
+            std::vector<float> tmp_feat;
+            std::vector<int> tmp_known;
+        };
+    };
+};
+#endif
@@ -0,0 +1,132 @@
+#ifndef _XGBOOST_STATS_H_
+#define _XGBOOST_STATS_H_
+/*!
+ * \file xgboost_stats.h
+ * \brief statistics of booster training: wall clock time of each phase, and the work done at each tree depth,
+ *        collected only when profiling is enabled, see parameter profile of GBMBaseModel
+ */
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "../utils/xgboost_timer.h"
+
+namespace xgboost{
+    namespace booster{
+        /*! \brief statistics of training, accumulated over the boosters updated since last Clear */
+        struct BoostStats{
+            /*! \brief phases of training */
+            enum Phase{
+                /*! \brief build columns of a node from its rows */
+                kColBuild = 0,
+                /*! \brief sort the columns of a node */
+                kSort,
+                /*! \brief enumerate split points, includes collecting node columns from pre-sorted index */
+                kEnumSplit,
+                /*! \brief partition rows of a node into its childs */
+                kPartition,
+                /*! \brief make leaf and try pruning */
+                kMakeLeaf,
+                /*! \brief update predictions of training rows with the new booster */
+                kPredUpdate,
+                /*! \brief histogram mode: quantile sketch and bin codes, once per tree */
+                kHistInit,
+                /*! \brief histogram mode: build histograms of nodes */
+                kHistBuild,
+                /*! \brief linear booster: coordinate descent */
+                kLinearUpdate,
+                /*! \brief distributed training: communication between workers, also counted in the enclosing phase */
+                kSync,
+                kNumPhase
+            };
+            /*! \brief seconds spent in each phase */
+            double time[ kNumPhase ];
+            /*! \brief number of times each phase is entered */
+            size_t count[ kNumPhase ];
+            /*! \brief number of boosters updated */
+            size_t num_update;
+            /*! \brief number of nodes expanded at each depth */
+            std::vector<size_t> depth_node;
+            /*! \brief number of rows in expanded nodes at each depth */
+            std::vector<size_t> depth_row;
+            /*! \brief number of features scanned by expanded nodes at each depth */
+            std::vector<size_t> depth_feat;
+            /*! \brief constructor */
+            BoostStats( void ){
+                this->Clear();
+            }
+            /*! \brief clear the statistics */
+            inline void Clear( void ){
+                memset( time, 0, sizeof(time) );
+                memset( count, 0, sizeof(count) );
+                num_update = 0;
+                depth_node.clear(); depth_row.clear(); depth_feat.clear();
+            }
+            /*! \brief record a node at depth with nrow rows */
+            inline void AddNode( int depth, size_t nrow ){
+                this->Reserve( depth );
+                depth_node[ depth ] += 1; depth_row[ depth ] += nrow;
+            }
+            /*! \brief record nfeat features scanned by a node at depth */
+            inline void AddFeat( int depth, size_t nfeat ){
+                this->Reserve( depth );
+                depth_feat[ depth ] += nfeat;
+            }
+            /*! \brief name of phase */
+            inline static const char *PhaseName( int phase ){
+                static const char *names[ kNumPhase ] = {
+                    "col_build", "sort", "enum_split", "partition", "make_leaf",
+                    "pred_update", "hist_init", "hist_build", "linear_update", "sync"
+                };
+                return names[ phase ];
+            }
+            /*!
+             * \brief print the statistics, phases that are not entered are skipped
+             * \param fo output stream
+             */
+            inline void Print( FILE *fo ) const{
+                fprintf( fo, "profile of %lu booster updates\n", (unsigned long)num_update );
+                for( int i = 0; i < kNumPhase; i ++ ){
+                    if( count[ i ] == 0 ) continue;
+                    fprintf( fo, "  phase %-14s %10.6f sec %10lu calls\n", PhaseName( i ), time[ i ], (unsigned long)count[ i ] );
+                }
+                for( size_t d = 0; d < depth_node.size(); d ++ ){
+                    fprintf( fo, "  depth %-3lu %10lu nodes %12lu rows %12lu features\n", (unsigned long)d,
+                             (unsigned long)depth_node[ d ], (unsigned long)depth_row[ d ], (unsigned long)depth_feat[ d ] );
+                }
+            }
+        private:
+            inline void Reserve( int depth ){
+                if( depth_node.size() <= (size_t)depth ){
+                    depth_node.resize( depth + 1, 0 ); depth_row.resize( depth + 1, 0 ); depth_feat.resize( depth + 1, 0 );
+                }
+            }
+        };
+        /*! \brief timer that adds the time of its scope to a phase, does nothing when stats is NULL */
+        class ScopedTimer{
+        public:
+            /*!
+             * \brief start timing
+             * \param stats statistics to add to, can be NULL
+             * \param phase the phase timed
+             */
+            ScopedTimer( BoostStats *stats, int phase ):stats( stats ), phase( phase ), start( 0.0 ){
+                if( stats != NULL ) start = utils::GetTime();
+            }
+            ~ScopedTimer( void ){
+                this->Stop();
+            }
+            /*! \brief stop timing before the end of scope */
+            inline void Stop( void ){
+                if( stats == NULL ) return;
+                stats->time[ phase ] += utils::GetTime() - start;
+                stats->count[ phase ] += 1;
+                stats = NULL;
+            }
+        private:
+            BoostStats *stats;
+            int phase;
+            double start;
+        };
+    };
+};
+#endif
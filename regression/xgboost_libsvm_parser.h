@@ -0,0 +1,280 @@
+#ifndef _XGBOOST_LIBSVM_PARSER_H_
+#define _XGBOOST_LIBSVM_PARSER_H_
+/*!
+ * \file xgboost_libsvm_parser.h
+ * \brief parallel parser of text data in libsvm format, used by DMatrix::LoadText
+ *     The text is a sequence of whitespace separated tokens, a token index:value is a feature,
+ *     any other token is the label that starts a new instance, features before the first label are ignored.
+ *     The file is read in large blocks cut at line boundaries, each block is split into chunks
+ *     that are parsed by different threads with a hand-written tokenizer, then appended to the matrix.
+ *     When a paged matrix is given, finished instances are moved to pages after each block, so memory is bounded.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "../booster/xgboost_data.h"
+#include "../booster/xgboost_data_paged.h"
+#include "../utils/xgboost_utils.h"
+#include "../utils/xgboost_omp.h"
+
+namespace xgboost{
+    namespace regression{
+        /*! \brief parser of libsvm format text */
+        class LibSVMParser{
+        public:
+            /*!
+             * \brief constructor
+             * \param data matrix to store features
+             * \param labels vector to store labels
+             * \param paged if not NULL, features are added to paged matrix, which must be in writing state,
+             *        data only keeps the instance that is not finished
+             */
+            LibSVMParser( booster::FMatrixS &data, std::vector<float> &labels, booster::FMatrixPaged *paged = NULL )
+                :data( data ), labels( labels ), paged( paged ){
+                block_size = 64 << 20;
+            }
+            /*!
+             * \brief load all content of a file, previous content of data and labels is cleared
+             * \param fi input file
+             */
+            inline void Load( FILE *fi ){
+                data.Clear(); labels.clear();
+                std::vector<char> buf;
+                // bytes of an unfinished line kept from last block
+                size_t nleft = 0;
+                while( true ){
+                    // one extra byte to terminate the text at end of file
+                    buf.resize( nleft + block_size + 1 );
+                    const size_t nread = fread( &buf[ nleft ], 1, block_size, fi );
+                    const size_t n = nleft + nread;
+                    const bool eof = nread < block_size;
+                    buf[ n ] = '\0';
+                    const size_t end = eof ? n : FindBoundary( &buf[0], &buf[0] + n ) - &buf[0];
+                    if( end == 0 && !eof ){
+                        // no whitespace in the whole buffer, keep reading
+                        nleft = n; continue;
+                    }
+                    this->ParseBlock( &buf[0], &buf[0] + end );
+                    if( paged != NULL ) this->MoveToPaged();
+                    if( eof ) break;
+                    memmove( &buf[0], &buf[ end ], n - end );
+                    nleft = n - end;
+                }
+                // close the last instance
+                if( labels.size() != 0 ) data.row_ptr.push_back( data.findex.size() );
+                if( paged != NULL ) this->MoveToPaged();
+            }
+        private:
+            /*! \brief instances parsed from a chunk of text */
+            struct Piece{
+                /*! \brief feature index of all features in the chunk */
+                std::vector<booster::bst_uint>  findex;
+                /*! \brief feature value of all features in the chunk */
+                std::vector<booster::bst_float> fvalue;
+                /*! \brief label of each instance in the chunk */
+                std::vector<float> labels;
+                /*! \brief number of features in the chunk before each label */
+                std::vector<size_t> label_pos;
+                /*! \brief clear the piece */
+                inline void Clear( void ){
+                    findex.clear(); fvalue.clear(); labels.clear(); label_pos.clear();
+                }
+            };
+        public:
+            // whether c is whitespace, same as isspace in C locale
+            inline static bool IsSpace( char c ){
+                return c == ' ' || ( c >= '\t' && c <= '\r' );
+            }
+            inline static bool IsDigit( char c ){
+                return c >= '0' && c <= '9';
+            }
+        private:
+            // position right after the last newline in [begin,end), or after last whitespace if there is no newline,
+            // begin if there is no whitespace at all
+            inline static const char *FindBoundary( const char *begin, const char *end ){
+                for( const char *p = end; p != begin; -- p ){
+                    if( p[-1] == '\n' ) return p;
+                }
+                for( const char *p = end; p != begin; -- p ){
+                    if( IsSpace( p[-1] ) ) return p;
+                }
+                return begin;
+            }
+        public:
+            /*!
+             * \brief parse unsigned integer occupying whole [begin,end), same value as scanf %u
+             * \return whether parsing is success
+             */
+            inline static bool ParseUInt( const char *begin, const char *end, unsigned &out ){
+                if( begin == end ) return false;
+                if( !IsDigit( *begin ) ){
+                    // signed input, rare, follow the library
+                    char *endp;
+                    out = static_cast<unsigned>( strtoul( begin, &endp, 10 ) );
+                    return endp == end;
+                }
+                unsigned v = 0;
+                for( const char *p = begin; p != end; ++ p ){
+                    if( !IsDigit( *p ) ) return false;
+                    v = v * 10 + ( *p - '0' );
+                }
+                out = v;
+                return true;
+            }
+            /*!
+             * \brief parse float from the prefix of [begin,end), same as scanf %f, end must be followed by whitespace or '\0'.
+             *    plain decimals whose digits fit in float mantissa and small exponents are computed exactly with
+             *    one float operation, which gives the correctly rounded result, other input falls back to strtof
+             * \return whether parsing is success
+             */
+            inline static bool ParseFloat( const char *begin, const char *end, float &out ){
+                static const float kPow10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+                // strtof would skip the whitespace after an empty token
+                if( begin == end ) return false;
+                const char *p = begin;
+                bool neg = false;
+                if( p != end && ( *p == '-' || *p == '+' ) ){
+                    neg = *p == '-'; ++ p;
+                }
+                unsigned long long m = 0;
+                int ndigit = 0, nsig = 0, e10 = 0;
+                for( ; p != end && IsDigit( *p ); ++ p, ++ ndigit ){
+                    if( nsig != 0 || *p != '0' ){
+                        m = m * 10 + ( *p - '0' ); ++ nsig;
+                    }
+                }
+                if( p != end && *p == '.' ){
+                    for( ++ p; p != end && IsDigit( *p ); ++ p, ++ ndigit ){
+                        if( nsig != 0 || *p != '0' ){
+                            m = m * 10 + ( *p - '0' ); ++ nsig;
+                        }
+                        -- e10;
+                    }
+                }
+                if( ndigit != 0 && p != end && ( *p == 'e' || *p == 'E' ) ){
+                    const char *q = p + 1;
+                    bool eneg = false;
+                    if( q != end && ( *q == '-' || *q == '+' ) ){
+                        eneg = *q == '-'; ++ q;
+                    }
+                    if( q != end && IsDigit( *q ) ){
+                        int ev = 0;
+                        for( ; q != end && IsDigit( *q ) && ev < 10000; ++ q ){
+                            ev = ev * 10 + ( *q - '0' );
+                        }
+                        e10 += eneg ? -ev : ev;
+                        p = q;
+                    }
+                }
+                if( ndigit != 0 && p == end && nsig <= 19 ){
+                    while( m > ( 1ULL << 24 ) && m % 10 == 0 ){
+                        m /= 10; ++ e10;
+                    }
+                    if( m <= ( 1ULL << 24 ) && ( m == 0 || ( e10 >= -10 && e10 <= 10 ) ) ){
+                        float v = static_cast<float>( m );
+                        if( m != 0 ){
+                            if( e10 < 0 ) v /= kPow10[ -e10 ];
+                            else v *= kPow10[ e10 ];
+                        }
+                        out = neg ? -v : v;
+                        return true;
+                    }
+                }
+                char *endp;
+                out = strtof( begin, &endp );
+                return endp != begin;
+            }
+        private:
+            /*! \brief parse a chunk of text into piece */
+            inline static void ParseChunk( const char *begin, const char *end, Piece &piece ){
+                piece.Clear();
+                const char *p = begin;
+                while( true ){
+                    while( p != end && IsSpace( *p ) ) ++ p;
+                    if( p == end ) break;
+                    const char *q = p, *colon = NULL;
+                    for( ; q != end && !IsSpace( *q ); ++ q ){
+                        if( *q == ':' && colon == NULL ) colon = q;
+                    }
+                    unsigned index; float value;
+                    if( colon != NULL && ParseUInt( p, colon, index ) && ParseFloat( colon + 1, q, value ) ){
+                        piece.findex.push_back( index );
+                        piece.fvalue.push_back( value );
+                    }else{
+                        utils::Assert( ParseFloat( p, q, value ), "invalid format" );
+                        piece.labels.push_back( value );
+                        piece.label_pos.push_back( piece.findex.size() );
+                    }
+                    p = q;
+                }
+            }
+            /*! \brief parse a block of text that ends at a line boundary, and append the result */
+            inline void ParseBlock( const char *begin, const char *end ){
+                const int nthread = omp_get_max_threads();
+                pieces.resize( nthread );
+                std::vector<const char*> bound( nthread + 1 );
+                bound[ 0 ] = begin; bound[ nthread ] = end;
+                for( int i = 1; i < nthread; i ++ ){
+                    const char *p = begin + ( end - begin ) / nthread * i;
+                    if( p < bound[ i - 1 ] ) p = bound[ i - 1 ];
+                    while( p != end && *p != '\n' ) ++ p;
+                    bound[ i ] = p == end ? end : p + 1;
+                }
+                #pragma omp parallel for schedule( static, 1 )
+                for( int i = 0; i < nthread; i ++ ){
+                    ParseChunk( bound[ i ], bound[ i + 1 ], pieces[ i ] );
+                }
+                // features before the first label of the text are dropped, the rest are appended in order
+                std::vector<size_t> skip( nthread, 0 ), offset( nthread + 1, data.findex.size() );
+                bool has_label = labels.size() != 0;
+                for( int i = 0; i < nthread; i ++ ){
+                    const Piece &pc = pieces[ i ];
+                    if( !has_label ){
+                        skip[ i ] = pc.labels.size() != 0 ? pc.label_pos[ 0 ] : pc.findex.size();
+                    }
+                    for( size_t j = 0; j < pc.labels.size(); j ++ ){
+                        // a label closes the previous instance
+                        if( has_label ) data.row_ptr.push_back( offset[ i ] + pc.label_pos[ j ] - skip[ i ] );
+                        labels.push_back( pc.labels[ j ] );
+                        has_label = true;
+                    }
+                    offset[ i + 1 ] = offset[ i ] + pc.findex.size() - skip[ i ];
+                }
+                data.findex.resize( offset[ nthread ] );
+                data.fvalue.resize( offset[ nthread ] );
+                #pragma omp parallel for schedule( static, 1 )
+                for( int i = 0; i < nthread; i ++ ){
+                    const Piece &pc = pieces[ i ];
+                    const size_t n = pc.findex.size() - skip[ i ];
+                    if( n == 0 ) continue;
+                    memcpy( &data.findex[ offset[ i ] ], &pc.findex[ skip[ i ] ], n * sizeof(booster::bst_uint) );
+                    memcpy( &data.fvalue[ offset[ i ] ], &pc.fvalue[ skip[ i ] ], n * sizeof(booster::bst_float) );
+                }
+            }
+            /*! \brief move finished instances to paged matrix, keep features of the unfinished one */
+            inline void MoveToPaged( void ){
+                const size_t nrow = data.NumRow();
+                for( size_t i = 0; i < nrow; i ++ ){
+                    paged->AddRow( data[ i ] );
+                }
+                const size_t start = data.row_ptr.back();
+                data.findex.erase( data.findex.begin(), data.findex.begin() + start );
+                data.fvalue.erase( data.fvalue.begin(), data.fvalue.begin() + start );
+                data.row_ptr.resize( 1 );
+            }
+        private:
+            /*! \brief size of each block read from file */
+            size_t block_size;
+            /*! \brief target matrix */
+            booster::FMatrixS &data;
+            /*! \brief target labels */
+            std::vector<float> &labels;
+            /*! \brief paged matrix to move finished instances into, can be NULL */
+            booster::FMatrixPaged *paged;
+            /*! \brief parse result of each thread, kept to reuse memory across blocks */
+            std::vector<Piece> pieces;
+        };
+    };
+};
+#endif
@@ -7,7 +7,10 @@
 */
 #include <cmath>
 #include "xgboost_regdata.h"
+#include "xgboost_reg_loss.h"
 #include "../booster/xgboost_gbmbase.h"
+#include "../booster/xgboost_checkpoint.h"
+#include "xgboost_reg_serving.h"
 #include "../utils/xgboost_utils.h"
 #include "../utils/xgboost_stream.h"
 
@@ -19,6 +22,9 @@ namespace xgboost{
 
 			RegBoostLearner(bool silent = false){
 				this->silent = silent;
+				this->sync = NULL;
+				this->eval_period = 1;
+				this->dsplit_col = false;
 			}
 
 			/*! 
@@ -27,10 +33,13 @@ namespace xgboost{
 			* \param evals array of evaluating data
 			* \param evname name of evaluation data, used print statistics
 			*/
-			RegBoostLearner( const DMatrix *train,
+			RegBoostLearner( DMatrix *train,
 				std::vector<const DMatrix *> evals,
 				std::vector<std::string> evname, bool silent = false ){
 					this->silent = silent;
+					this->sync = NULL;
+					this->eval_period = 1;
+					this->dsplit_col = false;
 					SetData(train,evals,evname);
 			}
 
@@ -40,7 +49,7 @@ namespace xgboost{
 			* \param evals array of evaluating data
 			* \param evname name of evaluation data, used print statistics
 			*/
-			inline void SetData(const DMatrix *train,
+			inline void SetData(DMatrix *train,
 				std::vector<const DMatrix *> evals,
 				std::vector<std::string> evname){
 					this->train_ = train;
@@ -52,7 +61,7 @@ namespace xgboost{
 						buffer_size += (*evals[i]).size();
 					}
 					char str[25];
-					itoa(buffer_size,str,10);
+					sprintf(str,"%d",buffer_size);
 					base_model.SetParam("num_pbuffer",str);
 			}
 
@@ -62,16 +71,36 @@ namespace xgboost{
 			* \param val  value of the parameter
 			*/
 			inline void SetParam( const char *name, const char *val ){
+				if( !strcmp( "eval_period", name ) ) eval_period = atoi( val );
+				if( !strcmp( "bst:dsplit", name ) ) dsplit_col = !strcmp( val, "col" );
 				mparam.SetParam( name, val );
 				base_model.SetParam( name, val );
 			}
 			/*!
+			* \brief set synchronization engine for distributed training, the learner does not own it
+			*        each worker sets its own shard of rows as data (bst:dsplit=row), gradients and prediction buffers stay local,
+			*        all workers get the same model, losses of evaluation data are summed over workers;
+			*        with bst:dsplit=col each worker sets all rows with its own features, evaluation data is predicted
+			*        by the workers together, so all workers get the same losses
+			* \param sync synchronization engine, NULL means training in a single process
+			*/
+			inline void SetSync( sync::ISync *sync ){
+				this->sync = sync;
+				base_model.SetSync( sync );
+			}
+			/*!
 			* \brief initialize solver before training, called before training
 			* this function is reserved for solver to allocate necessary space and do other preparation 
 			*/
 			inline void InitTrainer( void ){
 				base_model.InitTrainer();
 				mparam.AdjustBase();
+				// build the column index of training data once, shared by all the rounds,
+				// sorted by value for trees, in row order for linear booster, paged data is streamed by the boosters instead
+				if( (*train_).PagedRows() == NULL ){
+					if( base_model.BoosterType() == 1 ) (*train_).data.InitRowOrderCol();
+					else (*train_).data.InitColAccess();
+				}
 			} 
 
 			 /*!
@@ -86,7 +115,7 @@ namespace xgboost{
 			* \param fi input stream
 			*/          
 			inline void LoadModel( utils::IStream &fi ){
-				utils::Assert( fi.Read( &mparam, sizeof(ModelParam) ) != 0 );
+				utils::Assert( fi.Read( &mparam, sizeof(ModelParam) ) == sizeof(ModelParam) );
 				base_model.LoadModel( fi );
 			}
 			/*! 
@@ -97,51 +126,171 @@ namespace xgboost{
 				fo.Write( &mparam, sizeof(ModelParam) );
 				base_model.SaveModel( fo );	
 			} 
+			/*!
+			* \brief save the model in serving format, which only has what prediction needs and is loaded by RegServingModel,
+			*        only supported when all boosters are trees
+			* \param fo output stream
+			*/
+			inline void SaveServing( utils::IStream &fo ) const{
+				ServingHead head;
+				head.base_score = mparam.base_score; head.loss_type = mparam.loss_type;
+				base_model.SaveServing( fo, &head, sizeof(head) );
+			}
 			
 			/*! 
 			* \brief update the model for one iteration
 			* \param iteration the number of updating iteration 
 			*/           
 			inline void UpdateOneIter( int iteration ){
-				std::vector<float> grad,hess,preds;
+				// statistics of training are collected per iteration when parameter profile is set
+				if( base_model.Profiling() ) base_model.ClearStats();
 				std::vector<unsigned> root_index;
-				booster::FMatrixS::Image train_image((*train_).data);
-				Predict(preds,*train_,0);
-				Gradient(preds,(*train_).labels,grad,hess);
-				base_model.DoBoost(grad,hess,train_image,root_index);
-				int buffer_index_offset = (*train_).size();
-				float loss = 0.0;
-				for(int i = 0; i < evals_.size();i++){
-					Predict(preds, *evals_[i], buffer_index_offset);
-					loss = mparam.Loss(preds,(*evals_[i]).labels);
-					if(!silent){
-						printf("The loss of %s data set in %d the \
-							iteration is %f",evname_[i].c_str(),&iteration,&loss);
+				booster::FMatrixS::Image train_image((*train_).data, (*train_).PagedRows());
+				// buffers are members, so their space is reused by later iterations
+				Predict(preds_,*train_,0);
+				Gradient(preds_,(*train_).labels,grad_,hess_);
+				// training data uses buffer from 0, its buffer is updated with the new booster in DoBoost
+				base_model.DoBoost(grad_,hess_,train_image,root_index,0);
+				// evaluation data is scored every eval_period iterations, their buffers catch up with the skipped boosters
+				if( eval_period > 0 && iteration % eval_period == 0 ) this->Evaluate( iteration );
+				if( base_model.Profiling() && !silent ){
+					base_model.Stats().Print( stdout );
+				}
+			}
+
+			/*!
+			* \brief compute and print the loss of each evaluation data set, a collective call in distributed training
+			* \param iteration the number of updating iteration, used in the message
+			*/
+			inline void Evaluate( int iteration ){
+				this->EvalLoss( eval_loss_ );
+				if( silent || ( sync != NULL && sync->GetRank() != 0 ) ) return;
+				for( size_t i = 0; i < evals_.size(); i ++ ){
+					printf("The loss of %s data set in %d the iteration is %f\n",
+						evname_[i].c_str(),iteration,eval_loss_[i]);
+				}
+			}
+			/*!
+			* \brief compute the loss of all evaluation data sets in one parallel pass,
+			*        each set is predicted into its segment of the prediction buffer, so only new boosters are evaluated,
+			*        then rows of all sets are split into chunks, the chunks are scored in parallel and summed in order,
+			*        so the loss does not depend on the number of threads; losses of row shards are summed over workers in one call,
+			*        with bst:dsplit=col each step of a row is taken by the worker holding the split feature, see PredictBatchDistCol
+			* \param loss output loss of each evaluation data set
+			*/
+			inline void EvalLoss( std::vector<double> &loss ){
+				const size_t kChunk = 4096;
+				loss.assign( evals_.size(), 0.0 );
+				size_t nrow = 0;
+				for( size_t i = 0; i < evals_.size(); i ++ ) nrow += (*evals_[i]).size();
+				eval_preds_.resize( nrow );
+				eval_chunks_.clear();
+				const size_t ntrain = (*train_).size();
+				size_t offset = 0;
+				for( size_t i = 0; i < evals_.size(); i ++ ){
+					const size_t n = (*evals_[i]).size();
+					if( n == 0 ) continue;
+					booster::FMatrixS::Image data_image((*evals_[i]).data, (*evals_[i]).PagedRows());
+					if( this->DistCol() ){
+						base_model.PredictBatchDistCol(data_image, n, &eval_preds_[offset], static_cast<int>( ntrain + offset ));
+					}else{
+						base_model.PredictBatch(data_image, n, &eval_preds_[offset], static_cast<int>( ntrain + offset ));
+					}
+					for( size_t begin = 0; begin < n; begin += kChunk ){
+						EvalChunk c;
+						c.set = static_cast<unsigned>( i ); c.offset = offset + begin;
+						c.begin = begin; c.len = std::min( kChunk, n - begin );
+						eval_chunks_.push_back( c );
 					}
-					buffer_index_offset += (*evals_[i]).size();
+					offset += n;
 				}
-				
+				const int nchunk = static_cast<int>( eval_chunks_.size() );
+				chunk_loss_.resize( nchunk );
+				#pragma omp parallel for schedule( dynamic, 1 )
+				for( int k = 0; k < nchunk; k ++ ){
+					const EvalChunk &c = eval_chunks_[k];
+					chunk_loss_[k] = mparam.LossMargin( &eval_preds_[c.offset], &(*evals_[c.set]).labels[c.begin], c.len );
+				}
+				for( int k = 0; k < nchunk; k ++ ){
+					loss[ eval_chunks_[k].set ] += chunk_loss_[k];
+				}
+				// each worker of column split holds all the rows, so the losses are already the same on all workers
+				if( sync != NULL && !this->DistCol() && loss.size() != 0 ) sync->AllreduceSum( &loss[0], loss.size() );
+			}
+			/*! \brief whether training is distributed by columns over more than one worker */
+			inline bool DistCol( void ) const{
+				return dsplit_col && sync != NULL && sync->GetWorldSize() > 1;
+			}
+
+			/*!
+			* \brief checkpoint the model, the prediction buffers are written in background, see booster::CheckpointWriter
+			* \param writer checkpoint writer, initialized with the prefix of checkpoint
+			* \param iteration the number of updating iterations done, returned by LoadCheckpoint on resume
+			*/
+			inline void SaveCheckpoint( booster::CheckpointWriter &writer, int iteration ){
+				CheckpointHead head;
+				head.mparam = mparam; head.iteration = iteration;
+				writer.Save( base_model, &head, sizeof(head) );
+			}
+			/*!
+			* \brief resume from the latest checkpoint, called after InitTrainer, replaces the model
+			* \param prefix prefix of checkpoint
+			* \return the number of iterations done in checkpoint, 0 if there is no checkpoint
+			*/
+			inline int LoadCheckpoint( const char *prefix ){
+				std::string head;
+				if( !booster::CheckpointWriter::Load( prefix, base_model, &head ) ) return 0;
+				utils::Assert( head.length() == sizeof(CheckpointHead), "invalid checkpoint of RegBoostLearner" );
+				CheckpointHead h;
+				memcpy( &h, head.data(), sizeof(h) );
+				// base_score in checkpoint is already adjusted by InitTrainer
+				mparam = h.mparam;
+				base_model.InitTrainer();
+				return h.iteration;
+			}
+
+			/*! \brief statistics of training in last iteration, only collected when parameter profile is set */
+			inline const booster::BoostStats &Stats( void ) const{
+				return base_model.Stats();
 			}
 
 			/*! \brief get the transformed predictions, given data */
 			inline void Predict( std::vector<float> &preds, const DMatrix &data,int buffer_index_offset = 0 ){
 				int data_size = data.size();
 				preds.resize(data_size);
-				for(int j = 0; j < data_size; j++){
-					preds[j] = mparam.PredTransform(mparam.base_score + 
-						base_model.Predict(data.data[j],buffer_index_offset + j));
-				}
+				if(data_size == 0) return;
+				booster::FMatrixS::Image data_image(data.data, data.PagedRows());
+				base_model.PredictBatch(data_image, data_size, &preds[0], buffer_index_offset);
+				mparam.PredTransform(&preds[0], data_size);
+			}
+
+			/*!
+			* \brief decide whether the transformed prediction of a row is above threshold, e.g. for filtering by a cut on probability,
+			*        boosters are evaluated in order and the evaluation stops once the decision is known, 
+			*        see GBMBaseModel::PredictAbove for the parameters
+			* \param row features of the row
+			* \param threshold threshold of transformed prediction
+			* \param bound_scale fraction of the bounds of remaining trees that is trusted, 1 makes the decision exact
+			* \param tree_limit only the first tree_limit boosters are used, 0 means all boosters
+			* \param ntree output number of boosters evaluated, can be NULL
+			* \return whether the prediction is above threshold
+			*/
+			inline bool PredictAbove( const booster::FMatrixS::Line &row, float threshold, float bound_scale = 1.0f,
+				unsigned tree_limit = 0, unsigned *ntree = NULL ){
+				return base_model.PredictAbove( row, mparam.MarginThreshold( threshold ), bound_scale, tree_limit, 0, ntree );
 			}
 
 		private:
 			/*! \brief get the first order and second order gradient, given the transformed predictions and labels*/
 			inline void Gradient(const std::vector<float> &preds, const std::vector<float> &labels, std::vector<float> &grad,
 				std::vector<float> &hess){
-					grad.clear(); 
-					hess.clear();
-					for(int j = 0; j < preds.size(); j++){
-						grad.push_back(mparam.FirstOrderGradient(preds[j],labels[j]));
-						hess.push_back(mparam.SecondOrderGradient(preds[j],labels[j]));
+					const int n = static_cast<int>( preds.size() );
+					grad.resize(n); hess.resize(n);
+					if( n == 0 ) return;
+					switch( mparam.loss_type ){
+					case LINEAR_SQUARE: LossGradient<SquareLoss>(&preds[0], &labels[0], n, &grad[0], &hess[0]); break;
+					case LOGISTIC_NEGLOGLIKELIHOOD: LossGradient<LogisticLoss>(&preds[0], &labels[0], n, &grad[0], &hess[0]); break;
+					default: utils::Error("unknown loss_type");
 					}
 			}
 
@@ -187,8 +336,8 @@ namespace xgboost{
 				*/
 				inline float FirstOrderGradient( float predt, float label ) const{
 					switch( loss_type ){                        
-					case LINEAR_SQUARE: return predt - label;
-					case 1: return predt - label;
+					case LINEAR_SQUARE: return SquareLoss::FirstOrderGradient( predt, label );
+					case LOGISTIC_NEGLOGLIKELIHOOD: return LogisticLoss::FirstOrderGradient( predt, label );
 					default: utils::Error("unknown loss_type"); return 0.0f;
 					}
 				}
@@ -200,8 +349,8 @@ namespace xgboost{
 				*/
 				inline float SecondOrderGradient( float predt, float label ) const{
 					switch( loss_type ){                        
-					case LINEAR_SQUARE: return 1.0f;
-					case LOGISTIC_NEGLOGLIKELIHOOD: return predt * ( 1 - predt );
+					case LINEAR_SQUARE: return SquareLoss::SecondOrderGradient( predt, label );
+					case LOGISTIC_NEGLOGLIKELIHOOD: return LogisticLoss::SecondOrderGradient( predt, label );
 					default: utils::Error("unknown loss_type"); return 0.0f;
 					}
 				}
@@ -210,43 +359,33 @@ namespace xgboost{
 				* \brief calculating the loss, given the predictions, labels and the loss type
 				* \param preds the given predictions
 				* \param labels the given labels
-				* \return the specified loss
+				* \return the summation of the specified loss
 				*/
-				inline float Loss(const std::vector<float> &preds, const std::vector<float> &labels) const{
+				inline double Loss(const std::vector<float> &preds, const std::vector<float> &labels) const{
+					const int n = static_cast<int>( preds.size() );
+					if( n == 0 ) return 0.0;
 					switch( loss_type ){
-					case LINEAR_SQUARE: return SquareLoss(preds,labels);
-					case LOGISTIC_NEGLOGLIKELIHOOD: return NegLoglikelihoodLoss(preds,labels);
-					default: utils::Error("unknown loss_type"); return 0.0f;
+					case LINEAR_SQUARE: return LossSum<SquareLoss>(&preds[0], &labels[0], n);
+					case LOGISTIC_NEGLOGLIKELIHOOD: return LossSum<LogisticLoss>(&preds[0], &labels[0], n);
+					default: utils::Error("unknown loss_type"); return 0.0;
 					}
 				}
 
 				/*!
-				* \brief calculating the square loss, given the predictions and labels
-				* \param preds the given predictions
+				* \brief calculating the loss of a range of instances, given the linear sums without base_score
+				* \param margin the linear sums of boosting ensemble
 				* \param labels the given labels
-				* \return the summation of square loss
+				* \param n number of instances
+				* \return the summation of the specified loss
 				*/
-				inline float SquareLoss(const std::vector<float> &preds, const std::vector<float> &labels) const{
-					float ans = 0.0;
-					for(int i = 0; i < preds.size(); i++)
-						ans += pow(preds[i] - labels[i], 2);
-					return ans;
-				}
-
-				/*!
-				* \brief calculating the square loss, given the predictions and labels
-				* \param preds the given predictions
-				* \param labels the given labels
-				* \return the summation of square loss
-				*/
-				inline float NegLoglikelihoodLoss(const std::vector<float> &preds, const std::vector<float> &labels) const{
-					float ans = 0.0;
-					for(int i = 0; i < preds.size(); i++)
-						ans -= labels[i] * log(preds[i]) + ( 1 - labels[i] ) * log(1 - preds[i]);
-					return ans;
+				inline double LossMargin(const float *margin, const float *labels, size_t n) const{
+					switch( loss_type ){
+					case LINEAR_SQUARE: return LossSumMargin<SquareLoss>(margin, labels, n, base_score);
+					case LOGISTIC_NEGLOGLIKELIHOOD: return LossSumMargin<LogisticLoss>(margin, labels, n, base_score);
+					default: utils::Error("unknown loss_type"); return 0.0;
+					}
 				}
 
-				
 				/*! 
 				* \brief transform the linear sum to prediction 
 				* \param x linear sum of boosting ensemble
@@ -254,21 +393,70 @@ namespace xgboost{
 				*/
 				inline float PredTransform( float x ){
 					switch( loss_type ){                        
-					case LINEAR_SQUARE: return x;
-					case LOGISTIC_NEGLOGLIKELIHOOD: return 1.0f/(1.0f + expf(-x));
+					case LINEAR_SQUARE: return SquareLoss::PredTransform( x );
+					case LOGISTIC_NEGLOGLIKELIHOOD: return LogisticLoss::PredTransform( x );
+					default: utils::Error("unknown loss_type"); return 0.0f;
+					}
+				}
+				/*!
+				* \brief threshold on linear sum of boosting ensemble that is equivalent to threshold on prediction, 
+				*        the transformations are increasing, so prediction > threshold iff linear sum > returned value
+				* \param threshold threshold of transformed prediction
+				* \return threshold of linear sum, without base_score
+				*/
+				inline float MarginThreshold( float threshold ) const{
+					switch( loss_type ){
+					case LINEAR_SQUARE: return threshold - base_score;
+					case LOGISTIC_NEGLOGLIKELIHOOD:
+						utils::Assert( threshold > 0.0f && threshold < 1.0f, "threshold of logistic loss must be in (0,1)" );
+						return - logf( 1.0f / threshold - 1.0f ) - base_score;
 					default: utils::Error("unknown loss_type"); return 0.0f;
 					}
 				}
+				/*! 
+				* \brief add base_score and transform linear sums to predictions, in place
+				* \param preds linear sums of boosting ensemble, transformed predictions on return
+				* \param n number of instances
+				*/
+				inline void PredTransform( float *preds, int n ) const{
+					switch( loss_type ){                        
+					case LINEAR_SQUARE: LossPredTransform<SquareLoss>( preds, n, base_score ); break;
+					case LOGISTIC_NEGLOGLIKELIHOOD: LossPredTransform<LogisticLoss>( preds, n, base_score ); break;
+					default: utils::Error("unknown loss_type");
+					}
+				}
 
 				
 			};            
+			/*! \brief parameters of learner saved with checkpoint */
+			struct CheckpointHead{
+				ModelParam mparam;
+				int iteration;
+			};
 		private:            
 			booster::GBMBaseModel base_model;
 			ModelParam   mparam;
-			const DMatrix *train_;
+			DMatrix *train_;
 			std::vector<const DMatrix *> evals_;
 			std::vector<std::string> evname_;
 			bool silent;
+			/*! \brief synchronization engine of distributed training, NULL if not distributed */
+			sync::ISync *sync;
+			/*! \brief buffers of predictions and gradients, reused across iterations */
+			std::vector<float> preds_, grad_, hess_;
+			/*! \brief evaluate every eval_period iterations, 0 means no evaluation */
+			int eval_period;
+			/*! \brief whether each worker holds its own features of all rows, set by bst:dsplit=col */
+			bool dsplit_col;
+			/*! \brief rows [begin,begin+len) of evaluation set, predictions at offset of eval_preds_ */
+			struct EvalChunk{
+				unsigned set;
+				size_t offset, begin, len;
+			};
+			/*! \brief buffers of evaluation, reused across iterations */
+			std::vector<float> eval_preds_;
+			std::vector<EvalChunk> eval_chunks_;
+			std::vector<double> chunk_loss_, eval_loss_;
 		};
 	}
 };
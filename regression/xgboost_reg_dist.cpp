@@ -0,0 +1,103 @@
+/*!
+* \file xgboost_reg_dist.cpp
+* \brief distributed training of regression model over MPI, built by make xgboost_dist, run by e.g. mpirun -np 4 xgboost_dist reg.conf
+*
+*  Usage: xgboost_dist [config] [name=value]...
+*     train_path        training data in text format, every worker loads it and keeps its own shard
+*     validation_paths  evaluation data in text format, separated by ';'
+*     validation_names  names of evaluation data, separated by ';'
+*     boost_iterations  number of boosting iterations
+*     model_out         file the model is saved to by worker 0 after training, default final.model
+*     bst:dsplit        row: each worker keeps rows i with i % nworker == rank, bst:tree_method=hist is required,
+*                       col: each worker keeps all rows with features f % nworker == rank,
+*                       evaluation data is sharded the same way as training data
+*  other parameters go to RegBoostLearner, parameters in the config file are read first, the ones on the command line override them
+*/
+#define _CRT_SECURE_NO_WARNINGS
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "xgboost_reg.h"
+#include "xgboost_regdata.h"
+#include "../utils/xgboost_config.h"
+#include "../utils/xgboost_string.h"
+#include "../utils/xgboost_sync.h"
+
+using namespace xgboost;
+
+/*! \brief parameters of the driver, the others are given to the learner */
+struct DistParam{
+	std::string train_path, model_out;
+	std::vector<std::string> eval_paths, eval_names;
+	int num_round;
+	bool by_col;
+	DistParam( void ){
+		model_out = "final.model"; num_round = 10; by_col = false;
+	}
+	inline void SetParam( const char *name, const char *val ){
+		if( !strcmp( name, "train_path" ) ) train_path = val;
+		if( !strcmp( name, "model_out" ) ) model_out = val;
+		if( !strcmp( name, "boost_iterations" ) ) num_round = atoi( val );
+		if( !strcmp( name, "validation_paths" ) ) eval_paths = utils::StringProcessing::split( val, ';' );
+		if( !strcmp( name, "validation_names" ) ) eval_names = utils::StringProcessing::split( val, ';' );
+		if( !strcmp( name, "bst:dsplit" ) ) by_col = !strcmp( val, "col" );
+	}
+};
+
+int main( int argc, char *argv[] ){
+	MPI_Init( &argc, &argv );
+	sync::SyncMPI engine;
+	const int rank = engine.GetRank(), nworker = engine.GetWorldSize();
+	// parameters are kept in order, the learner sees them as they are given
+	std::vector<std::string> names, vals;
+	for( int i = 1; i < argc; i ++ ){
+		char name[ 256 ], val[ 256 ];
+		if( sscanf( argv[i], "%255[^=]=%255s", name, val ) == 2 ){
+			names.push_back( name ); vals.push_back( val );
+		}else{
+			utils::ConfigIterator itr( argv[i] );
+			while( itr.Next() ){
+				names.push_back( itr.name() ); vals.push_back( itr.val() );
+			}
+		}
+	}
+	DistParam param;
+	for( size_t i = 0; i < names.size(); i ++ ) param.SetParam( names[i].c_str(), vals[i].c_str() );
+	utils::Assert( param.train_path.length() != 0, "train_path must be given" );
+	utils::Assert( param.eval_paths.size() == param.eval_names.size(),
+		"The number of validation paths is not the same as the number of validation data set names" );
+	const bool silent = rank != 0;
+
+	regression::DMatrix train;
+	train.LoadText( param.train_path.c_str(), silent );
+	train.Shard( rank, nworker, param.by_col );
+	// evaluation data is sharded the same way, the learner sums losses of row shards over workers
+	std::vector<const regression::DMatrix*> evals;
+	for( size_t i = 0; i < param.eval_paths.size(); i ++ ){
+		regression::DMatrix *eval = new regression::DMatrix();
+		eval->LoadText( param.eval_paths[i].c_str(), silent );
+		eval->Shard( rank, nworker, param.by_col );
+		evals.push_back( eval );
+	}
+
+	regression::RegBoostLearner learner( silent );
+	for( size_t i = 0; i < names.size(); i ++ ) learner.SetParam( names[i].c_str(), vals[i].c_str() );
+	if( silent ) learner.SetParam( "silent", "1" );
+	learner.SetData( &train, evals, param.eval_names );
+	learner.SetSync( &engine );
+	learner.InitModel();
+	learner.InitTrainer();
+	for( int i = 1; i <= param.num_round; i ++ ){
+		learner.UpdateOneIter( i );
+	}
+	// all workers hold the same model
+	if( rank == 0 ){
+		utils::FileStream fo( utils::FopenCheck( param.model_out.c_str(), "wb" ), utils::FileStream::kBufferSize );
+		learner.SaveModel( fo );
+		fo.Close();
+	}
+	for( size_t i = 0; i < evals.size(); i ++ ) delete evals[i];
+	MPI_Finalize();
+	return 0;
+}
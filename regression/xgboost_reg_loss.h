@@ -0,0 +1,111 @@
+#ifndef _XGBOOST_REG_LOSS_H_
+#define _XGBOOST_REG_LOSS_H_
+/*!
+* \file xgboost_reg_loss.h
+* \brief loss functions of regression and the parallel kernels that compute transform, gradient and loss,
+*     kernels are templates over the loss so the inner loops are free of dispatch and can be vectorized
+*/
+#include <cmath>
+#include "../utils/xgboost_omp.h"
+
+namespace xgboost{
+	namespace regression{
+		/*! \brief square loss, 0.5 * ( pred - label )^2, reported as ( pred - label )^2 */
+		struct SquareLoss{
+			/*! \brief transform the linear sum to prediction */
+			inline static float PredTransform( float x ){
+				return x;
+			}
+			/*! \brief first order gradient, given transformed prediction */
+			inline static float FirstOrderGradient( float predt, float label ){
+				return predt - label;
+			}
+			/*! \brief second order gradient, given transformed prediction */
+			inline static float SecondOrderGradient( float predt, float label ){
+				return 1.0f;
+			}
+			/*! \brief loss of one instance, given transformed prediction */
+			inline static double Loss( float predt, float label ){
+				const double diff = predt - label;
+				return diff * diff;
+			}
+		};
+		/*! \brief negative log likelihood of logistic regression, prediction is the probability */
+		struct LogisticLoss{
+			inline static float PredTransform( float x ){
+				return 1.0f / ( 1.0f + expf( -x ) );
+			}
+			inline static float FirstOrderGradient( float predt, float label ){
+				return predt - label;
+			}
+			inline static float SecondOrderGradient( float predt, float label ){
+				return predt * ( 1.0f - predt );
+			}
+			inline static double Loss( float predt, float label ){
+				return - ( label * log( (double)predt ) + ( 1.0 - label ) * log( 1.0 - predt ) );
+			}
+		};
+
+		/*!
+		* \brief transform linear sums into predictions, in place
+		* \param preds linear sum without base, transformed prediction on return
+		* \param n number of instances
+		* \param base_score global bias added before transform
+		*/
+		template<typename LossType>
+		inline void LossPredTransform( float *preds, int n, float base_score ){
+			#pragma omp parallel for schedule( static )
+			for( int i = 0; i < n; i ++ ){
+				preds[i] = LossType::PredTransform( base_score + preds[i] );
+			}
+		}
+		/*!
+		* \brief compute first and second order gradient of all instances
+		* \param preds transformed predictions
+		* \param labels true labels
+		* \param n number of instances
+		* \param grad output first order gradient, must have space of n
+		* \param hess output second order gradient, must have space of n
+		*/
+		template<typename LossType>
+		inline void LossGradient( const float *preds, const float *labels, int n, float *grad, float *hess ){
+			#pragma omp parallel for schedule( static )
+			for( int i = 0; i < n; i ++ ){
+				grad[i] = LossType::FirstOrderGradient( preds[i], labels[i] );
+				hess[i] = LossType::SecondOrderGradient( preds[i], labels[i] );
+			}
+		}
+		/*!
+		* \brief sum of loss over all instances, accumulated in double
+		* \param preds transformed predictions
+		* \param labels true labels
+		* \param n number of instances
+		*/
+		template<typename LossType>
+		inline double LossSum( const float *preds, const float *labels, int n ){
+			double sum = 0.0;
+			#pragma omp parallel for schedule( static ) reduction( +:sum )
+			for( int i = 0; i < n; i ++ ){
+				sum += LossType::Loss( preds[i], labels[i] );
+			}
+			return sum;
+		}
+		/*!
+		* \brief sum of loss over instances given linear sums, transform and loss are fused in one pass,
+		*        the loop is sequential, callers split the instances into chunks that are summed in parallel
+		* \param margin linear sums without base
+		* \param labels true labels
+		* \param n number of instances
+		* \param base_score global bias added before transform
+		*/
+		template<typename LossType>
+		inline double LossSumMargin( const float *margin, const float *labels, size_t n, float base_score ){
+			double sum = 0.0;
+			for( size_t i = 0; i < n; i ++ ){
+				sum += LossType::Loss( LossType::PredTransform( base_score + margin[i] ), labels[i] );
+			}
+			return sum;
+		}
+	};
+};
+#endif
@@ -0,0 +1,42 @@
+/*!
+* \file xgboost_reg_server.cpp
+* \brief scoring server of regression model, built by make xgboost_server, see xgboost_reg_server.h for the protocol
+*
+*  Usage: xgboost_server [config] [name=value]...
+*     serving_in       model in serving format, saved by RegBoostLearner::SaveServing
+*     model_in         model saved by training, used when serving_in is not given
+*     port             TCP port to listen to, default 0, which reads stdin and writes stdout until stdin ends
+*     nworker          number of worker threads, default 4
+*     max_batch        maximum number of rows in a batch, default 256
+*     batch_window_us  longest time in microseconds a row waits for its batch to fill, default 200
+*     max_queue        maximum number of rows waiting in queue, default 65536
+*     stats_out        file of latency statistics, written at exit and every stats_period seconds
+*     stats_period     seconds between writes of stats_out, default 0, which writes only at exit
+*  parameters in the config file are read first, the ones on the command line override them
+*/
+#define _CRT_SECURE_NO_WARNINGS
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include "xgboost_reg_server.h"
+#include "../utils/xgboost_config.h"
+
+using namespace xgboost;
+
+int main( int argc, char *argv[] ){
+	// a client that goes away fails the write of its connection instead of killing the server
+	signal( SIGPIPE, SIG_IGN );
+	regression::ServerParam param;
+	for( int i = 1; i < argc; i ++ ){
+		char name[ 256 ], val[ 256 ];
+		if( sscanf( argv[i], "%255[^=]=%255s", name, val ) == 2 ){
+			param.SetParam( name, val );
+		}else{
+			utils::ConfigIterator itr( argv[i] );
+			while( itr.Next() ) param.SetParam( itr.name(), itr.val() );
+		}
+	}
+	regression::RegScoreServer server( param );
+	server.Run();
+	return 0;
+}
@@ -0,0 +1,539 @@
+#ifndef _XGBOOST_REG_SERVER_H_
+#define _XGBOOST_REG_SERVER_H_
+/*!
+* \file xgboost_reg_server.h
+* \brief long running scoring server of regression model, the model is loaded once and kept resident.
+*     Requests are lines of text read from stdin, or from TCP connections when a port is given,
+*     each line is one sparse row in libsvm format without label:
+*         [id] index:value index:value ...
+*     the optional id is any token without ':', the response is a line "id prediction", or "prediction" without id,
+*     a line that can not be parsed gets "error invalid request"; responses of a connection are in order of its requests.
+*     A line "!stats" gets the statistics of the server, lines starting with '#', ended by a line "#end".
+*
+*     Rows of all connections go to one queue, a pool of workers takes them in batches: a batch is taken when
+*     max_batch rows are waiting, or when the oldest waiting row has waited batch_window_us microseconds,
+*     and is predicted by RegServingModel::PredictBatch in one call.
+*     Latency of each request is recorded in log scale histograms, see LatencyHist.
+*/
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cerrno>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <algorithm>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "xgboost_reg.h"
+#include "xgboost_reg_serving.h"
+#include "xgboost_libsvm_parser.h"
+#include "../utils/xgboost_utils.h"
+#include "../utils/xgboost_timer.h"
+#include "../utils/xgboost_stream.h"
+#include "../utils/xgboost_zstream.h"
+
+namespace xgboost{
+	namespace regression{
+		/*! \brief histogram of latency in log scale, 4 buckets for each power of 2 microseconds */
+		struct LatencyHist{
+			/*! \brief number of buckets, bucket 0 is below 1 microsecond, the last one is above 2^31.5 microseconds */
+			static const int kNumBucket = 128;
+			/*! \brief number of latencies in each bucket */
+			unsigned long long count[ kNumBucket ];
+			/*! \brief number of latencies, their sum and maximum in seconds */
+			unsigned long long total;
+			double sum, max;
+			LatencyHist( void ){
+				this->Clear();
+			}
+			inline void Clear( void ){
+				memset( count, 0, sizeof(count) );
+				total = 0; sum = max = 0.0;
+			}
+			/*! \brief bucket of latency t in seconds, bucket b > 0 holds [2^((b-1)/4),2^(b/4)) microseconds */
+			inline static int Bucket( double t ){
+				const double us = t * 1e6;
+				if( !( us >= 1.0 ) ) return 0;
+				const int b = static_cast<int>( std::log( us ) * ( 4.0 / std::log( 2.0 ) ) ) + 1;
+				return std::min( b, kNumBucket - 1 );
+			}
+			/*! \brief upper bound of bucket b in microseconds */
+			inline static double Upper( int b ){
+				return std::pow( 2.0, b * 0.25 );
+			}
+			/*! \brief add a latency in seconds */
+			inline void Add( double t ){
+				count[ Bucket( t ) ] ++;
+				total ++; sum += t;
+				if( t > max ) max = t;
+			}
+			/*!
+			* \brief latency at quantile q in microseconds, the upper bound of the bucket holding it,
+			*        so it is at most 19% above the exact quantile, and it is never above the maximum
+			*/
+			inline double Quantile( double q ) const{
+				if( total == 0 ) return 0.0;
+				const unsigned long long rank = static_cast<unsigned long long>( std::ceil( q * total ) );
+				unsigned long long acc = 0;
+				for( int b = 0; b < kNumBucket; b ++ ){
+					acc += count[ b ];
+					if( acc >= rank && acc != 0 ) return std::min( Upper( b ), max * 1e6 );
+				}
+				return max * 1e6;
+			}
+			/*!
+			* \brief append the histogram as text lines, a summary line
+			*          # latency name count mean_us p50_us p90_us p99_us p999_us max_us
+			*        followed by a line for each nonempty bucket
+			*          # bucket name upper_us count
+			*/
+			inline void Export( std::string &out, const char *name ) const{
+				char buf[ 256 ];
+				snprintf( buf, sizeof(buf), "# latency\t%s\t%llu\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\t%.1f\n", name, total,
+						  total == 0 ? 0.0 : sum / total * 1e6, Quantile( 0.5 ), Quantile( 0.9 ), Quantile( 0.99 ),
+						  Quantile( 0.999 ), max * 1e6 );
+				out += buf;
+				for( int b = 0; b < kNumBucket; b ++ ){
+					if( count[ b ] == 0 ) continue;
+					snprintf( buf, sizeof(buf), "# bucket\t%s\t%.1f\t%llu\n", name, Upper( b ), count[ b ] );
+					out += buf;
+				}
+			}
+		};
+
+		/*! \brief parameters of scoring server */
+		struct ServerParam{
+			/*! \brief model in serving format saved by RegBoostLearner::SaveServing, mapped from file */
+			std::string serving_in;
+			/*! \brief model saved by training, compiled into serving format in memory, used when serving_in is not given */
+			std::string model_in;
+			/*! \brief TCP port to listen to, 0 reads requests from stdin and writes responses to stdout */
+			int port;
+			/*! \brief number of worker threads that predict batches */
+			int nworker;
+			/*! \brief maximum number of rows in a batch */
+			int max_batch;
+			/*! \brief longest time in microseconds a row waits for its batch to fill */
+			int batch_window_us;
+			/*! \brief maximum number of rows waiting in queue, readers wait when the queue is full */
+			int max_queue;
+			/*! \brief file the statistics are written to, empty means stderr at exit */
+			std::string stats_out;
+			/*! \brief seconds between writes of statistics to stats_out, 0 means only at exit */
+			int stats_period;
+			/*! \brief whether to be silent */
+			int silent;
+			ServerParam( void ){
+				port = 0; nworker = 4; max_batch = 256; batch_window_us = 200;
+				max_queue = 65536; stats_period = 0; silent = 0;
+			}
+			/*!
+			* \brief set parameters from outside
+			* \param name name of the parameter
+			* \param val  value of the parameter
+			*/
+			inline void SetParam( const char *name, const char *val ){
+				if( !strcmp( name, "serving_in") )      serving_in = val;
+				if( !strcmp( name, "model_in") )        model_in = val;
+				if( !strcmp( name, "port") )            port = atoi( val );
+				if( !strcmp( name, "nworker") )         nworker = std::max( atoi( val ), 1 );
+				if( !strcmp( name, "max_batch") )       max_batch = std::max( atoi( val ), 1 );
+				if( !strcmp( name, "batch_window_us") ) batch_window_us = std::max( atoi( val ), 0 );
+				if( !strcmp( name, "max_queue") )       max_queue = std::max( atoi( val ), 1 );
+				if( !strcmp( name, "stats_out") )       stats_out = val;
+				if( !strcmp( name, "stats_period") )    stats_period = atoi( val );
+				if( !strcmp( name, "silent") )          silent = atoi( val );
+			}
+		};
+
+		/*! \brief scoring server of regression model */
+		class RegScoreServer{
+		public:
+			/*! \brief constructor, the model is loaded when Run starts */
+			RegScoreServer( const ServerParam &param ):param( param ){
+				pthread_mutex_init( &qlock, NULL );
+				pthread_cond_init( &qfill, NULL );
+				pthread_cond_init( &qspace, NULL );
+				pthread_cond_init( &qstop, NULL );
+				stop = false;
+				num_request = num_batch = 0;
+			}
+			~RegScoreServer( void ){
+				pthread_mutex_destroy( &qlock );
+				pthread_cond_destroy( &qfill );
+				pthread_cond_destroy( &qspace );
+				pthread_cond_destroy( &qstop );
+			}
+			/*! \brief load the model, map the serving format, or compile the trained model into it */
+			inline void LoadModel( void ){
+				if( param.serving_in.length() != 0 ){
+					utils::Assert( model.Load( param.serving_in.c_str() ), "RegScoreServer: fail to load model in serving format" );
+					return;
+				}
+				utils::Assert( param.model_in.length() != 0, "RegScoreServer: serving_in or model_in must be given" );
+				RegBoostLearner learner( true );
+				utils::FileStream fi( utils::FopenCheck( param.model_in.c_str(), "rb" ), utils::FileStream::kBufferSize );
+				{// models saved with model_compress are decompressed, plain models are read as they are
+					utils::ZInStream zin( fi );
+					learner.LoadModel( zin );
+				}
+				fi.Close();
+				std::string buf;
+				utils::MemoryStream ms( buf );
+				learner.SaveServing( ms );
+				// the serving format is read in place, it must be aligned to 8 bytes
+				model_data.resize( ( buf.length() + 7 ) / 8 );
+				memcpy( &model_data[0], buf.data(), buf.length() );
+				utils::Assert( model.LoadMemory( &model_data[0], buf.length() ), "RegScoreServer: fail to compile model" );
+			}
+			/*! \brief load the model and serve, until stdin ends, or forever when listening to a port */
+			inline void Run( void ){
+				this->LoadModel();
+				std::vector<pthread_t> workers( param.nworker );
+				for( int i = 0; i < param.nworker; i ++ ){
+					utils::Assert( pthread_create( &workers[i], NULL, WorkerThread, this ) == 0, "RegScoreServer: fail to start worker" );
+				}
+				pthread_t reporter;
+				const bool report = param.stats_period > 0 && param.stats_out.length() != 0;
+				if( report ){
+					utils::Assert( pthread_create( &reporter, NULL, ReportThread, this ) == 0, "RegScoreServer: fail to start reporter" );
+				}
+				if( param.port == 0 ){
+					if( !param.silent ) fprintf( stderr, "RegScoreServer: reading requests from stdin\n" );
+					this->ReadConn( new Conn( 0, 1, false ) );
+				}else{
+					this->Listen();
+				}
+				// rows in queue are still predicted, then the workers leave
+				pthread_mutex_lock( &qlock );
+				stop = true;
+				pthread_cond_broadcast( &qfill );
+				pthread_cond_broadcast( &qspace );
+				pthread_cond_broadcast( &qstop );
+				pthread_mutex_unlock( &qlock );
+				for( int i = 0; i < param.nworker; i ++ ) pthread_join( workers[i], NULL );
+				if( report ) pthread_join( reporter, NULL );
+				if( param.stats_out.length() != 0 ){
+					this->WriteStats();
+				}else if( !param.silent ){
+					fputs( this->Stats().c_str(), stderr );
+				}
+			}
+			/*! \brief statistics of the server in text, lines starting with '#', see LatencyHist::Export */
+			inline std::string Stats( void ){
+				std::string out;
+				char buf[ 256 ];
+				pthread_mutex_lock( &qlock );
+				snprintf( buf, sizeof(buf), "# requests\t%llu\n# batches\t%llu\n# rows_per_batch\t%.2f\n", num_request, num_batch,
+						  num_batch == 0 ? 0.0 : (double)num_request / num_batch );
+				out += buf;
+				// time from reading the request to the start of its batch, and to writing its response
+				hist_queue.Export( out, "queue" );
+				hist_total.Export( out, "total" );
+				pthread_mutex_unlock( &qlock );
+				return out;
+			}
+		private:
+			/*! \brief a stream of requests, responses are written back in order of requests */
+			struct Conn{
+				int fd_in, fd_out;
+				bool is_socket;
+				/*! \brief whether writing failed, later responses are dropped */
+				bool failed;
+				/*! \brief sequence number of next request, and of next response to write */
+				unsigned long long next_seq, write_seq;
+				/*! \brief responses that wait for earlier ones */
+				std::map<unsigned long long, std::string> ready;
+				/*! \brief number of references, the reader and each request in flight hold one */
+				int ref;
+				pthread_mutex_t lock;
+				Conn( int fd_in, int fd_out, bool is_socket ):fd_in( fd_in ), fd_out( fd_out ), is_socket( is_socket ){
+					failed = false; next_seq = write_seq = 0; ref = 1;
+					pthread_mutex_init( &lock, NULL );
+				}
+				~Conn( void ){
+					pthread_mutex_destroy( &lock );
+					if( is_socket ) close( fd_in );
+				}
+				inline void Write( const std::string &s ){
+					for( size_t top = 0; top < s.length() && !failed; ){
+						const ssize_t n = is_socket ? send( fd_out, s.data() + top, s.length() - top, MSG_NOSIGNAL )
+							: write( fd_out, s.data() + top, s.length() - top );
+						if( n < 0 && errno == EINTR ) continue;
+						if( n <= 0 ) failed = true; else top += n;
+					}
+				}
+			};
+			/*! \brief a row to be predicted */
+			struct Request{
+				Conn *conn;
+				unsigned long long seq;
+				/*! \brief time the request is read */
+				double arrive;
+				std::string id;
+				std::vector<booster::bst_uint> findex;
+				std::vector<booster::bst_float> fvalue;
+			};
+			/*! \brief argument of reader thread of a connection */
+			struct ReaderArg{
+				RegScoreServer *server;
+				Conn *conn;
+			};
+		private:
+			inline static void *WorkerThread( void *p ){
+				static_cast<RegScoreServer*>( p )->Work(); return NULL;
+			}
+			inline static void *ReportThread( void *p ){
+				static_cast<RegScoreServer*>( p )->Report(); return NULL;
+			}
+			inline static void *ReaderThread( void *p ){
+				ReaderArg *arg = static_cast<ReaderArg*>( p );
+				arg->server->ReadConn( arg->conn );
+				delete arg; return NULL;
+			}
+			// wait on cond for at most sec seconds
+			inline static void TimedWait( pthread_cond_t *cond, pthread_mutex_t *lock, double sec ){
+				timeval now;
+				gettimeofday( &now, NULL );
+				const double t = now.tv_sec + now.tv_usec * 1e-6 + sec;
+				timespec ts;
+				ts.tv_sec = static_cast<time_t>( t );
+				ts.tv_nsec = static_cast<long>( ( t - ts.tv_sec ) * 1e9 );
+				if( ts.tv_nsec >= 1000000000L ) ts.tv_nsec = 999999999L;
+				pthread_cond_timedwait( cond, lock, &ts );
+			}
+			// accept connections forever, each connection is read by a thread of its own
+			inline void Listen( void ){
+				const int lfd = socket( AF_INET, SOCK_STREAM, 0 );
+				utils::Assert( lfd >= 0, "RegScoreServer: fail to create socket" );
+				int one = 1;
+				setsockopt( lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one) );
+				sockaddr_in addr;
+				memset( &addr, 0, sizeof(addr) );
+				addr.sin_family = AF_INET;
+				addr.sin_addr.s_addr = htonl( INADDR_ANY );
+				addr.sin_port = htons( static_cast<unsigned short>( param.port ) );
+				utils::Assert( bind( lfd, (sockaddr*)&addr, sizeof(addr) ) == 0, "RegScoreServer: fail to bind port" );
+				utils::Assert( listen( lfd, 128 ) == 0, "RegScoreServer: fail to listen" );
+				if( !param.silent ) fprintf( stderr, "RegScoreServer: listening to port %d\n", param.port );
+				while( true ){
+					const int fd = accept( lfd, NULL, NULL );
+					if( fd < 0 ){
+						utils::Assert( errno == EINTR || errno == ECONNABORTED, "RegScoreServer: fail to accept" );
+						continue;
+					}
+					// responses are small, send them without delay
+					setsockopt( fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one) );
+					ReaderArg *arg = new ReaderArg();
+					arg->server = this; arg->conn = new Conn( fd, fd, true );
+					pthread_t reader;
+					utils::Assert( pthread_create( &reader, NULL, ReaderThread, arg ) == 0, "RegScoreServer: fail to start reader" );
+					pthread_detach( reader );
+				}
+			}
+			// read lines of connection until it ends, then release it
+			inline void ReadConn( Conn *conn ){
+				std::vector<char> buf( 1 << 16 );
+				size_t nleft = 0;
+				while( true ){
+					if( nleft == buf.size() ) buf.resize( buf.size() * 2 );
+					const ssize_t n = read( conn->fd_in, &buf[ nleft ], buf.size() - nleft );
+					if( n < 0 && errno == EINTR ) continue;
+					if( n <= 0 ) break;
+					const char *begin = &buf[0], *end = &buf[0] + nleft + n;
+					for( const char *p = begin + nleft; p != end; ++ p ){
+						if( *p != '\n' ) continue;
+						this->HandleLine( conn, begin, p );
+						begin = p + 1;
+					}
+					nleft = end - begin;
+					memmove( &buf[0], begin, nleft );
+				}
+				// the last line may have no newline, it is terminated for the parser
+				if( nleft != 0 ){
+					if( nleft == buf.size() ) buf.resize( nleft + 1 );
+					buf[ nleft ] = '\0';
+					this->HandleLine( conn, &buf[0], &buf[0] + nleft );
+				}
+				this->Release( conn );
+			}
+			// parse a request line and put it into queue, called by the reader of conn
+			inline void HandleLine( Conn *conn, const char *begin, const char *end ){
+				while( begin != end && LibSVMParser::IsSpace( *begin ) ) ++ begin;
+				while( end != begin && LibSVMParser::IsSpace( end[-1] ) ) -- end;
+				if( begin == end ) return;
+				pthread_mutex_lock( &conn->lock );
+				conn->ref ++;
+				pthread_mutex_unlock( &conn->lock );
+				const unsigned long long seq = conn->next_seq ++;
+				if( end - begin == 6 && !strncmp( begin, "!stats", 6 ) ){
+					this->Complete( conn, seq, this->Stats() + "#end\n" ); return;
+				}
+				Request *req = new Request();
+				req->conn = conn; req->seq = seq; req->arrive = utils::GetTime();
+				for( const char *p = begin; p != end; ){
+					const char *q = p, *colon = NULL;
+					for( ; q != end && !LibSVMParser::IsSpace( *q ); ++ q ){
+						if( *q == ':' && colon == NULL ) colon = q;
+					}
+					unsigned index; float value;
+					if( colon != NULL && LibSVMParser::ParseUInt( p, colon, index ) && LibSVMParser::ParseFloat( colon + 1, q, value ) ){
+						req->findex.push_back( index ); req->fvalue.push_back( value );
+					}else if( colon == NULL && p == begin ){
+						req->id.assign( p, q );
+					}else{
+						delete req;
+						this->Complete( conn, seq, "error invalid request\n" ); return;
+					}
+					for( p = q; p != end && LibSVMParser::IsSpace( *p ); ++ p );
+				}
+				pthread_mutex_lock( &qlock );
+				while( queue.size() >= (size_t)param.max_queue && !stop ){
+					pthread_cond_wait( &qspace, &qlock );
+				}
+				queue.push_back( req );
+				pthread_cond_signal( &qfill );
+				pthread_mutex_unlock( &qlock );
+			}
+			// record the response of request seq of conn, responses that are in order are written
+			inline void Complete( Conn *conn, unsigned long long seq, const std::string &resp ){
+				std::vector< std::pair<unsigned long long, std::string> > one( 1, std::make_pair( seq, resp ) );
+				this->Complete( conn, one );
+			}
+			// record responses of several requests of conn, the ones in order are written in one write
+			inline void Complete( Conn *conn, const std::vector< std::pair<unsigned long long, std::string> > &resp ){
+				pthread_mutex_lock( &conn->lock );
+				for( size_t i = 0; i < resp.size(); i ++ ){
+					conn->ready[ resp[i].first ] = resp[i].second;
+				}
+				std::string out;
+				std::map<unsigned long long, std::string>::iterator it;
+				while( ( it = conn->ready.find( conn->write_seq ) ) != conn->ready.end() ){
+					out += it->second;
+					conn->ready.erase( it );
+					conn->write_seq ++;
+				}
+				// writes of a connection are ordered by its lock
+				if( out.length() != 0 ) conn->Write( out );
+				pthread_mutex_unlock( &conn->lock );
+				for( size_t i = 0; i < resp.size(); i ++ ) this->Release( conn );
+			}
+			// drop a reference of conn, it is deleted when no reference is left
+			inline void Release( Conn *conn ){
+				pthread_mutex_lock( &conn->lock );
+				const bool last = -- conn->ref == 0;
+				pthread_mutex_unlock( &conn->lock );
+				if( last ) delete conn;
+			}
+			// loop of worker, take batches from queue and predict them
+			inline void Work( void ){
+				std::vector<Request*> batch;
+				booster::FMatrixS rows;
+				std::vector<float> preds;
+				std::vector<double> tqueue;
+				// dense block of the worker, sized by the model once and reused by all its batches
+				booster::CompiledForest::BlockScratch scratch;
+				const double window = param.batch_window_us * 1e-6;
+				while( true ){
+					pthread_mutex_lock( &qlock );
+					while( queue.size() == 0 && !stop ){
+						pthread_cond_wait( &qfill, &qlock );
+					}
+					// wait for the batch to fill, until the oldest row has waited the window
+					while( queue.size() != 0 && queue.size() < (size_t)param.max_batch && !stop ){
+						const double wait = queue.front()->arrive + window - utils::GetTime();
+						if( wait <= 0.0 ) break;
+						TimedWait( &qfill, &qlock, wait );
+					}
+					if( queue.size() == 0 ){
+						pthread_mutex_unlock( &qlock );
+						if( stop ) break; else continue;
+					}
+					const size_t n = std::min( queue.size(), (size_t)param.max_batch );
+					batch.assign( queue.begin(), queue.begin() + n );
+					queue.erase( queue.begin(), queue.begin() + n );
+					pthread_cond_broadcast( &qspace );
+					// let another worker collect the rest
+					if( queue.size() != 0 ) pthread_cond_signal( &qfill );
+					pthread_mutex_unlock( &qlock );
+					this->Predict( batch, rows, preds, tqueue, scratch );
+				}
+			}
+			// predict a batch and write the responses
+			inline void Predict( const std::vector<Request*> &batch, booster::FMatrixS &rows,
+								 std::vector<float> &preds, std::vector<double> &tqueue,
+								 booster::CompiledForest::BlockScratch &scratch ){
+				const double tstart = utils::GetTime();
+				rows.Clear();
+				for( size_t i = 0; i < batch.size(); i ++ ){
+					rows.AddRow( batch[i]->findex, batch[i]->fvalue );
+				}
+				preds.resize( batch.size() );
+				// the batch is predicted by the worker alone, the workers are the parallelism
+				model.PredictBatch( booster::FMatrixS::Image( rows ), batch.size(), &preds[0], 1, &scratch );
+				tqueue.resize( batch.size() );
+				char buf[ 64 ];
+				// rows of a connection are mostly next to each other in a batch, each run of them is written together
+				std::vector< std::pair<unsigned long long, std::string> > resp;
+				for( size_t i = 0; i < batch.size(); i ++ ){
+					const Request *req = batch[i];
+					snprintf( buf, sizeof(buf), "%g\n", preds[i] );
+					tqueue[i] = tstart - req->arrive;
+					resp.push_back( std::make_pair( req->seq, req->id.length() != 0 ? req->id + " " + buf : std::string( buf ) ) );
+					if( i + 1 == batch.size() || batch[ i + 1 ]->conn != req->conn ){
+						this->Complete( req->conn, resp ); resp.clear();
+					}
+				}
+				const double tend = utils::GetTime();
+				pthread_mutex_lock( &qlock );
+				num_request += batch.size(); num_batch ++;
+				for( size_t i = 0; i < batch.size(); i ++ ){
+					hist_queue.Add( tqueue[i] );
+					hist_total.Add( tend - batch[i]->arrive );
+				}
+				pthread_mutex_unlock( &qlock );
+				for( size_t i = 0; i < batch.size(); i ++ ) delete batch[i];
+			}
+			// loop of reporter, write statistics every stats_period seconds until the server stops
+			inline void Report( void ){
+				while( true ){
+					pthread_mutex_lock( &qlock );
+					if( !stop ) TimedWait( &qstop, &qlock, param.stats_period );
+					const bool done = stop;
+					pthread_mutex_unlock( &qlock );
+					if( done ) break;
+					this->WriteStats();
+				}
+			}
+			// write statistics to stats_out, through a temporal file, so readers never see a partial file
+			inline void WriteStats( void ){
+				const std::string s = this->Stats();
+				const std::string tmp = param.stats_out + ".tmp";
+				FILE *fo = utils::FopenCheck( tmp.c_str(), "w" );
+				fputs( s.c_str(), fo );
+				fclose( fo );
+				utils::Assert( rename( tmp.c_str(), param.stats_out.c_str() ) == 0, "RegScoreServer: fail to write statistics" );
+			}
+		private:
+			const ServerParam &param;
+			/*! \brief the model, and the memory of it when compiled in memory */
+			RegServingModel model;
+			std::vector<unsigned long long> model_data;
+			/*! \brief rows waiting for prediction, and the lock of queue and statistics */
+			std::deque<Request*> queue;
+			pthread_mutex_t qlock;
+			pthread_cond_t qfill, qspace, qstop;
+			bool stop;
+			/*! \brief statistics, protected by qlock */
+			unsigned long long num_request, num_batch;
+			LatencyHist hist_queue, hist_total;
+		};
+	};
+};
+#endif
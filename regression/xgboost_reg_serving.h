@@ -0,0 +1,96 @@
+#ifndef _XGBOOST_REG_SERVING_H_
+#define _XGBOOST_REG_SERVING_H_
+/*!
+* \file xgboost_reg_serving.h
+* \brief regression model for serving, loads the serving format saved by RegBoostLearner::SaveServing,
+*     predictions are the same as RegBoostLearner::Predict
+*/
+#include <vector>
+#include <cstring>
+#include "xgboost_regdata.h"
+#include "xgboost_reg_loss.h"
+#include "../booster/xgboost_serving.h"
+#include "../utils/xgboost_utils.h"
+
+namespace xgboost{
+	namespace regression{
+		/*! \brief parameters of regression saved with the forest in serving format */
+		struct ServingHead{
+			/*! \brief global bias, added to the sum of trees before transform */
+			float base_score;
+			/*! \brief type of loss function, decides the transform of prediction */
+			int loss_type;
+		};
+		/*! \brief regression model for serving */
+		class RegServingModel{
+		public:
+			/*!
+			* \brief map a model file in serving format
+			* \param fname name of the file
+			* \return whether the file is a valid regression model in serving format
+			*/
+			inline bool Load( const char *fname ){
+				if( !model.Load( fname ) ) return false;
+				return this->InitHead();
+			}
+			/*!
+			* \brief use a model in serving format from memory, the memory is not copied
+			* \param data start of model, aligned to 8 bytes, must be kept until the model is released
+			* \param size number of bytes of data
+			* \return whether data is a valid regression model in serving format
+			*/
+			inline bool LoadMemory( const void *data, size_t size ){
+				if( !model.LoadMemory( data, size ) ) return false;
+				return this->InitHead();
+			}
+			/*!
+			* \brief transformed prediction of a row
+			*   NOTE: this is not threadsafe
+			*/
+			inline float Predict( const booster::FMatrixS::Line &row ){
+				float p = model.Predict( row );
+				this->Transform( &p, 1 );
+				return p;
+			}
+			/*! \brief get the transformed predictions, given data */
+			inline void Predict( std::vector<float> &preds, const DMatrix &data ) const{
+				const int data_size = data.size();
+				preds.resize( data_size );
+				if( data_size == 0 ) return;
+				booster::FMatrixS::Image data_image( data.data, data.PagedRows() );
+				model.PredictBatch( data_image, data_size, &preds[0] );
+				this->Transform( &preds[0], data_size );
+			}
+			/*!
+			* \brief get the transformed predictions of rows [0,nrow) of feats, threadsafe for rows in memory
+			* \param nthread number of threads, 0 means default of openmp
+			* \param scratch scratch space kept by the caller to predict in the calling thread, NULL to use nthread threads
+			*/
+			inline void PredictBatch( const booster::FMatrixS::Image &feats, size_t nrow, float *out, int nthread = 0,
+									  booster::CompiledForest::BlockScratch *scratch = NULL ) const{
+				if( nrow == 0 ) return;
+				model.PredictBatch( feats, nrow, out, std::vector<unsigned>(), nthread, scratch );
+				this->Transform( out, static_cast<int>( nrow ) );
+			}
+		private:
+			inline bool InitHead( void ){
+				if( model.HeadSize() != sizeof(ServingHead) ){
+					model.Close(); return false;
+				}
+				memcpy( &head, model.Head(), sizeof(head) );
+				return true;
+			}
+			inline void Transform( float *preds, int n ) const{
+				switch( head.loss_type ){
+				case 0: LossPredTransform<SquareLoss>( preds, n, head.base_score ); break;
+				case 1: LossPredTransform<LogisticLoss>( preds, n, head.base_score ); break;
+				default: utils::Error("unknown loss_type");
+				}
+			}
+		private:
+			booster::ServingModel model;
+			ServingHead head;
+		};
+	};
+};
+#endif
@@ -8,6 +8,7 @@
 #include"xgboost_reg.h"
 #include"xgboost_regdata.h"
 #include"../utils/xgboost_string.h"
+#include"../utils/xgboost_zstream.h"
 
 using namespace xgboost::utils;
 namespace xgboost{
@@ -46,8 +47,11 @@ namespace xgboost{
 					xgboost::regression::DMatrix test_data;
 					test_data.LoadText(test_param.test_paths[i].c_str());
 					sscanf(model_path,"%s/final.model",test_param.model_dir_path);
-					FileStream fin(fopen(model_path,"r"));
-					reg_boost_learner->LoadModel(fin);
+					FileStream fin(fopen(model_path,"rb"), FileStream::kBufferSize);
+					{// models saved with model_compress are decompressed, plain models are read as they are
+						ZInStream zin(fin);
+						reg_boost_learner->LoadModel(zin);
+					}
 					fin.Close();
 					reg_boost_learner->Predict(preds,test_data);
 				}
@@ -8,6 +8,7 @@
 #include"xgboost_reg.h"
 #include"xgboost_regdata.h"
 #include"../utils/xgboost_string.h"
+#include"../utils/xgboost_zstream.h"
 
 using namespace xgboost::utils;
 
@@ -52,14 +53,28 @@ namespace xgboost{
 
 				//begin training
 				reg_boost_learner->InitTrainer();
+				//resume from the checkpoint if there is one
+				xgboost::booster::CheckpointWriter checkpoint;
+				int start_iteration = 1;
+				if(train_param.checkpoint.length() != 0){
+					const int done = reg_boost_learner->LoadCheckpoint(train_param.checkpoint.c_str());
+					checkpoint.Init(train_param.checkpoint.c_str(), done != 0);
+					if(done != 0 && !silent) printf("resume from checkpoint of iteration %d\n", done);
+					start_iteration = done + 1;
+				}
 				char suffix[256];
-				for(int i = 1; i <= train_param.boost_iterations; i++){
+				for(int i = start_iteration; i <= train_param.boost_iterations; i++){
 					reg_boost_learner->UpdateOneIter(i);
 					if(train_param.save_period != 0 && i % train_param.save_period == 0){
 						sscanf(suffix,"%d.model",i);
 						SaveModel(suffix);
 					}
+					if(train_param.checkpoint.length() != 0 && train_param.checkpoint_period > 0 &&
+						i % train_param.checkpoint_period == 0){
+						reg_boost_learner->SaveCheckpoint(checkpoint, i);
+					}
 				}
+				checkpoint.Close();
 
 				//save the final round model
 				SaveModel("final.model");
@@ -71,9 +86,15 @@ namespace xgboost{
 				char model_path[256];
 				//save the final round model
 				sscanf(model_path,"%s/%s",train_param.model_dir_path,suffix);
-				FILE* file = fopen(model_path,"w");
-				FileStream fin(file);
-				reg_boost_learner->SaveModel(fin);
+				FILE* file = fopen(model_path,"wb");
+				FileStream fin(file, FileStream::kBufferSize);
+				if(train_param.model_compress != 0){
+					ZOutStream zout(fin, train_param.model_compress);
+					reg_boost_learner->SaveModel(zout);
+					zout.Finish();
+				}else{
+					reg_boost_learner->SaveModel(fin);
+				}
 				fin.Close();
 			}
 
@@ -96,6 +117,20 @@ namespace xgboost{
 				/* \brief the names of the validation data sets */
 				std::vector<std::string> validation_data_names;
 
+				/* \brief prefix of checkpoint files, training resumes from the checkpoint when it exists, empty means no checkpoint */
+				std::string checkpoint;
+
+				/* \brief the period to checkpoint the model, checkpoints are written in background */
+				int checkpoint_period;
+
+				/* \brief zlib level to compress the saved models, 0 means no compression */
+				int model_compress;
+
+				TrainParam( void ){
+					checkpoint_period = 1;
+					model_compress = 0;
+				}
+
 				/*! 
 				* \brief set parameters from outside 
 				* \param name name of the parameter
@@ -106,6 +141,9 @@ namespace xgboost{
 					if( !strcmp("save_period", name ) )   save_period = atoi( val );
 					if( !strcmp("train_path",  name ) ) train_path = val;
 					if( !strcmp("model_dir_path", name ) ) model_dir_path = val;
+					if( !strcmp("checkpoint", name ) ) checkpoint = val;
+					if( !strcmp("checkpoint_period", name ) ) checkpoint_period = atoi( val );
+					if( !strcmp("model_compress", name ) ) model_compress = atoi( val );
 					if( !strcmp("validation_paths",  name) ) {
 						validation_data_paths = StringProcessing::split(val,';');
 					}
@@ -11,10 +11,15 @@
  * \author Kailong Chen: chenkl198812@gmail.com, Tianqi Chen: tianqi.tchen@gmail.com
  */
 #include <cstdio>
+#include <cstring>
 #include <vector>
 #include "../booster/xgboost_data.h"
+#include "../booster/xgboost_data_compressed.h"
 #include "../utils/xgboost_utils.h"
 #include "../utils/xgboost_stream.h"
+#include "../utils/xgboost_mmap.h"
+#include "../utils/xgboost_zstream.h"
+#include "xgboost_libsvm_parser.h"
 
 namespace xgboost{
     namespace regression{
@@ -27,6 +32,10 @@ namespace xgboost{
             booster::FMatrixS data;
             /*! \brief label of each instance */
             std::vector<float> labels;
+            /*! \brief feature data paged on disk, used instead of data when opened, see LoadTextPaged */
+            booster::FMatrixPaged paged;
+            /*! \brief feature data compressed in memory, used instead of data and paged when built, see Compress */
+            booster::FMatrixCompressed compressed;
         public:
             /*! \brief default constructor */
             DMatrix( void ){}
@@ -38,58 +47,93 @@ namespace xgboost{
 			}
 
             /*! 
-             * \brief load from text file 
+             * \brief load from text file, the file is parsed in parallel, see xgboost_libsvm_parser.h
              * \param fname name of text data
              * \param silent whether print information or not
              */            
             inline void LoadText( const char* fname, bool silent = false ){
-                data.Clear();
+                data.Clear(); mmap_file.Close(); paged.Close(); compressed.Clear();
                 FILE* file = utils::FopenCheck( fname, "r" );
-                float label; bool init = true;
-                char tmp[ 1024 ];
-                std::vector<booster::bst_uint> findex;
-                std::vector<booster::bst_float> fvalue;
-                
-                while( fscanf( file, "%s", tmp ) == 1 ){
-                    unsigned index; float value;
-                    if( sscanf( tmp, "%u:%f", &index, &value ) == 2 ){
-                        findex.push_back( index ); fvalue.push_back( value );
-                    }else{
-                        if( !init ){
-                            labels.push_back( label );
-                            data.AddRow( findex, fvalue );
-                        }
-                        findex.clear(); fvalue.clear();
-                        utils::Assert( sscanf( tmp, "%f", &label ) == 1, "invalid format" );
-                        init = false;
-                    }
-                }
-                if( init ){
-                    labels.push_back( label );
-                    data.AddRow( findex, fvalue );
-                }
+                LibSVMParser parser( data, labels );
+                parser.Load( file );
+                fclose(file);
                 
                 this->UpdateInfo();
                 if( !silent ){
                     printf("%ux%u matrix with %lu entries is loaded from %s\n", 
                            (unsigned)labels.size(), num_feature, (unsigned long)data.NumEntry(), fname );
                 }
+            }
+            /*! 
+             * \brief load from text file, features are written to pages on disk, only labels are kept in memory,
+             *        set paged.SetParam( "page_size" / "page_cache" ) before loading to control the tradeoff of RAM and IO
+             * \param fname name of text data
+             * \param page_file name of file to store the pages
+             * \param silent whether print information or not
+             */            
+            inline void LoadTextPaged( const char* fname, const char *page_file, bool silent = false ){
+                data.Clear(); mmap_file.Close(); compressed.Clear();
+                FILE* file = utils::FopenCheck( fname, "r" );
+                paged.InitWrite( page_file );
+                LibSVMParser parser( data, labels, &paged );
+                parser.Load( file );
                 fclose(file);
+                paged.FinishWrite();
+                data.Clear();
+                this->num_feature = paged.NumCol();
+                if( !silent ){
+                    printf("%ux%u matrix with %lu entries is loaded from %s into %lu pages\n", 
+                           (unsigned)labels.size(), num_feature, (unsigned long)paged.NumEntry(), fname,
+                           (unsigned long)paged.NumPage() );
+                }
+            }
+            /*! 
+             * \brief compress the features in memory, the original features and pages are released,
+             *        set compressed.SetParam( "compress_block" ) before to control the size of blocks
+             * \param silent whether print information or not
+             */
+            inline void Compress( bool silent = false ){
+                compressed.Build( data, paged.IsOpen() ? &paged : NULL );
+                data.Clear(); mmap_file.Close(); paged.Close();
+                if( !silent ){
+                    printf("%lu entries are compressed into %lu bytes in %lu blocks\n", 
+                           (unsigned long)compressed.NumEntry(), (unsigned long)compressed.Bytes(),
+                           (unsigned long)compressed.NumPage() );
+                }
+            }
+            /*! \brief paged or compressed features, NULL if features are in memory */
+            inline const booster::FMatrixS::IPagedRows *PagedRows( void ) const{
+                if( compressed.IsReady() ) return &compressed;
+                return paged.IsOpen() ? &paged : NULL;
             }
             /*! 
-             * \brief load from binary file 
+             * \brief load from binary file, the file is memory mapped and feature data is used in place,
+             *        so loading is fast and the page cache is shared by processes using the same file,
+             *        the file must not be modified while the matrix is in use;
+             *        a compressed file, see SaveBinary, is decompressed into memory instead
              * \param fname name of binary data
              * \param silent whether print information or not
-             * \return whether loading is success
+             * \return whether loading is success, false if file does not exist or is not in current binary format
              */
             inline bool LoadBinary( const char* fname, bool silent = false ){
-                FILE *fp = fopen64( fname, "rb" );
-                if( fp == NULL ) return false;                
-                utils::FileStream fs( fp );
-                data.LoadBinary( fs );
-                labels.resize( data.NumRow() );
-                utils::Assert( fs.Read( &labels[0], sizeof(float) * data.NumRow() ) != 0, "DMatrix LoadBinary" );
-                fs.Close();
+                data.Clear(); paged.Close(); compressed.Clear();
+                if( !mmap_file.Open( fname ) ) return false;
+                if( mmap_file.Size() >= sizeof(utils::kZStreamMagic) &&
+                    memcmp( mmap_file.Data(), utils::kZStreamMagic, sizeof(utils::kZStreamMagic) ) == 0 ){
+                    mmap_file.Close();
+                    if( !this->LoadCompressed( fname ) ) return false;
+                }else{
+                    const size_t nbyte = data.LoadView( mmap_file.Data(), mmap_file.Size() );
+                    if( nbyte == 0 || nbyte + sizeof(float) * data.NumRow() > mmap_file.Size() ){
+                        data.Clear(); mmap_file.Close();
+                        return false;
+                    }
+                    // labels are small compared to features, they are copied so that they can be modified
+                    labels.resize( data.NumRow() );
+                    if( labels.size() != 0 ){
+                        memcpy( &labels[0], static_cast<const char*>( mmap_file.Data() ) + nbyte, sizeof(float) * labels.size() );
+                    }
+                }
                 this->UpdateInfo();
                 if( !silent ){
                     printf("%ux%u matrix with %lu entries is loaded from %s\n", 
@@ -101,11 +145,18 @@ namespace xgboost{
              * \brief save to binary file
              * \param fname name of binary data
              * \param silent whether print information or not
+             * \param compress_level 0 to save plain file that is mapped by LoadBinary,
+             *        1 to 9 to save compressed file with the level of zlib, smaller to transfer but decompressed on load
              */
-            inline void SaveBinary( const char* fname, bool silent = false ){
-                utils::FileStream fs( utils::FopenCheck( fname, "wb" ) );
-                data.SaveBinary( fs );
-                fs.Write( &labels[0], sizeof(float) * data.NumRow() );
+            inline void SaveBinary( const char* fname, bool silent = false, int compress_level = 0 ){
+                utils::FileStream fs( utils::FopenCheck( fname, "wb" ), utils::FileStream::kBufferSize );
+                if( compress_level == 0 ){
+                    this->SaveBinary( fs );
+                }else{
+                    utils::ZOutStream zs( fs, compress_level );
+                    this->SaveBinary( zs );
+                    zs.Finish();
+                }
                 fs.Close();
                 if( !silent ){
                     printf("%ux%u matrix with %lu entries is saved to %s\n", 
@@ -118,17 +169,77 @@ namespace xgboost{
              *        and try to create a buffer file 
              * \param fname name of binary data
              * \param silent whether print information or not
+             * \param compress_level compression level of the created buffer file, see SaveBinary
              * \return whether loading is success
              */            
-            inline void CacheLoad( const char *fname, bool silent = false ){
+            inline void CacheLoad( const char *fname, bool silent = false, int compress_level = 0 ){
                 char bname[ 1024 ];
                 sprintf( bname, "%s.buffer", fname );
                 if( !this->LoadBinary( bname, silent ) ){
                     this->LoadText( fname, silent );
-                    this->SaveBinary( fname, silent );
+                    this->SaveBinary( bname, silent, compress_level );
                 }                
             }
+            /*!
+             * \brief keep the shard of a worker in distributed training, only in memory data can be sharded
+             * \param rank rank of the worker
+             * \param nworker number of workers
+             * \param by_col false keeps rows i with i % nworker == rank, true keeps all rows with features f % nworker == rank
+             */
+            inline void Shard( int rank, int nworker, bool by_col ){
+                utils::Assert( this->PagedRows() == NULL, "only in memory data can be sharded" );
+                booster::FMatrixS shard;
+                std::vector<float> shard_labels;
+                std::vector<booster::bst_uint> findex;
+                std::vector<booster::bst_float> fvalue;
+                for( size_t i = 0; i < data.NumRow(); i ++ ){
+                    if( !by_col && i % nworker != (size_t)rank ) continue;
+                    booster::FMatrixS::Line sp = data[i];
+                    if( by_col ){
+                        findex.clear(); fvalue.clear();
+                        for( unsigned j = 0; j < sp.len; j ++ ){
+                            if( sp.findex[j] % nworker != (unsigned)rank ) continue;
+                            findex.push_back( sp.findex[j] ); fvalue.push_back( sp.fvalue[j] );
+                        }
+                        sp.len = static_cast<booster::bst_uint>( findex.size() );
+                        sp.findex = findex.size() == 0 ? NULL : &findex[0];
+                        sp.fvalue = fvalue.size() == 0 ? NULL : &fvalue[0];
+                    }
+                    shard.AddRow( sp );
+                    shard_labels.push_back( labels[i] );
+                }
+                // num_feature is kept, it is the same for all workers
+                data.Clear(); mmap_file.Close();
+                data = shard;
+                labels.swap( shard_labels );
+            }
+        private:
+            /*! \brief mapped binary file, feature data refers to it after LoadBinary */
+            utils::MMapFile mmap_file;
         private:
+            /*! \brief write features and labels to stream */
+            inline void SaveBinary( utils::IStream &fo ){
+                data.SaveBinary( fo );
+                if( labels.size() != 0 ){
+                    fo.Write( &labels[0], sizeof(float) * labels.size() );
+                }
+            }
+            /*! \brief read features and labels of compressed binary file into memory */
+            inline bool LoadCompressed( const char *fname ){
+                FILE *fi = fopen64( fname, "rb" );
+                if( fi == NULL ) return false;
+                utils::FileStream fs( fi, utils::FileStream::kBufferSize );
+                utils::ZInStream zs( fs );
+                data.LoadBinary( zs );
+                labels.resize( data.NumRow() );
+                const size_t nbyte = sizeof(float) * labels.size();
+                const bool ret = nbyte == 0 || zs.Read( &labels[0], nbyte ) == nbyte;
+                fs.Close();
+                if( !ret ){
+                    data.Clear(); labels.clear();
+                }
+                return ret;
+            }
             /*! \brief update num_feature info */
             inline void UpdateInfo( void ){
                 this->num_feature = 0;
@@ -66,6 +66,24 @@ namespace xgboost{
                 }
                 rptr[ row_id + 1 ] += nelem;
             }
+            /*!
+             * \brief optional step between 2 and 3, only when aclist is used:
+             *        remove the budget of active rows r with keep[r] == 0, no element can be pushed to removed rows
+             * \param keep whether to keep each row, indexed by row id
+             */
+            inline void DropRows( const std::vector<char> &keep ){
+                Assert( UseAcList, "this function can only be called use AcList" );
+                size_t top = 0;
+                for( size_t i = 0; i < aclist.size(); i ++ ){
+                    const size_t ridx = aclist[ i ];
+                    if( keep[ ridx ] != 0 ){
+                        aclist[ top ++ ] = ridx;
+                    }else{
+                        rptr[ ridx + 1 ] = 0;
+                    }
+                }
+                aclist.resize( top );
+            }
             /*! \brief step 3: initialize the necessary storage */
             inline void InitStorage( void ){
                 // initialize rptr to be beginning of each segment
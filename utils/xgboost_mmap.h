@@ -0,0 +1,73 @@
+#ifndef _XGBOOST_MMAP_H_
+#define _XGBOOST_MMAP_H_
+/*!
+ * \file xgboost_mmap.h
+ * \brief read-only memory mapped file, pages are loaded lazily and shared between processes
+ */
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace xgboost{
+    namespace utils{
+        /*! \brief read-only memory mapping of a whole file */
+        class MMapFile{
+        public:
+            /*! \brief constructor */
+            MMapFile( void ){
+                dptr = NULL; dsize = 0;
+            }
+            /*! \brief destructor, unmap the file */
+            ~MMapFile( void ){
+                this->Close();
+            }
+            /*!
+             * \brief map a file, previous mapping is released
+             * \param fname name of the file
+             * \return whether mapping is success, an empty file can not be mapped
+             */
+            inline bool Open( const char *fname ){
+                this->Close();
+                int fd = open( fname, O_RDONLY );
+                if( fd < 0 ) return false;
+                struct stat st;
+                if( fstat( fd, &st ) != 0 || st.st_size == 0 ){
+                    close( fd ); return false;
+                }
+                void *p = mmap( NULL, static_cast<size_t>( st.st_size ), PROT_READ, MAP_SHARED, fd, 0 );
+                // the mapping stays valid after the descriptor is closed
+                close( fd );
+                if( p == MAP_FAILED ) return false;
+                dptr = p; dsize = static_cast<size_t>( st.st_size );
+                return true;
+            }
+            /*! \brief release the mapping */
+            inline void Close( void ){
+                if( dptr != NULL ){
+                    munmap( dptr, dsize );
+                    dptr = NULL; dsize = 0;
+                }
+            }
+            /*! \brief start of mapped content, NULL if nothing is mapped */
+            inline const void *Data( void ) const{
+                return dptr;
+            }
+            /*! \brief size of mapped content in bytes */
+            inline size_t Size( void ) const{
+                return dsize;
+            }
+        private:
+            // mapping can not be copied
+            MMapFile( const MMapFile &src );
+            void operator=( const MMapFile &src );
+        private:
+            /*! \brief mapped content */
+            void *dptr;
+            /*! \brief size of mapped content */
+            size_t dsize;
+        };
+    };
+};
+#endif
@@ -0,0 +1,17 @@
+#ifndef _XGBOOST_OMP_H_
+#define _XGBOOST_OMP_H_
+/*!
+ * \file xgboost_omp.h
+ * \brief header to handle OpenMP compatibility issues
+ *        when OpenMP is not available, the code compiles to single thread
+ */
+#if defined(_OPENMP)
+#include <omp.h>
+#else
+#warning "OpenMP is not available, compile to single thread code"
+inline int omp_get_thread_num( void ) { return 0; }
+inline int omp_get_num_threads( void ) { return 1; }
+inline int omp_get_max_threads( void ) { return 1; }
+inline void omp_set_num_threads( int nthread ) {}
+#endif
+#endif
@@ -0,0 +1,195 @@
+#ifndef _XGBOOST_QUANTILE_H_
+#define _XGBOOST_QUANTILE_H_
+/*!
+ * \file xgboost_quantile.h
+ * \brief weighted quantile summary and sketch, used to propose candidate split points
+ *        the summary keeps, for each kept value, the bounds of its rank in weighted sense,
+ *        summaries can be combined and pruned, so a sketch of bounded size can be built from a stream
+ */
+#include <vector>
+#include <algorithm>
+#include "xgboost_utils.h"
+
+namespace xgboost{
+    namespace utils{
+        /*! \brief summary of weighted quantiles of a data stream */
+        struct WQSummary{
+            /*! \brief an entry in the summary */
+            struct Entry{
+                /*! \brief lower bound of the sum of weights of data strictly smaller than value */
+                double rmin;
+                /*! \brief upper bound of the sum of weights of data smaller or equal to value */
+                double rmax;
+                /*! \brief lower bound of the weight of value */
+                double wmin;
+                /*! \brief the value of the entry */
+                float  value;
+                /*! \brief default constructor */
+                Entry( void ){}
+                /*! \brief constructor */
+                Entry( double rmin, double rmax, double wmin, float value ){
+                    this->rmin = rmin; this->rmax = rmax; this->wmin = wmin; this->value = value;
+                }
+                /*! \brief lower bound of rank of the value right after this one */
+                inline double rmin_next( void ) const{
+                    return rmin + wmin;
+                }
+                /*! \brief upper bound of rank of the value right before this one */
+                inline double rmax_prev( void ) const{
+                    return rmax - wmin;
+                }
+            };
+            /*! \brief entries of the summary, sorted by value, values are unique */
+            std::vector<Entry> data;
+        public:
+            /*!
+             * \brief set the summary to be exact summary of a set of weighted values
+             * \param qdata pairs of (value,weight), must be sorted by value
+             */
+            inline void SetFromSorted( const std::vector< std::pair<float,double> > &qdata ){
+                data.resize( 0 );
+                double wsum = 0.0;
+                for( size_t i = 0; i < qdata.size(); ){
+                    size_t j = i + 1;
+                    double w = qdata[i].second;
+                    while( j < qdata.size() && qdata[j].first == qdata[i].first ){
+                        w += qdata[j].second; j ++;
+                    }
+                    data.push_back( Entry( wsum, wsum + w, w, qdata[i].first ) );
+                    wsum += w; i = j;
+                }
+            }
+            /*!
+             * \brief set the summary to be combination of two summaries
+             * \param sa first summary
+             * \param sb second summary
+             */
+            inline void SetCombine( const WQSummary &sa, const WQSummary &sb ){
+                if( sa.data.size() == 0 ){ data = sb.data; return; }
+                if( sb.data.size() == 0 ){ data = sa.data; return; }
+                const std::vector<Entry> &a = sa.data, &b = sb.data;
+                data.resize( 0 );
+                // rmin of value right after last processed entry in a and b
+                double armin = 0.0, brmin = 0.0;
+                size_t i = 0, j = 0;
+                while( i < a.size() && j < b.size() ){
+                    if( a[i].value == b[j].value ){
+                        data.push_back( Entry( a[i].rmin + b[j].rmin, a[i].rmax + b[j].rmax,
+                                               a[i].wmin + b[j].wmin, a[i].value ) );
+                        armin = a[i].rmin_next(); brmin = b[j].rmin_next();
+                        i ++; j ++;
+                    }else if( a[i].value < b[j].value ){
+                        data.push_back( Entry( a[i].rmin + brmin, a[i].rmax + b[j].rmax_prev(),
+                                               a[i].wmin, a[i].value ) );
+                        armin = a[i].rmin_next(); i ++;
+                    }else{
+                        data.push_back( Entry( b[j].rmin + armin, b[j].rmax + a[i].rmax_prev(),
+                                               b[j].wmin, b[j].value ) );
+                        brmin = b[j].rmin_next(); j ++;
+                    }
+                }
+                for( ; i < a.size(); i ++ ){
+                    data.push_back( Entry( a[i].rmin + brmin, a[i].rmax + b.back().rmax, a[i].wmin, a[i].value ) );
+                }
+                for( ; j < b.size(); j ++ ){
+                    data.push_back( Entry( b[j].rmin + armin, b[j].rmax + a.back().rmax, b[j].wmin, b[j].value ) );
+                }
+            }
+            /*!
+             * \brief set the summary to be pruned version of src,
+             *        the first and last entry are always kept, the others are picked closest to even ranks
+             * \param src source summary
+             * \param maxsize maximum number of entries kept
+             */
+            inline void SetPrune( const WQSummary &src, size_t maxsize ){
+                if( src.data.size() <= maxsize ){ data = src.data; return; }
+                const std::vector<Entry> &s = src.data;
+                data.resize( 0 );
+                data.push_back( s[0] );
+                if( maxsize < 2 ) return;
+                const double range = s.back().rmin + s.back().rmax - s[0].rmin - s[0].rmax;
+                size_t i = 0;
+                for( size_t k = 1; k + 1 < maxsize; k ++ ){
+                    // target of rmin + rmax
+                    const double dx2 = s[0].rmin + s[0].rmax + range * k / ( maxsize - 1 );
+                    while( i + 2 < s.size() && s[i+1].rmin + s[i+1].rmax < dx2 ) i ++;
+                    // pick the closer one in s[i], s[i+1]
+                    size_t c = i;
+                    if( dx2 - s[i].rmin - s[i].rmax > s[i+1].rmin + s[i+1].rmax - dx2 ) c = i + 1;
+                    if( c != 0 && c + 1 != s.size() && s[c].value != data.back().value ){
+                        data.push_back( s[c] );
+                    }
+                }
+                data.push_back( s.back() );
+            }
+        };
+        /*!
+         * \brief streaming sketch of weighted quantiles,
+         *        data are buffered, buffers are turned into summaries and merged in a binary counter way,
+         *        so each stored summary is of bounded size, and the error grows logarithmically with data size
+         */
+        class WQuantileSketch{
+        public:
+            /*! \brief constructor */
+            WQuantileSketch( void ){ limit_size = 256; }
+            /*!
+             * \brief initialize the sketch
+             * \param limit_size maximum size of each summary kept in the sketch
+             */
+            inline void Init( size_t limit_size ){
+                this->limit_size = limit_size;
+                buffer.resize( 0 ); level.resize( 0 );
+            }
+            /*!
+             * \brief add a weighted value to the sketch
+             * \param value value of the data
+             * \param weight weight of the data
+             */
+            inline void Push( float value, double weight ){
+                buffer.push_back( std::make_pair( value, weight ) );
+                if( buffer.size() >= limit_size ) this->FlushBuffer();
+            }
+            /*!
+             * \brief get summary of all data pushed
+             * \param out the output summary
+             * \param maxsize maximum size of output summary
+             */
+            inline void GetSummary( WQSummary &out, size_t maxsize ){
+                this->FlushBuffer();
+                WQSummary sum, tmp;
+                for( size_t i = 0; i < level.size(); i ++ ){
+                    tmp.SetCombine( sum, level[i] );
+                    sum.data.swap( tmp.data );
+                }
+                out.SetPrune( sum, maxsize );
+            }
+        private:
+            // turn buffer into summary and put it into levels
+            inline void FlushBuffer( void ){
+                if( buffer.size() == 0 ) return;
+                std::sort( buffer.begin(), buffer.end() );
+                WQSummary s, tmp;
+                tmp.SetFromSorted( buffer );
+                s.SetPrune( tmp, limit_size );
+                buffer.resize( 0 );
+                for( size_t i = 0; ; i ++ ){
+                    if( i == level.size() ) level.push_back( WQSummary() );
+                    if( level[i].data.size() == 0 ){
+                        level[i].data.swap( s.data ); return;
+                    }
+                    tmp.SetCombine( level[i], s );
+                    s.SetPrune( tmp, limit_size );
+                    level[i].data.resize( 0 );
+                }
+            }
+        private:
+            /*! \brief maximum size of each summary */
+            size_t limit_size;
+            /*! \brief buffered data that are not summarized yet */
+            std::vector< std::pair<float,double> > buffer;
+            /*! \brief level[i] is summary of 2^i buffers, or empty */
+            std::vector<WQSummary> level;
+        };
+    };
+};
+#endif
@@ -2,9 +2,15 @@
 #define _XGBOOST_STREAM_H_
 
 #include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include "xgboost_utils.h"
 /*!
  * \file xgboost_stream.h
  * \brief general stream interface for serialization
+ *        FileStream reads and writes a FILE, MemoryStream reads and writes a string in memory;
+ *        see xgboost_zstream.h for compressed stream
  * \author Tianqi Chen: tianqi.tchen@gmail.com
  */
 namespace xgboost{
@@ -18,7 +24,7 @@ namespace xgboost{
              * \brief read data from stream
              * \param ptr pointer to memory buffer
              * \param size size of block
-             * \return usually is the size of data readed
+             * \return number of bytes read, less than size only when the stream ends or fails
              */
             virtual size_t Read( void *ptr, size_t size ) = 0;        
             /*! 
@@ -36,19 +42,57 @@ namespace xgboost{
         private:
             FILE *fp;
         public:        
+            /*! \brief size of stdio buffer of model and data files, large blocks keep the number of system calls low on network file systems */
+            static const size_t kBufferSize = 4 << 20;
             FileStream( FILE *fp ){
                 this->fp = fp;
             }
+            /*!
+             * \brief constructor that sets the stdio buffer of the file, must be called before any i/o on the file
+             * \param fp the file
+             * \param buffer_size size of stdio buffer in bytes, large buffer reduces the number of system calls
+             */
+            FileStream( FILE *fp, size_t buffer_size ){
+                this->fp = fp;
+                setvbuf( fp, NULL, _IOFBF, buffer_size );
+            }
             virtual size_t Read( void *ptr, size_t size ){
-                return fread( ptr, size, 1, fp );
+                // fread stops early only at end of file or error
+                return fread( ptr, 1, size, fp );
             }
             virtual void Write( const void *ptr, size_t size ){
-                fwrite( ptr, size, 1, fp );
+                utils::Assert( size == 0 || fwrite( ptr, size, 1, fp ) == 1, "FileStream: fail to write" );
             }
             inline void Close( void ){
-                fclose( fp );
+                utils::Assert( fclose( fp ) == 0, "FileStream: fail to close" );
             }
         };
+
+        /*!
+         * \brief stream on a string in memory, writes append to the string,
+         *        reads start from the beginning and advance to the end of the string
+         */
+        class MemoryStream: public IStream{
+        public:
+            /*! \brief constructor, the string must outlive the stream */
+            MemoryStream( std::string &data ):data( data ){
+                pos = 0;
+            }
+            virtual size_t Read( void *ptr, size_t size ){
+                const size_t n = std::min( size, data.length() - pos );
+                if( n != 0 ) memcpy( ptr, data.data() + pos, n );
+                pos += n;
+                return n;
+            }
+            virtual void Write( const void *ptr, size_t size ){
+                data.append( static_cast<const char*>( ptr ), size );
+            }
+        private:
+            /*! \brief content of the stream */
+            std::string &data;
+            /*! \brief read position */
+            size_t pos;
+        };
     };
 };
 #endif
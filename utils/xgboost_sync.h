@@ -0,0 +1,107 @@
+#ifndef _XGBOOST_SYNC_H_
+#define _XGBOOST_SYNC_H_
+/*!
+ * \file xgboost_sync.h
+ * \brief synchronization between workers in distributed training, each worker holds a shard of the rows,
+ *        the workers exchange gradient statistics so that all of them build the same model
+ *        the MPI engine is compiled when XGBOOST_USE_MPI is defined, e.g. mpicxx -DXGBOOST_USE_MPI
+ */
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include "xgboost_utils.h"
+#ifdef XGBOOST_USE_MPI
+#include <mpi.h>
+#endif
+
+namespace xgboost{
+    /*! \brief namespace of synchronization between workers */
+    namespace sync{
+        /*!
+         * \brief interface of synchronization engine, the calls are collective:
+         *        every worker must make the same sequence of calls with the same sizes
+         */
+        class ISync{
+        public:
+            /*! \brief rank of current worker, in [0, GetWorldSize()) */
+            virtual int GetRank( void ) const = 0;
+            /*! \brief number of workers */
+            virtual int GetWorldSize( void ) const = 0;
+            /*!
+             * \brief sum the buffers of all workers, the result is bitwise identical in every worker
+             * \param buf buffer of n values, replaced by the sum
+             * \param n number of values
+             */
+            virtual void AllreduceSum( double *buf, size_t n ) = 0;
+            /*!
+             * \brief broadcast a buffer from root to all workers
+             * \param buf buffer of size bytes, input in root and output in the others
+             * \param size number of bytes
+             * \param root rank of the sender
+             */
+            virtual void Broadcast( void *buf, size_t size, int root ) = 0;
+            /*!
+             * \brief gather a buffer of same size from every worker
+             * \param in buffer of size bytes in current worker
+             * \param size number of bytes of each worker
+             * \param out output of size * GetWorldSize() bytes, buffer of worker k is at out + k * size
+             */
+            virtual void Allgather( const void *in, size_t size, void *out ) = 0;
+        public:
+            /*! \brief virtual destructor */
+            virtual ~ISync( void ){}
+        };
+
+#ifdef XGBOOST_USE_MPI
+        /*! \brief synchronization engine over MPI, MPI_Init is done by the caller */
+        class SyncMPI : public ISync{
+        public:
+            /*!
+             * \brief constructor
+             * \param comm communicator of the workers
+             */
+            SyncMPI( MPI_Comm comm = MPI_COMM_WORLD ):comm( comm ){}
+            virtual int GetRank( void ) const{
+                int rank; MPI_Comm_rank( comm, &rank );
+                return rank;
+            }
+            virtual int GetWorldSize( void ) const{
+                int size; MPI_Comm_size( comm, &size );
+                return size;
+            }
+            virtual void AllreduceSum( double *buf, size_t n ){
+                // reduce to root then broadcast, MPI_Allreduce does not promise the same result in every worker
+                for( size_t i = 0; i < n; i += MaxChunk() ){
+                    const int len = static_cast<int>( std::min( n - i, MaxChunk() ) );
+                    if( this->GetRank() == 0 ){
+                        MPI_Reduce( MPI_IN_PLACE, buf + i, len, MPI_DOUBLE, MPI_SUM, 0, comm );
+                    }else{
+                        MPI_Reduce( buf + i, NULL, len, MPI_DOUBLE, MPI_SUM, 0, comm );
+                    }
+                    MPI_Bcast( buf + i, len, MPI_DOUBLE, 0, comm );
+                }
+            }
+            virtual void Broadcast( void *buf, size_t size, int root ){
+                char *p = static_cast<char*>( buf );
+                for( size_t i = 0; i < size; i += MaxChunk() ){
+                    MPI_Bcast( p + i, static_cast<int>( std::min( size - i, MaxChunk() ) ), MPI_BYTE, root, comm );
+                }
+            }
+            virtual void Allgather( const void *in, size_t size, void *out ){
+                utils::Assert( size <= MaxChunk(), "SyncMPI: Allgather buffer too large" );
+                if( size == 0 ) return;
+                MPI_Allgather( const_cast<void*>( in ), static_cast<int>( size ), MPI_BYTE,
+                               out, static_cast<int>( size ), MPI_BYTE, comm );
+            }
+        private:
+            /*! \brief maximum number of elements in one MPI call, counts of MPI are int */
+            inline static size_t MaxChunk( void ){
+                return static_cast<size_t>( INT_MAX );
+            }
+            /*! \brief communicator */
+            MPI_Comm comm;
+        };
+#endif
+    };
+};
+#endif
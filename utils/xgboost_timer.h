@@ -0,0 +1,26 @@
+#ifndef _XGBOOST_TIMER_H_
+#define _XGBOOST_TIMER_H_
+/*!
+ * \file xgboost_timer.h
+ * \brief wall clock timer for benchmarks and training statistics
+ */
+#include <time.h>
+#include <sys/time.h>
+
+namespace xgboost{
+    namespace utils{
+        /*! \brief current wall clock time in seconds, monotonic when the clock is available */
+        inline double GetTime( void ){
+#if defined(CLOCK_MONOTONIC)
+            timespec ts;
+            if( clock_gettime( CLOCK_MONOTONIC, &ts ) == 0 ){
+                return static_cast<double>( ts.tv_sec ) + static_cast<double>( ts.tv_nsec ) * 1e-9;
+            }
+#endif
+            timeval tv;
+            gettimeofday( &tv, NULL );
+            return static_cast<double>( tv.tv_sec ) + static_cast<double>( tv.tv_usec ) * 1e-6;
+        }
+    };
+};
+#endif
@@ -0,0 +1,175 @@
+#ifndef _XGBOOST_ZSTREAM_H_
+#define _XGBOOST_ZSTREAM_H_
+/*!
+ * \file xgboost_zstream.h
+ * \brief compressed streams on top of another stream, using deflate of zlib, link with -lz
+ *        compressed data starts with a 4 byte magic followed by a zlib stream, which carries a checksum;
+ *        ZInStream passes data without the magic through unchanged, so it reads both compressed and plain files
+ */
+#include <cstring>
+#include <vector>
+#include <zlib.h>
+#include "xgboost_utils.h"
+#include "xgboost_stream.h"
+
+namespace xgboost{
+    namespace utils{
+        /*! \brief magic at the beginning of compressed data */
+        const char kZStreamMagic[ 4 ] = { 'X', 'G', 'Z', '1' };
+        /*! \brief largest block given to zlib in one call, its counters are 32 bit */
+        const size_t kZStreamMaxBlock = 1 << 30;
+
+        /*!
+         * \brief stream that compresses written data into another stream,
+         *        Finish must be called after the last write, before the underlying stream is closed
+         */
+        class ZOutStream: public IStream{
+        public:
+            /*!
+             * \brief constructor
+             * \param base the underlying stream
+             * \param level compression level from 1 to 9, low level is fast and is usually enough for binary data
+             * \param buffer_size size of output buffer in bytes
+             */
+            ZOutStream( IStream &base, int level = 1, size_t buffer_size = 1 << 20 ):base( base ){
+                memset( &zs, 0, sizeof(zs) );
+                utils::Assert( deflateInit( &zs, level ) == Z_OK, "ZOutStream: fail to init zlib" );
+                out.resize( buffer_size );
+                base.Write( kZStreamMagic, sizeof(kZStreamMagic) );
+                finished = false;
+            }
+            virtual ~ZOutStream( void ){
+                deflateEnd( &zs );
+            }
+            virtual size_t Read( void *ptr, size_t size ){
+                utils::Error( "ZOutStream: read is not supported" ); return 0;
+            }
+            virtual void Write( const void *ptr, size_t size ){
+                utils::Assert( !finished, "ZOutStream: write after Finish" );
+                const char *p = static_cast<const char*>( ptr );
+                while( size != 0 ){
+                    const size_t n = std::min( size, kZStreamMaxBlock );
+                    zs.next_in = reinterpret_cast<Bytef*>( const_cast<char*>( p ) );
+                    zs.avail_in = static_cast<uInt>( n );
+                    this->Deflate( Z_NO_FLUSH );
+                    p += n; size -= n;
+                }
+            }
+            /*! \brief flush the remaining compressed data and end the zlib stream */
+            inline void Finish( void ){
+                if( finished ) return;
+                zs.next_in = NULL; zs.avail_in = 0;
+                this->Deflate( Z_FINISH );
+                finished = true;
+            }
+        private:
+            // run deflate until the input is consumed, or until the stream ends for Z_FINISH
+            inline void Deflate( int flush ){
+                while( true ){
+                    zs.next_out = reinterpret_cast<Bytef*>( &out[0] );
+                    zs.avail_out = static_cast<uInt>( out.size() );
+                    const int ret = deflate( &zs, flush );
+                    utils::Assert( ret == Z_OK || ret == Z_STREAM_END || ret == Z_BUF_ERROR, "ZOutStream: fail to compress" );
+                    const size_t n = out.size() - zs.avail_out;
+                    if( n != 0 ) base.Write( &out[0], n );
+                    if( flush == Z_FINISH ){
+                        if( ret == Z_STREAM_END ) return;
+                    }else{
+                        if( zs.avail_in == 0 && zs.avail_out != 0 ) return;
+                    }
+                }
+            }
+        private:
+            /*! \brief underlying stream */
+            IStream &base;
+            /*! \brief state of zlib */
+            z_stream zs;
+            /*! \brief output buffer */
+            std::vector<char> out;
+            /*! \brief whether Finish is called */
+            bool finished;
+        };
+
+        /*!
+         * \brief stream that reads data written by ZOutStream,
+         *        data that does not start with the magic is read as it is
+         */
+        class ZInStream: public IStream{
+        public:
+            /*!
+             * \brief constructor
+             * \param base the underlying stream
+             * \param buffer_size size of input buffer in bytes
+             */
+            ZInStream( IStream &base, size_t buffer_size = 1 << 20 ):base( base ){
+                memset( &zs, 0, sizeof(zs) );
+                utils::Assert( inflateInit( &zs ) == Z_OK, "ZInStream: fail to init zlib" );
+                in.resize( buffer_size );
+                begin = end = 0;
+                // probe the magic, bytes of plain data are kept in buffer
+                end = this->ReadBase( &in[0], sizeof(kZStreamMagic) );
+                compressed = end == sizeof(kZStreamMagic) && memcmp( &in[0], kZStreamMagic, sizeof(kZStreamMagic) ) == 0;
+                if( compressed ) end = 0;
+                stream_end = false;
+            }
+            virtual ~ZInStream( void ){
+                inflateEnd( &zs );
+            }
+            /*! \brief whether the data is compressed */
+            inline bool IsCompressed( void ) const{
+                return compressed;
+            }
+            virtual size_t Read( void *ptr, size_t size ){
+                char *p = static_cast<char*>( ptr );
+                if( !compressed ){
+                    const size_t n = std::min( size, end - begin );
+                    if( n != 0 ) memcpy( p, &in[ begin ], n );
+                    begin += n;
+                    return n + ( n < size ? base.Read( p + n, size - n ) : 0 );
+                }
+                size_t nread = 0;
+                while( nread < size && !stream_end ){
+                    if( zs.avail_in == 0 ){
+                        zs.next_in = reinterpret_cast<Bytef*>( &in[0] );
+                        zs.avail_in = static_cast<uInt>( base.Read( &in[0], in.size() ) );
+                        utils::Assert( zs.avail_in != 0, "ZInStream: compressed data is truncated" );
+                    }
+                    const size_t n = std::min( size - nread, kZStreamMaxBlock );
+                    zs.next_out = reinterpret_cast<Bytef*>( p + nread );
+                    zs.avail_out = static_cast<uInt>( n );
+                    const int ret = inflate( &zs, Z_NO_FLUSH );
+                    utils::Assert( ret == Z_OK || ret == Z_STREAM_END, "ZInStream: compressed data is corrupted" );
+                    nread += n - zs.avail_out;
+                    if( ret == Z_STREAM_END ) stream_end = true;
+                }
+                return nread;
+            }
+            virtual void Write( const void *ptr, size_t size ){
+                utils::Error( "ZInStream: write is not supported" );
+            }
+        private:
+            // read until size bytes or end of underlying stream
+            inline size_t ReadBase( void *ptr, size_t size ){
+                char *p = static_cast<char*>( ptr );
+                size_t nread = 0;
+                while( nread < size ){
+                    const size_t n = base.Read( p + nread, size - nread );
+                    if( n == 0 ) break;
+                    nread += n;
+                }
+                return nread;
+            }
+        private:
+            /*! \brief underlying stream */
+            IStream &base;
+            /*! \brief state of zlib */
+            z_stream zs;
+            /*! \brief input buffer, holds the probed bytes of plain data in [begin,end) */
+            std::vector<char> in;
+            size_t begin, end;
+            /*! \brief whether the data is compressed, and whether the zlib stream ended */
+            bool compressed, stream_end;
+        };
+    };
+};
+#endif